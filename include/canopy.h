@@ -16,6 +16,7 @@
 #define CANOPY_INCLUDED
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // A CanopyContext holds the internal state used by the libcanopy library.
@@ -30,6 +31,11 @@
 // Most routines in this library require a CanopyContext as the first
 // parameter.
 //
+// A CanopyContext may be shared between threads.  Once its Cloud Variables
+// are initialized and its options are set, any thread may set and get Cloud
+// Variables (each variable has its own lock) while one thread calls
+// canopy_sync.  See "Threads" in docs/cloud_vars_c.md.
+//
 // Creating a CanopyContext initializes this library:
 //
 //     CanopyContext canopy = canopy_init_context();
@@ -37,6 +43,14 @@
 typedef struct CanopyContext_t * CanopyContext;
 
 // A CanopyVarValue represents a value that can be assigned to Cloud Variable.
+//
+// Values (created with CANOPY_VALUE_*) and readers (CANOPY_READ_*) are
+// single-use: canopy_var_set and canopy_var_get consume them, whether or not
+// they succeed, so they are meant to be created inline in the call.  Consumed
+// objects are recycled through a small per-thread pool, so in steady state
+// creating them doesn't allocate.  A consumed value or reader is invalid and
+// must not be used again: it may already have been freed, or handed out
+// again by a later CANOPY_VALUE_* or CANOPY_READ_*.
 typedef struct STCloudVarValue_t * CanopyVarValue;
 
 // A CanopyVarReader represents a destination for reading a Cloud Variable.
@@ -45,6 +59,10 @@ typedef struct STCloudVarReader_t * CanopyVarReader;
 // A CanopyInitObject represents structure fields being initialized.
 typedef struct STCloudVarInitObject_t * CanopyVarInitObject;
 
+// A CanopyVar is a handle to an initialized Cloud Variable.  See
+// canopy_var_handle.
+typedef struct STCloudVar_t * CanopyVar;
+
 typedef int (*CanopyOnChangeCallback)(CanopyContext, const char *, void *);
 
 // A CanopyPromise is a synchronization primitive.  When the libcanopy library
@@ -52,6 +70,10 @@ typedef int (*CanopyOnChangeCallback)(CanopyContext, const char *, void *);
 // can be used to wait for the completion of the event.
 typedef struct CanopyPromise_t * CanopyPromise;
 
+// A CanopyReactor is an event loop (one thread) that services the WebSocket
+// connections of many contexts.  See canopy_use_reactor.
+typedef struct CanopyReactor_t * CanopyReactor;
+
 
 #define CANOPY_SECONDS 1000000
 
@@ -163,7 +185,11 @@ typedef enum
     CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS,
 
     // Operation timed out
-    CANOPY_ERROR_TIMED_OUT
+    CANOPY_ERROR_TIMED_OUT,
+
+    // Too many syncs are already queued.  Local changes are kept, and get
+    // sent by a later sync.
+    CANOPY_ERROR_SYNC_IN_PROGRESS
 } CanopyResultEnum;
 
 // CanopyGlobalOptEnum
@@ -256,7 +282,7 @@ typedef enum
     // must be a boolean.  If true, the calling thread will block until the
     // sync operation completes (either successfully, or with an error, or
     // times out).  If false, the call to canopy_sync will begin synchronizing
-    // in another thread and them immediately return.
+    // in another thread and them immediately return.  Defaults to true.
     CANOPY_SYNC_BLOCKING,
 
     // Configures the amount of time to allow canopy_sync synchronization to
@@ -264,8 +290,54 @@ typedef enum
     // CANOPY_SYNC_BLOCKING is enabled, then this specifies the maximum amount
     // of time the canopy_sync command will block for.  If CANOPY_SYNC_BLOCKING
     // is disabled, then this specifies the maximum amount of time the spawned
-    // synchronization thread will exist for.
-    CANOPY_SYNC_TIMEOUT_MS
+    // synchronization thread will exist for.  Defaults to 10000.
+    CANOPY_SYNC_TIMEOUT_MS,
+
+    // Configures the preferred wire encoding for sync payloads.  The value
+    // must be a CanopyEncodingEnum value.  The preference is offered to the
+    // server during the WebSocket handshake; payloads are only sent in a
+    // binary encoding once the server has accepted it.  HTTP payloads are
+    // always JSON.  Defaults to CANOPY_ENCODING_CBOR.
+    CANOPY_PAYLOAD_ENCODING,
+
+    // Configures how many outbound WebSocket messages may be queued waiting
+    // for the connection to accept them.  Must be a positive integer.  When
+    // the queue reaches this many messages, CANOPY_WS_QUEUE_POLICY applies.
+    // Defaults to 8.
+    CANOPY_WS_QUEUE_HIGH_WATERMARK,
+
+    // Configures the queue length at which a full WebSocket send queue is
+    // considered drained again.  Must be a nonnegative integer no greater
+    // than CANOPY_WS_QUEUE_HIGH_WATERMARK.  Defaults to 2.
+    CANOPY_WS_QUEUE_LOW_WATERMARK,
+
+    // Configures what happens to Cloud Variable updates while the WebSocket
+    // send queue is full.  The value must be a CanopyQueuePolicyEnum value.
+    // Defaults to CANOPY_QUEUE_POLICY_COALESCE.
+    CANOPY_WS_QUEUE_POLICY,
+
+    // Configures how many bytes libwebsockets reads from the connection at a
+    // time.  Larger messages are received in several pieces and reassembled.
+    // Must be a positive integer.  Defaults to 4096.
+    CANOPY_WS_RX_BUFFER_SIZE,
+
+    // Configures the largest WebSocket message accepted from the server, in
+    // bytes.  Larger messages are discarded.  Must be a positive integer.
+    // Defaults to 1048576 (1 MiB).
+    CANOPY_WS_MAX_MESSAGE_SIZE,
+
+    // Configures the shortest and longest waits, in milliseconds, before
+    // reconnecting a lost WebSocket connection.  Each failed attempt in a row
+    // doubles the wait, up to the maximum, and a random part of it is used.
+    // Default to 1000 and 60000.
+    CANOPY_WS_RECONNECT_MIN_MS,
+    CANOPY_WS_RECONNECT_MAX_MS,
+
+    // Configures whether to offer compression (the "deflate-frame"
+    // extension) when opening the WebSocket connection.  If the server
+    // accepts, messages in both directions are compressed.  Takes effect on
+    // the next connection.  Defaults to false.
+    CANOPY_WS_COMPRESSION
 } CanopyOptEnum;
 
 typedef enum
@@ -277,7 +349,14 @@ typedef enum
     CANOPY_VAR_MIN_VALUE,
     CANOPY_VAR_MAX_VALUE,
     CANOPY_VAR_DESCRIPTION,
-    CANOPY_VAR_FIELD
+    CANOPY_VAR_FIELD,
+
+    // Keep up to this many timestamped samples of a basic Cloud Variable
+    // between syncs, instead of just its latest value.  The value must be a
+    // nonnegative int.  Every local set records a sample; the next sync
+    // uploads all of them in one batch.  When the buffer is full, the oldest
+    // sample is overwritten.  Defaults to 0 (latest value only).
+    CANOPY_VAR_BUFFER_SAMPLES
 } CanopyVarConfigEnum;
 
 // CanopyProtocolEnum
@@ -302,6 +381,34 @@ typedef enum {
     CANOPY_PROTOCOL_WSS,
 } CanopyProtocolEnum;
 
+// CanopyEncodingEnum
+//
+// List of wire encodings for sync payloads.
+typedef enum {
+    // JSON text.  Always supported, and used whenever the server hasn't
+    // agreed to anything else.
+    CANOPY_ENCODING_JSON,
+
+    // CBOR (RFC 7049) binary encoding of the same document.  Smaller, and
+    // cheaper to produce and parse, than JSON.
+    CANOPY_ENCODING_CBOR,
+} CanopyEncodingEnum;
+
+// CanopyQueuePolicyEnum
+//
+// What to do with outbound updates when a send queue is full.
+typedef enum {
+    // Keep the updates locally (the Cloud Variables stay dirty) and send
+    // them, merged into one message carrying the latest values, once the
+    // queue has drained.  Nothing is lost.
+    CANOPY_QUEUE_POLICY_COALESCE,
+
+    // Queue the new message and discard the oldest queued one (other than
+    // the connection's handshake, which is always sent).  Everything is
+    // resent in full at the next sync, so the server catches up.
+    CANOPY_QUEUE_POLICY_DROP_OLDEST,
+} CanopyQueuePolicyEnum;
+
 // Initialize libcanopy and create a context.  
 //
 // This may be called multiple times to create multiple contexts, which may be
@@ -389,6 +496,63 @@ CanopyResultEnum canopy_set_global_opt_impl(void *dummy, ...);
 //
 //      Defaults to CANOPY_PROTOCOL_WS
 //
+// CANOPY_PAYLOAD_ENCODING
+//
+//     Configures the preferred wire encoding for sync payloads.  The value
+//     must be a CanopyEncodingEnum value:
+//
+//          CANOPY_ENCODING_JSON
+//          CANOPY_ENCODING_CBOR
+//
+//     The preference is offered to the server during the WebSocket
+//     handshake, and JSON is used until the server accepts it.
+//
+//      Defaults to CANOPY_ENCODING_CBOR
+//
+// CANOPY_WS_QUEUE_HIGH_WATERMARK
+// CANOPY_WS_QUEUE_LOW_WATERMARK
+// CANOPY_WS_QUEUE_POLICY
+//
+//     Configure the bounded queue of outbound WebSocket messages.  Once
+//     HIGH_WATERMARK messages are waiting, the queue is full until it drains
+//     down to LOW_WATERMARK.  While it is full, CANOPY_WS_QUEUE_POLICY
+//     decides what happens to updates:
+//
+//          CANOPY_QUEUE_POLICY_COALESCE
+//          CANOPY_QUEUE_POLICY_DROP_OLDEST
+//
+//      Default to 8, 2 and CANOPY_QUEUE_POLICY_COALESCE.
+//
+// CANOPY_WS_RX_BUFFER_SIZE
+//
+//      Number of bytes read from the WebSocket at a time.  Larger messages
+//      are reassembled from several reads.  Defaults to 4096.
+//
+// CANOPY_WS_MAX_MESSAGE_SIZE
+//
+//      Largest WebSocket message accepted from the server, in bytes.  Larger
+//      messages are discarded.  Defaults to 1048576.
+//
+// CANOPY_WS_RECONNECT_MIN_MS
+// CANOPY_WS_RECONNECT_MAX_MS
+//
+//      When the WebSocket connection is lost, libcanopy reconnects by
+//      itself, waiting a random time between 0 and MIN_MS * 2^n (n = number
+//      of failed attempts so far), but never more than MAX_MS.  An attempt
+//      counts as failed until the server has sent something over the new
+//      connection.  This keeps a
+//      fleet of devices from reconnecting all at once after an outage.  Once
+//      reconnected, all Cloud Variables are resent.  Default to 1000 and
+//      60000.
+//
+// CANOPY_WS_COMPRESSION
+//
+//      Set to true to offer WebSocket compression to the server.  Sync
+//      payloads repeat the same variable names over and over, so they
+//      compress well, at the cost of some CPU time and memory for zlib on the
+//      device.  Servers that don't support it decline, and the connection
+//      goes on uncompressed.  Defaults to false.
+//
 // For example:
 //
 //      canopy_set_opt(ctx);
@@ -420,6 +584,12 @@ CanopyResultEnum canopy_set_opt_impl(CanopyContext ctx, ...);
 //          CANOPY_VAR_MAX_VALUE, 0.0,
 //      );
 //
+// To sample faster than you sync, buffer the values set in between:
+//
+//      canopy_var_init(ctx, "out float32 vibration",
+//          CANOPY_VAR_BUFFER_SAMPLES, 100
+//      );
+//
 // A fixed-length array can be initialized using:
 //
 //      canopy_var_init(ctx, "out float32 cpu_level[8]");
@@ -528,26 +698,28 @@ CanopyVarValue CANOPY_VALUE_ARRAY_IMPL(void * dummy, ...);
 //      canopy_sync(ctx, CANOPY_SYNC_BLOCKING, true);
 //
 CanopyResultEnum canopy_var_set(CanopyContext ctx, const char *varname, CanopyVarValue value);
-#define canopy_var_set_bool(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_BOOL(value))
-#define canopy_var_set_float32(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_FLOAT32(value))
-#define canopy_var_set_float64(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_FLOAT64(value))
-#define canopy_var_set_int8(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_INT8(value))
-#define canopy_var_set_int16(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_INT16(value))
-#define canopy_var_set_int32(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_INT32(value))
-#define canopy_var_set_string(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_STRING(value))
-#define canopy_var_set_uint8(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_UINT8(value))
-#define canopy_var_set_uint16(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_UINT16(value))
-#define canopy_var_set_uint32(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_UINT32(value))
+
+// Typed setters for Cloud Variables with basic datatypes.
+//
+// These behave like canopy_var_set(ctx, varname, CANOPY_VALUE_<TYPE>(value)),
+// but write the value directly into the Cloud Variable's storage without
+// creating a CanopyVarValue object.  Apart from copying strings, they never
+// allocate memory, which makes them suitable for high-rate sampling loops:
+//
+//      canopy_var_set_float32(ctx, "temperature", 43.0f);
+//
+// The Cloud Variable's datatype must match, otherwise
+// CANOPY_ERROR_INCORRECT_DATATYPE is returned.
+CanopyResultEnum canopy_var_set_bool(CanopyContext ctx, const char *varname, bool value);
+CanopyResultEnum canopy_var_set_float32(CanopyContext ctx, const char *varname, float value);
+CanopyResultEnum canopy_var_set_float64(CanopyContext ctx, const char *varname, double value);
+CanopyResultEnum canopy_var_set_int8(CanopyContext ctx, const char *varname, int8_t value);
+CanopyResultEnum canopy_var_set_int16(CanopyContext ctx, const char *varname, int16_t value);
+CanopyResultEnum canopy_var_set_int32(CanopyContext ctx, const char *varname, int32_t value);
+CanopyResultEnum canopy_var_set_string(CanopyContext ctx, const char *varname, const char *value);
+CanopyResultEnum canopy_var_set_uint8(CanopyContext ctx, const char *varname, uint8_t value);
+CanopyResultEnum canopy_var_set_uint16(CanopyContext ctx, const char *varname, uint16_t value);
+CanopyResultEnum canopy_var_set_uint32(CanopyContext ctx, const char *varname, uint32_t value);
 
 CanopyVarReader CANOPY_READ_BOOL(bool *dest);
 
@@ -617,6 +789,142 @@ CanopyResultEnum canopy_var_get(CanopyContext ctx, const char *varname, CanopyVa
     canopy_var_get((ctx), (varname), CANOPY_READ_UINT32(outValue))
 
 
+// Get a handle to an initialized Cloud Variable.
+//
+// Returns NULL if <varname> has not been initialized with canopy_var_init.
+// The handle stays valid until the context is shut down.
+//
+// Looking a Cloud Variable up by name hashes <varname> on every call.  Code
+// that sets or gets the same variable repeatedly can look it up once and then
+// use the canopy_var_handle_* routines, which operate on the Cloud Variable
+// directly:
+//
+//      CanopyVar temperature = canopy_var_handle(ctx, "temperature");
+//      while (1)
+//      {
+//          canopy_var_handle_set_float32(temperature, read_sensor());
+//          ...
+//      }
+CanopyVar canopy_var_handle(CanopyContext ctx, const char *varname);
+
+// Get handles to the members of a struct Cloud Variable.
+//
+// A struct's members are laid out once, at canopy_var_init, in the order
+// they were declared, and are also synced in that order.  A member handle
+// works with every canopy_var_handle_* routine, so resolving members once
+// avoids looking them up by name on every access:
+//
+//      CanopyVar gps = canopy_var_handle(ctx, "gps");
+//      CanopyVar latitude = canopy_var_member(gps, "latitude");
+//      canopy_var_handle_set_float32(latitude, 37.77f);
+//
+// canopy_var_member returns NULL if <var> isn't a struct or has no member
+// called <name>.  canopy_var_member_index returns the member's position
+// (starting at 0), or -1.  canopy_var_member_at returns NULL if <index> is
+// out of range.
+CanopyVar canopy_var_member(CanopyVar var, const char *name);
+int canopy_var_member_index(CanopyVar var, const char *name);
+CanopyVar canopy_var_member_at(CanopyVar var, unsigned index);
+unsigned canopy_var_num_members(CanopyVar var);
+
+// Same as canopy_var_set, canopy_var_get and canopy_var_on_change, but
+// operating on a Cloud Variable handle.  For a struct member handle, the
+// on-change callback is registered under the member's full name, such as
+// "gps.status.ok".
+CanopyResultEnum canopy_var_handle_set(CanopyVar var, CanopyVarValue value);
+CanopyResultEnum canopy_var_handle_get(CanopyVar var, CanopyVarReader dest);
+CanopyResultEnum canopy_var_handle_on_change(CanopyVar var, CanopyOnChangeCallback cb, void *userdata);
+
+// Typed setters operating on a Cloud Variable handle.  Like
+// canopy_var_set_<type>, these write the value in place without allocating
+// (apart from copying strings).
+CanopyResultEnum canopy_var_handle_set_bool(CanopyVar var, bool value);
+CanopyResultEnum canopy_var_handle_set_float32(CanopyVar var, float value);
+CanopyResultEnum canopy_var_handle_set_float64(CanopyVar var, double value);
+CanopyResultEnum canopy_var_handle_set_int8(CanopyVar var, int8_t value);
+CanopyResultEnum canopy_var_handle_set_int16(CanopyVar var, int16_t value);
+CanopyResultEnum canopy_var_handle_set_int32(CanopyVar var, int32_t value);
+CanopyResultEnum canopy_var_handle_set_string(CanopyVar var, const char *value);
+CanopyResultEnum canopy_var_handle_set_uint8(CanopyVar var, uint8_t value);
+CanopyResultEnum canopy_var_handle_set_uint16(CanopyVar var, uint16_t value);
+CanopyResultEnum canopy_var_handle_set_uint32(CanopyVar var, uint32_t value);
+
+// Typed getters operating on a Cloud Variable handle.  These read the value
+// directly without creating a CanopyVarReader object.  Except for
+// canopy_var_handle_get_string, they never take a lock, so they can be
+// called at a high rate (from a control loop, say) without ever waiting for
+// a thread that is setting the variable or syncing.
+// canopy_var_handle_get_string sets <*outValue> to a newly-allocated copy of
+// the string, which the caller must free.
+CanopyResultEnum canopy_var_handle_get_bool(CanopyVar var, bool *outValue);
+CanopyResultEnum canopy_var_handle_get_float32(CanopyVar var, float *outValue);
+CanopyResultEnum canopy_var_handle_get_float64(CanopyVar var, double *outValue);
+CanopyResultEnum canopy_var_handle_get_int8(CanopyVar var, int8_t *outValue);
+CanopyResultEnum canopy_var_handle_get_int16(CanopyVar var, int16_t *outValue);
+CanopyResultEnum canopy_var_handle_get_int32(CanopyVar var, int32_t *outValue);
+CanopyResultEnum canopy_var_handle_get_string(CanopyVar var, char **outValue);
+CanopyResultEnum canopy_var_handle_get_uint8(CanopyVar var, uint8_t *outValue);
+CanopyResultEnum canopy_var_handle_get_uint16(CanopyVar var, uint16_t *outValue);
+CanopyResultEnum canopy_var_handle_get_uint32(CanopyVar var, uint32_t *outValue);
+
+// Bulk accessors for array Cloud Variables.
+//
+// These copy <count> consecutive elements, starting at element <offset>,
+// between the Cloud Variable and a C array, without creating CanopyVarValue
+// or CanopyVarReader objects.  A whole frame of samples can be pushed in one
+// call:
+//
+//      float frame[256];
+//      read_sensor_frame(frame);
+//      canopy_var_set_array_float32(ctx, "spectrum", frame, 0, 256);
+//
+// The Cloud Variable's element datatype must match, otherwise
+// CANOPY_ERROR_INCORRECT_DATATYPE is returned.  If the range doesn't fit in
+// the array, CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS is returned and nothing
+// is copied.  The getters return CANOPY_ERROR_VARIABLE_NOT_SET if any element
+// in the range has never been set.  String arrays aren't supported; use
+// canopy_var_set with CANOPY_VALUE_ARRAY for those.
+CanopyResultEnum canopy_var_set_array_bool(CanopyContext ctx, const char *varname, const bool *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_float32(CanopyContext ctx, const char *varname, const float *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_float64(CanopyContext ctx, const char *varname, const double *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_int8(CanopyContext ctx, const char *varname, const int8_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_int16(CanopyContext ctx, const char *varname, const int16_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_int32(CanopyContext ctx, const char *varname, const int32_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_uint8(CanopyContext ctx, const char *varname, const uint8_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_uint16(CanopyContext ctx, const char *varname, const uint16_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_set_array_uint32(CanopyContext ctx, const char *varname, const uint32_t *src, size_t offset, size_t count);
+
+CanopyResultEnum canopy_var_get_array_bool(CanopyContext ctx, const char *varname, bool *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_float32(CanopyContext ctx, const char *varname, float *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_float64(CanopyContext ctx, const char *varname, double *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_int8(CanopyContext ctx, const char *varname, int8_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_int16(CanopyContext ctx, const char *varname, int16_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_int32(CanopyContext ctx, const char *varname, int32_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_uint8(CanopyContext ctx, const char *varname, uint8_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_uint16(CanopyContext ctx, const char *varname, uint16_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_get_array_uint32(CanopyContext ctx, const char *varname, uint32_t *dest, size_t offset, size_t count);
+
+// Same as the above, but operating on a Cloud Variable handle.
+CanopyResultEnum canopy_var_handle_set_array_bool(CanopyVar var, const bool *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_float32(CanopyVar var, const float *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_float64(CanopyVar var, const double *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_int8(CanopyVar var, const int8_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_int16(CanopyVar var, const int16_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_int32(CanopyVar var, const int32_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_uint8(CanopyVar var, const uint8_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_uint16(CanopyVar var, const uint16_t *src, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_set_array_uint32(CanopyVar var, const uint32_t *src, size_t offset, size_t count);
+
+CanopyResultEnum canopy_var_handle_get_array_bool(CanopyVar var, bool *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_float32(CanopyVar var, float *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_float64(CanopyVar var, double *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_int8(CanopyVar var, int8_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_int16(CanopyVar var, int16_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_int32(CanopyVar var, int32_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_uint8(CanopyVar var, uint8_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_uint16(CanopyVar var, uint16_t *dest, size_t offset, size_t count);
+CanopyResultEnum canopy_var_handle_get_array_uint32(CanopyVar var, uint32_t *dest, size_t offset, size_t count);
+
 // Register a callback that triggers when a Cloud Variable changes.
 //
 // static int handle_temperature(CanopyContext ctx, const char *varname, void *userdata)
@@ -636,14 +944,78 @@ CanopyResultEnum canopy_var_on_change(CanopyContext ctx, const char *varname, Ca
 //
 // Updates the local and remote copies of each Cloud Variable with the latest
 // values.
+//
+// The values to send are captured on the calling thread; the network I/O is
+// done by the context's sync thread.  If CANOPY_SYNC_BLOCKING is enabled,
+// this waits up to CANOPY_SYNC_TIMEOUT_MS for it to finish.  Otherwise it
+// returns immediately, and <promise> (if non-NULL) completes when the sync
+// is done:
+//
+//      CanopyPromise promise = canopy_new_promise();
+//      canopy_set_opt(ctx, CANOPY_SYNC_BLOCKING, false);
+//      canopy_sync(ctx, promise);
+//      // ... do stuff
+//      canopy_promise_wait(promise, 10000);
+//      if (canopy_promise_result(promise) == CANOPY_SUCCESS)
+//          printf("Synchronized with server!\n");
+//      canopy_free_promise(promise);
+//
+// Updates received from the server are applied to the local copies during
+// canopy_sync and canopy_sync_blocking calls, on the calling thread.
 CanopyResultEnum canopy_sync(CanopyContext ctx, CanopyPromise promise);
 
-// Synchronize with the cloud server (blocking the current thread).
+// Synchronize with the cloud server (blocking the current thread for up to
+// <timeout_us> microseconds).
 //
 // Updates the local and remote copies of each Cloud Variable with the latest
-// values.
+// values.  Returns CANOPY_ERROR_TIMED_OUT if the sync doesn't finish in
+// time; it still completes in the background.
 CanopyResultEnum canopy_sync_blocking(CanopyContext ctx, int timeout_us);
 
+// Create a new promise, for use with asynchronous routines such as
+// canopy_sync.  Returns NULL if out of memory.  A promise can be reused for
+// several operations, one at a time.
+CanopyPromise canopy_new_promise();
+
+// Free a promise.  Don't free a promise that an operation in progress is
+// going to complete.
+void canopy_free_promise(CanopyPromise promise);
+
+// Block until <promise> completes, or <timeout_ms> milliseconds elapse.  A
+// negative timeout waits forever.  Returns the promise's result, or
+// CANOPY_ERROR_TIMED_OUT.
+CanopyResultEnum canopy_promise_wait(CanopyPromise promise, int timeout_ms);
+
+// Get the result of the operation that <promise> is tracking, or
+// CANOPY_ERROR_PROMISE_NOT_COMPLETE if it hasn't finished yet.
+CanopyResultEnum canopy_promise_result(CanopyPromise promise);
+
+// Create a reactor: a single thread, waiting on one epoll set, that services
+// the WebSocket connections of any number of contexts.  Without one, each
+// context's sync thread services its own connection, which adds up when a
+// process (such as a gateway or a simulator) runs many contexts.  Returns
+// NULL on failure.
+CanopyReactor canopy_new_reactor();
+
+// Stop and free a reactor.  Shut down all contexts using it first.
+void canopy_free_reactor(CanopyReactor reactor);
+
+// Service <ctx>'s WebSocket connection from <reactor> rather than from the
+// context's own sync thread.  Must be called before the context first
+// connects.  Returns CANOPY_ERROR_SYNC_IN_PROGRESS if it already has.
+//
+//      CanopyReactor reactor = canopy_new_reactor();
+//      for (i = 0; i < numDevices; i++)
+//      {
+//          devices[i] = canopy_init_context();
+//          canopy_use_reactor(devices[i], reactor);
+//          canopy_set_opt(devices[i], CANOPY_DEVICE_UUID, uuids[i], ...);
+//      }
+//
+// CANOPY_WS_COMPRESSION and CANOPY_WS_RX_BUFFER_SIZE are properties of the
+// reactor's libwebsockets context and are ignored for contexts using it.
+CanopyResultEnum canopy_use_reactor(CanopyContext ctx, CanopyReactor reactor);
+
 // Helper routine for performing an operation once in a while.
 // <timer> is a pointer to a long that holds internal state for the time.
 // *timer should be initialized to 0 by your application.
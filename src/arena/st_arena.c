@@ -0,0 +1,159 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena/st_arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _DEFAULT_CHUNK_SIZE (64*1024)
+
+// Every allocation is rounded up to this, so that it is suitably aligned for
+// any type.
+#define _ALIGNMENT (sizeof(long double) > sizeof(void *) ? sizeof(long double) : sizeof(void *))
+
+typedef struct _Chunk_t
+{
+    struct _Chunk_t *prev;
+    size_t size;
+    size_t used;
+    // Chunk's memory follows the header, starting at an aligned offset.
+} _Chunk_t;
+
+#define _HEADER_SIZE ((sizeof(_Chunk_t) + _ALIGNMENT - 1) & ~(_ALIGNMENT - 1))
+
+typedef struct STArena_t
+{
+    // Most recent chunk, which allocations are carved from.  Older chunks are
+    // only kept for freeing.
+    _Chunk_t *current;
+    size_t chunk_size;
+    size_t capacity;
+} STArena_t;
+
+STArena st_arena_new(size_t chunk_size)
+{
+    STArena arena;
+    arena = calloc(1, sizeof(STArena_t));
+    if (!arena)
+    {
+        return NULL;
+    }
+    arena->chunk_size = chunk_size ? chunk_size : _DEFAULT_CHUNK_SIZE;
+    return arena;
+}
+
+void st_arena_free(STArena arena)
+{
+    _Chunk_t *chunk;
+    if (!arena)
+    {
+        return;
+    }
+    chunk = arena->current;
+    while (chunk)
+    {
+        _Chunk_t *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    free(arena);
+}
+
+// Start a new chunk with room for at least <size> bytes.  Large requests get
+// a chunk of exactly their size, which goes behind the current one so that
+// the space left in the current chunk isn't wasted.
+static _Chunk_t * _add_chunk(STArena arena, size_t size)
+{
+    _Chunk_t *chunk;
+    bool dedicated = (size > arena->chunk_size / 4 && arena->current);
+    size_t chunkSize = size;
+
+    if (!dedicated && chunkSize < arena->chunk_size)
+    {
+        chunkSize = arena->chunk_size;
+    }
+
+    chunk = malloc(_HEADER_SIZE + chunkSize);
+    if (!chunk)
+    {
+        return NULL;
+    }
+    chunk->size = chunkSize;
+    chunk->used = 0;
+    arena->capacity += _HEADER_SIZE + chunkSize;
+
+    if (dedicated)
+    {
+        chunk->prev = arena->current->prev;
+        arena->current->prev = chunk;
+    }
+    else
+    {
+        chunk->prev = arena->current;
+        arena->current = chunk;
+    }
+    return chunk;
+}
+
+void * st_arena_alloc(STArena arena, size_t size)
+{
+    _Chunk_t *chunk = arena->current;
+    void *out;
+
+    if (size > SIZE_MAX - _ALIGNMENT)
+    {
+        return NULL;
+    }
+    size = (size + _ALIGNMENT - 1) & ~(_ALIGNMENT - 1);
+
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        chunk = _add_chunk(arena, size);
+        if (!chunk)
+        {
+            return NULL;
+        }
+    }
+    out = (char *)chunk + _HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    memset(out, 0, size);
+    return out;
+}
+
+void * st_arena_calloc(STArena arena, size_t count, size_t size)
+{
+    if (size && count > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+    return st_arena_alloc(arena, count*size);
+}
+
+char * st_arena_strdup(STArena arena, const char *sz)
+{
+    size_t len = strlen(sz) + 1;
+    char *out = st_arena_alloc(arena, len);
+    if (out)
+    {
+        memcpy(out, sz, len);
+    }
+    return out;
+}
+
+size_t st_arena_capacity(STArena arena)
+{
+    return arena->capacity;
+}
@@ -0,0 +1,54 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_ARENA_INCLUDED
+#define ST_ARENA_INCLUDED
+
+// Region allocator for memory that lives as long as its owner.
+//
+// An STArena hands out memory by bumping a pointer through large chunks,
+// and gives it all back at once in st_arena_free; there is no way to free a
+// single allocation.  It suits structures that are built up once and then
+// torn down together, such as a context's cloud variable trees: thousands of
+// small objects cost a handful of mallocs, don't fragment the heap, and need
+// no per-object cleanup.
+//
+// An arena is not thread-safe.  Its owner must serialize allocations.
+
+#include <stddef.h>
+
+typedef struct STArena_t * STArena;
+
+// Create an empty arena.  Memory is obtained in chunks of at least
+// <chunk_size> bytes (0 for a default).  Returns NULL if out of memory.
+STArena st_arena_new(size_t chunk_size);
+
+// Free every allocation made from <arena>, and the arena itself.
+void st_arena_free(STArena arena);
+
+// Allocate <size> zeroed bytes, aligned for any type.  Returns NULL if out
+// of memory.
+void * st_arena_alloc(STArena arena, size_t size);
+
+// Allocate zeroed space for <count> objects of <size> bytes, like calloc.
+void * st_arena_calloc(STArena arena, size_t count, size_t size);
+
+// Copy NUL-terminated string <sz> into the arena.  Returns NULL if out of
+// memory.
+char * st_arena_strdup(STArena arena, const char *sz);
+
+// Get the total number of bytes obtained from malloc so far.
+size_t st_arena_capacity(STArena arena);
+
+#endif // ST_ARENA_INCLUDED
@@ -21,12 +21,15 @@
 #include "http/st_http.h"
 #include "log/st_log.h"
 #include "options/st_options.h"
+#include "promise/st_promise.h"
+#include "reactor/st_reactor.h"
 #include "sync/st_sync.h"
 #include "websocket/st_websocket.h"
 #include "red_json.h"
 #include "red_string.h"
 #include "red_hash.h"
 #include "red_log.h"
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -43,6 +46,10 @@ typedef struct _Global_t
 
 static _Global_t _global;
 
+// Serializes _global_init, so that contexts can be created from several
+// threads at once.
+static pthread_mutex_t _globalLock = PTHREAD_MUTEX_INITIALIZER;
+
 typedef struct CanopyContext_t
 {
     STOptions options;
@@ -51,11 +58,12 @@ typedef struct CanopyContext_t
 
     STWebSocket ws;
 
+    STSync sync;
+
 } CanopyContext_t;
 
-static CanopyResultEnum _global_init()
+static CanopyResultEnum _global_init_locked()
 {
-    // TODO: thread safety?
     // TODO: error handling
 
     // Already initialized?
@@ -85,6 +93,15 @@ static CanopyResultEnum _global_init()
     return CANOPY_SUCCESS;
 }
 
+static CanopyResultEnum _global_init()
+{
+    CanopyResultEnum result;
+    pthread_mutex_lock(&_globalLock);
+    result = _global_init_locked();
+    pthread_mutex_unlock(&_globalLock);
+    return result;
+}
+
 bool canopy_once_every(uint64_t *timer, uint64_t us) {
     // Timer holds the start time.
     struct timespec t;
@@ -142,6 +159,13 @@ CanopyContext canopy_init_context()
         goto fail;
     }
 
+    ctx->sync = st_sync_new(ctx, ctx->options, ctx->ws, ctx->cloudvars);
+    if (!ctx->sync)
+    {
+        RedLog_Error("OOM in canopy_create_ctx");
+        goto fail;
+    }
+
     return ctx;
 fail:
     canopy_shutdown_context(ctx);
@@ -153,9 +177,11 @@ CanopyResultEnum canopy_shutdown_context(CanopyContext ctx)
     st_log_trace("canopy_shutdown_context(0x%p)", ctx);
     if (ctx)
     {
-        st_options_free(ctx->options);
+        // Stop the sync thread before freeing what it uses.
+        st_sync_free(ctx->sync);
         st_websocket_free(ctx->ws);
         st_cloudvar_system_free(ctx->cloudvars);
+        st_options_free(ctx->options);
         free(ctx);
     }
     return CANOPY_SUCCESS;
@@ -300,9 +326,64 @@ void canopy_var_value_free(CanopyVarValue value)
 
 CanopyResultEnum canopy_var_set(CanopyContext ctx, const char *varname, CanopyVarValue value)
 {
-    CanopyResultEnum result;
     STCloudVar var;
     st_log_trace("canopy_var_set(0x%p, %s, ...", ctx, varname);
+
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        if (value && !st_cloudvar_value_already_used(value))
+        {
+            st_cloudvar_value_free(value);
+        }
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+
+    return canopy_var_handle_set(var, value);
+}
+
+CanopyVar canopy_var_handle(CanopyContext ctx, const char *varname)
+{
+    st_log_trace("canopy_var_handle(0x%p, %s)", ctx, varname);
+    return st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+}
+
+CanopyVar canopy_var_member(CanopyVar var, const char *name)
+{
+    int index;
+    st_log_trace("canopy_var_member(0x%p, %s)", var, name);
+    index = st_cloudvar_struct_member_index(var, name);
+    if (index < 0)
+    {
+        return NULL;
+    }
+    return st_cloudvar_struct_member_at(var, (unsigned)index);
+}
+
+int canopy_var_member_index(CanopyVar var, const char *name)
+{
+    return st_cloudvar_struct_member_index(var, name);
+}
+
+CanopyVar canopy_var_member_at(CanopyVar var, unsigned index)
+{
+    return st_cloudvar_struct_member_at(var, index);
+}
+
+unsigned canopy_var_num_members(CanopyVar var)
+{
+    return st_cloudvar_struct_num_members(var);
+}
+
+CanopyResultEnum canopy_var_handle_set(CanopyVar var, CanopyVarValue value)
+{
+    CanopyResultEnum result;
+    st_log_trace("canopy_var_handle_set(0x%p, ...", var);
+    if (!value)
+    {
+        // The CANOPY_VALUE_* constructor ran out of memory.
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
     if (st_cloudvar_value_already_used(value))
     {
         // CanopyVarValue objects are meant to be used once.  If it has been
@@ -310,21 +391,516 @@ CanopyResultEnum canopy_var_set(CanopyContext ctx, const char *varname, CanopyVa
         return CANOPY_ERROR_SINGLE_USE_VALUE_ALREADY_USED;
     }
 
+    st_cloudvar_lock(var);
+    result = st_cloudvar_set_var(var, value);
+    st_cloudvar_unlock(var);
+
+    // <value> is single-use, so recycle it now.  This allows, for example:
+    //      canopy_set_var(ctx, "foo", CANOPY_FLOAT32(100.0f)) 
+    //  to not leak any memory, and since recycled values are pooled per
+    //  thread, the next CANOPY_VALUE_* on this thread won't allocate either.
+    //  It stays marked as used until it is handed out again.
+    st_cloudvar_value_free(value);
+    return result;
+}
+
+// The typed setters skip trace logging, since they are meant for hot loops.
+CanopyResultEnum canopy_var_set_bool(CanopyContext ctx, const char *varname, bool value)
+{
+    STCloudVar var;
     var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
     if (!var)
     {
         return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
     }
+    return st_cloudvar_set_bool(var, value);
+}
 
-    result = st_cloudvar_set_var(var, value);
+CanopyResultEnum canopy_var_set_float32(CanopyContext ctx, const char *varname, float value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_float32(var, value);
+}
 
-    // Mark <value> as used, since it is intended to be single-use.
-    // This allows, for example:
-    //      canopy_set_var(ctx, "foo", CANOPY_FLOAT32(100.0f)) 
-    //  to not leak any memory.
-    //  Although, it does result in an alloc and free for each call.
-    st_cloudvar_value_mark_used(value);
-    return result;
+CanopyResultEnum canopy_var_set_float64(CanopyContext ctx, const char *varname, double value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_float64(var, value);
+}
+
+CanopyResultEnum canopy_var_set_int8(CanopyContext ctx, const char *varname, int8_t value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_int8(var, value);
+}
+
+CanopyResultEnum canopy_var_set_int16(CanopyContext ctx, const char *varname, int16_t value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_int16(var, value);
+}
+
+CanopyResultEnum canopy_var_set_int32(CanopyContext ctx, const char *varname, int32_t value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_int32(var, value);
+}
+
+CanopyResultEnum canopy_var_set_string(CanopyContext ctx, const char *varname, const char *value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_string(var, value);
+}
+
+CanopyResultEnum canopy_var_set_uint8(CanopyContext ctx, const char *varname, uint8_t value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_uint8(var, value);
+}
+
+CanopyResultEnum canopy_var_set_uint16(CanopyContext ctx, const char *varname, uint16_t value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_uint16(var, value);
+}
+
+CanopyResultEnum canopy_var_set_uint32(CanopyContext ctx, const char *varname, uint32_t value)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_uint32(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_bool(CanopyVar var, bool value)
+{
+    return st_cloudvar_set_bool(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_float32(CanopyVar var, float value)
+{
+    return st_cloudvar_set_float32(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_float64(CanopyVar var, double value)
+{
+    return st_cloudvar_set_float64(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_int8(CanopyVar var, int8_t value)
+{
+    return st_cloudvar_set_int8(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_int16(CanopyVar var, int16_t value)
+{
+    return st_cloudvar_set_int16(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_int32(CanopyVar var, int32_t value)
+{
+    return st_cloudvar_set_int32(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_string(CanopyVar var, const char *value)
+{
+    return st_cloudvar_set_string(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_uint8(CanopyVar var, uint8_t value)
+{
+    return st_cloudvar_set_uint8(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_uint16(CanopyVar var, uint16_t value)
+{
+    return st_cloudvar_set_uint16(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_set_uint32(CanopyVar var, uint32_t value)
+{
+    return st_cloudvar_set_uint32(var, value);
+}
+
+CanopyResultEnum canopy_var_handle_get_bool(CanopyVar var, bool *outValue)
+{
+    return st_cloudvar_get_bool(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_float32(CanopyVar var, float *outValue)
+{
+    return st_cloudvar_get_float32(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_float64(CanopyVar var, double *outValue)
+{
+    return st_cloudvar_get_float64(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_int8(CanopyVar var, int8_t *outValue)
+{
+    return st_cloudvar_get_int8(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_int16(CanopyVar var, int16_t *outValue)
+{
+    return st_cloudvar_get_int16(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_int32(CanopyVar var, int32_t *outValue)
+{
+    return st_cloudvar_get_int32(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_string(CanopyVar var, char **outValue)
+{
+    return st_cloudvar_get_string(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_uint8(CanopyVar var, uint8_t *outValue)
+{
+    return st_cloudvar_get_uint8(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_uint16(CanopyVar var, uint16_t *outValue)
+{
+    return st_cloudvar_get_uint16(var, outValue);
+}
+
+CanopyResultEnum canopy_var_handle_get_uint32(CanopyVar var, uint32_t *outValue)
+{
+    return st_cloudvar_get_uint32(var, outValue);
+}
+
+CanopyResultEnum canopy_var_set_array_bool(CanopyContext ctx, const char *varname, const bool *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_bool(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_float32(CanopyContext ctx, const char *varname, const float *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_float32(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_float64(CanopyContext ctx, const char *varname, const double *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_float64(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_int8(CanopyContext ctx, const char *varname, const int8_t *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_int8(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_int16(CanopyContext ctx, const char *varname, const int16_t *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_int16(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_int32(CanopyContext ctx, const char *varname, const int32_t *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_int32(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_uint8(CanopyContext ctx, const char *varname, const uint8_t *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_uint8(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_uint16(CanopyContext ctx, const char *varname, const uint16_t *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_uint16(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_set_array_uint32(CanopyContext ctx, const char *varname, const uint32_t *src, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_set_array_uint32(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_bool(CanopyContext ctx, const char *varname, bool *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_bool(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_float32(CanopyContext ctx, const char *varname, float *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_float32(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_float64(CanopyContext ctx, const char *varname, double *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_float64(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_int8(CanopyContext ctx, const char *varname, int8_t *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_int8(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_int16(CanopyContext ctx, const char *varname, int16_t *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_int16(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_int32(CanopyContext ctx, const char *varname, int32_t *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_int32(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_uint8(CanopyContext ctx, const char *varname, uint8_t *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_uint8(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_uint16(CanopyContext ctx, const char *varname, uint16_t *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_uint16(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_get_array_uint32(CanopyContext ctx, const char *varname, uint32_t *dest, size_t offset, size_t count)
+{
+    STCloudVar var;
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    return st_cloudvar_get_array_uint32(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_bool(CanopyVar var, const bool *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_bool(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_float32(CanopyVar var, const float *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_float32(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_float64(CanopyVar var, const double *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_float64(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_int8(CanopyVar var, const int8_t *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_int8(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_int16(CanopyVar var, const int16_t *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_int16(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_int32(CanopyVar var, const int32_t *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_int32(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_uint8(CanopyVar var, const uint8_t *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_uint8(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_uint16(CanopyVar var, const uint16_t *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_uint16(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_set_array_uint32(CanopyVar var, const uint32_t *src, size_t offset, size_t count)
+{
+    return st_cloudvar_set_array_uint32(var, src, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_bool(CanopyVar var, bool *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_bool(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_float32(CanopyVar var, float *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_float32(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_float64(CanopyVar var, double *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_float64(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_int8(CanopyVar var, int8_t *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_int8(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_int16(CanopyVar var, int16_t *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_int16(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_int32(CanopyVar var, int32_t *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_int32(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_uint8(CanopyVar var, uint8_t *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_uint8(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_uint16(CanopyVar var, uint16_t *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_uint16(var, dest, offset, count);
+}
+
+CanopyResultEnum canopy_var_handle_get_array_uint32(CanopyVar var, uint32_t *dest, size_t offset, size_t count)
+{
+    return st_cloudvar_get_array_uint32(var, dest, offset, count);
 }
 
 CanopyVarReader CANOPY_READ_BOOL(bool *dest)
@@ -407,10 +983,46 @@ CanopyResultEnum canopy_var_get(CanopyContext ctx, const char *varname, CanopyVa
     var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
     if (!var)
     {
+        if (dest && !st_cloudvar_reader_already_used(dest))
+        {
+            st_cloudvar_reader_free(dest);
+        }
         return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
     }
 
-    return st_cloudvar_read_var(var, dest);
+    return canopy_var_handle_get(var, dest);
+}
+
+CanopyResultEnum canopy_var_handle_get(CanopyVar var, CanopyVarReader dest)
+{
+    CanopyResultEnum result;
+    st_log_trace("canopy_var_handle_get(...)");
+    if (!dest)
+    {
+        // The CANOPY_READ_* constructor ran out of memory.
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    if (st_cloudvar_reader_already_used(dest))
+    {
+        return CANOPY_ERROR_SINGLE_USE_VALUE_ALREADY_USED;
+    }
+
+    if (st_cloudvar_is_basic(var) &&
+            st_cloudvar_datatype(var) != CANOPY_DATATYPE_STRING)
+    {
+        // Read without the lock, so that readers never wait for writers.
+        result = st_cloudvar_read_var(var, dest);
+    }
+    else
+    {
+        st_cloudvar_lock(var);
+        result = st_cloudvar_read_var(var, dest);
+        st_cloudvar_unlock(var);
+    }
+
+    // Like values, readers are single-use; recycle it.
+    st_cloudvar_reader_free(dest);
+    return result;
 }
 
 CanopyResultEnum canopy_var_on_change(CanopyContext ctx, const char *varname, CanopyOnChangeCallback cb, void *userdata)
@@ -427,6 +1039,12 @@ CanopyResultEnum canopy_var_on_change(CanopyContext ctx, const char *varname, Ca
     return st_cloudvar_register_on_change_callback(var, cb, userdata);
 }
 
+CanopyResultEnum canopy_var_handle_on_change(CanopyVar var, CanopyOnChangeCallback cb, void *userdata)
+{
+    st_log_trace("canopy_var_handle_on_change(...)");
+    return st_cloudvar_register_on_change_callback(var, cb, userdata);
+}
+
 CanopyResultEnum canopy_var_init_impl(CanopyContext ctx, const char *decl, ...)
 {
     st_log_trace("canopy_var_init(...)");
@@ -440,18 +1058,95 @@ CanopyResultEnum canopy_var_init_impl(CanopyContext ctx, const char *decl, ...)
     return result;
 }
 
+// Start a sync and wait up to <timeout_us> for it to finish.  <promise> may
+// be NULL.
+static CanopyResultEnum _sync_and_wait(CanopyContext ctx, CanopyPromise promise, int64_t timeout_us)
+{
+    CanopyPromise ownPromise = NULL;
+    CanopyResultEnum result;
+
+    if (!promise)
+    {
+        promise = ownPromise = st_promise_new();
+        if (!promise)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    result = st_sync_start(ctx->sync, promise, timeout_us);
+    if (result != CANOPY_SUCCESS)
+    {
+        st_promise_free(ownPromise);
+        return result;
+    }
+
+    result = st_promise_wait(promise, timeout_us);
+    // Apply anything received during the sync right away.
+    st_sync_process_inbound(ctx->sync);
+
+    if (ownPromise)
+    {
+        // After a timeout the sync may still complete it later, so it is
+        // freed whenever that happens.
+        st_promise_abandon(ownPromise);
+    }
+    return result;
+}
+
 CanopyResultEnum canopy_sync_blocking(CanopyContext ctx, int timeout_us)
 {
-    // TODO: don't ignore timeout_us!
     st_log_trace("canopy_sync_blocking(...)");
-    return st_sync(ctx, ctx->options, ctx->ws, ctx->cloudvars);
+    return _sync_and_wait(ctx, NULL, timeout_us);
 }
 
 
 CanopyResultEnum canopy_sync(CanopyContext ctx, CanopyPromise promise)
 {
     st_log_trace("canopy_sync(...)");
-    return st_sync(ctx, ctx->options, ctx->ws, ctx->cloudvars);
+    if (ctx->options->val_CANOPY_SYNC_BLOCKING)
+    {
+        return _sync_and_wait(ctx, promise, 
+                (int64_t)ctx->options->val_CANOPY_SYNC_TIMEOUT_MS * 1000);
+    }
+    return st_sync_start(ctx->sync, promise,
+            (int64_t)ctx->options->val_CANOPY_SYNC_TIMEOUT_MS * 1000);
+}
+
+CanopyPromise canopy_new_promise()
+{
+    return st_promise_new();
+}
+
+void canopy_free_promise(CanopyPromise promise)
+{
+    st_promise_free(promise);
+}
+
+CanopyResultEnum canopy_promise_wait(CanopyPromise promise, int timeout_ms)
+{
+    return st_promise_wait(promise, timeout_ms < 0 ? -1 : (int64_t)timeout_ms * 1000);
+}
+
+CanopyResultEnum canopy_promise_result(CanopyPromise promise)
+{
+    return st_promise_result(promise);
+}
+
+CanopyReactor canopy_new_reactor()
+{
+    return st_reactor_new();
+}
+
+void canopy_free_reactor(CanopyReactor reactor)
+{
+    st_reactor_free(reactor);
+}
+
+CanopyResultEnum canopy_use_reactor(CanopyContext ctx, CanopyReactor reactor)
+{
+    st_log_trace("canopy_use_reactor(0x%p, 0x%p)", ctx, reactor);
+    return st_websocket_set_reactor(ctx->ws, reactor);
 }
 
 void canopy_debug_dump_opts(CanopyContext ctx)
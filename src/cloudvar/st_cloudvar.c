@@ -19,6 +19,9 @@
 #include "red_string.h"
 #include <sddl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 typedef struct STCloudVarStruct_t
@@ -31,17 +34,199 @@ typedef struct STCloudVarArray_t
     RedHash hash; // index -> CanopyVarValue
 } STCloudVarArray_t;
 
+// CanopyVarValue and CanopyVarReader objects are single-use: canopy_var_set
+// and canopy_var_get consume them.  Rather than going back to the heap, a
+// consumed object is pushed onto a small free list belonging to the thread
+// that consumed it, and the next CANOPY_VALUE_* / CANOPY_READ_* on that
+// thread pops it off again.  A thread's pool is freed when the thread exits.
+// Handles to consumed objects are therefore dangling, and reusing one can't
+// be detected.
+#define _POOL_MAX_OBJECTS 64
+
+typedef struct _Pool_t
+{
+    CanopyVarValue values;
+    unsigned num_values;
+    CanopyVarReader readers;
+    unsigned num_readers;
+} _Pool_t;
+
+static pthread_key_t _poolKey;
+static bool _poolKeyValid;
+static pthread_once_t _poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static void _value_destroy(CanopyVarValue value)
+{
+    if (value->array_hash)
+    {
+        RedHash_Free(value->array_hash);
+    }
+    if (value->struct_hash)
+    {
+        RedHash_Free(value->struct_hash);
+    }
+    free(value);
+}
+
+static void _reader_destroy(CanopyVarReader reader)
+{
+    if (reader->hash)
+    {
+        RedHash_Free(reader->hash);
+    }
+    free(reader);
+}
+
+static void _pool_free(void *arg)
+{
+    _Pool_t *pool = (_Pool_t *)arg;
+    while (pool->values)
+    {
+        CanopyVarValue next = pool->values->next_free;
+        _value_destroy(pool->values);
+        pool->values = next;
+    }
+    while (pool->readers)
+    {
+        CanopyVarReader next = pool->readers->next_free;
+        _reader_destroy(pool->readers);
+        pool->readers = next;
+    }
+    free(pool);
+}
+
+// If the key can't be created (the process is out of keys), nothing is
+// pooled.
+static void _pool_key_init(void)
+{
+    _poolKeyValid = (pthread_key_create(&_poolKey, _pool_free) == 0);
+}
+
+// Get the calling thread's pool, creating it if necessary.  Returns NULL if
+// out of memory or thread-specific keys, in which case objects simply aren't
+// pooled.
+static _Pool_t * _pool(void)
+{
+    _Pool_t *pool;
+    pthread_once(&_poolKeyOnce, _pool_key_init);
+    if (!_poolKeyValid)
+    {
+        return NULL;
+    }
+    pool = pthread_getspecific(_poolKey);
+    if (!pool)
+    {
+        pool = calloc(1, sizeof(_Pool_t));
+        if (pool && pthread_setspecific(_poolKey, pool) != 0)
+        {
+            free(pool);
+            pool = NULL;
+        }
+    }
+    return pool;
+}
+
+// Get a blank value, from the pool if possible.
+static CanopyVarValue _value_alloc(CanopyDatatypeEnum datatype)
+{
+    _Pool_t *pool = _pool();
+    CanopyVarValue out;
+    if (pool && pool->values)
+    {
+        out = pool->values;
+        pool->values = out->next_free;
+        pool->num_values--;
+        memset(&out->basic_value, 0, sizeof(out->basic_value));
+        out->used = false;
+        out->next_free = NULL;
+    }
+    else
+    {
+        out = calloc(1, sizeof(STCloudVarValue_t));
+        if (!out)
+        {
+            return NULL;
+        }
+    }
+    out->datatype = datatype;
+    return out;
+}
+
+// Return <value> (already emptied) to the pool, or free it if the pool is
+// full.
+static void _value_recycle(CanopyVarValue value)
+{
+    _Pool_t *pool = _pool();
+    value->used = true;
+    if (!pool || pool->num_values >= _POOL_MAX_OBJECTS)
+    {
+        _value_destroy(value);
+        return;
+    }
+    value->next_free = pool->values;
+    pool->values = value;
+    pool->num_values++;
+}
+
+static CanopyVarReader _reader_alloc(CanopyDatatypeEnum datatype)
+{
+    _Pool_t *pool = _pool();
+    CanopyVarReader out;
+    if (pool && pool->readers)
+    {
+        out = pool->readers;
+        pool->readers = out->next_free;
+        pool->num_readers--;
+        memset(&out->dest, 0, sizeof(out->dest));
+        out->used = false;
+        out->next_free = NULL;
+    }
+    else
+    {
+        out = calloc(1, sizeof(STCloudVarReader_t));
+        if (!out)
+        {
+            return NULL;
+        }
+    }
+    out->datatype = datatype;
+    return out;
+}
+
+static void _reader_recycle(CanopyVarReader reader)
+{
+    _Pool_t *pool = _pool();
+    reader->used = true;
+    if (!pool || pool->num_readers >= _POOL_MAX_OBJECTS)
+    {
+        _reader_destroy(reader);
+        return;
+    }
+    reader->next_free = pool->readers;
+    pool->readers = reader;
+    pool->num_readers++;
+}
+
+// Get an empty hash for an array or struct reader.
+static RedHash _reader_hash(CanopyVarReader reader)
+{
+    if (!reader->hash)
+    {
+        reader->hash = RedHash_New(0);
+    }
+    return reader->hash;
+}
+
 
 
 CanopyVarValue st_cloudvar_value_bool(bool x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_BOOL);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_BOOL;
     out->basic_value.val.val_bool = x;
     return out;
 }
@@ -49,12 +234,11 @@ CanopyVarValue st_cloudvar_value_bool(bool x)
 CanopyVarValue st_cloudvar_value_float32(float x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_FLOAT32);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_FLOAT32;
     out->basic_value.val.val_float32 = x;
     return out;
 }
@@ -62,12 +246,11 @@ CanopyVarValue st_cloudvar_value_float32(float x)
 CanopyVarValue st_cloudvar_value_float64(double x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_FLOAT64);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_FLOAT64;
     out->basic_value.val.val_float64 = x;
     return out;
 }
@@ -76,12 +259,11 @@ CanopyVarValue st_cloudvar_value_float64(double x)
 CanopyVarValue st_cloudvar_value_int8(int8_t x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_INT8);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_INT8;
     out->basic_value.val.val_int8 = x;
     return out;
 }
@@ -89,12 +271,11 @@ CanopyVarValue st_cloudvar_value_int8(int8_t x)
 CanopyVarValue st_cloudvar_value_int16(int16_t x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_INT16);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_INT16;
     out->basic_value.val.val_int16 = x;
     return out;
 }
@@ -102,12 +283,11 @@ CanopyVarValue st_cloudvar_value_int16(int16_t x)
 CanopyVarValue st_cloudvar_value_int32(int32_t x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_INT32);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_INT32;
     out->basic_value.val.val_int32 = x;
     return out;
 }
@@ -115,16 +295,15 @@ CanopyVarValue st_cloudvar_value_int32(int32_t x)
 CanopyVarValue st_cloudvar_value_string(const char *sz)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_STRING);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_STRING;
     out->basic_value.val.val_string = RedString_strdup(sz);
     if (!out->basic_value.val.val_string)
     {
-        free(out);
+        _value_recycle(out);
         return NULL;
     }
     return out;
@@ -133,12 +312,11 @@ CanopyVarValue st_cloudvar_value_string(const char *sz)
 CanopyVarValue st_cloudvar_value_uint8(uint8_t x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_UINT8);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_UINT8;
     out->basic_value.val.val_uint8 = x;
     return out;
 }
@@ -146,12 +324,11 @@ CanopyVarValue st_cloudvar_value_uint8(uint8_t x)
 CanopyVarValue st_cloudvar_value_uint16(uint16_t x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_UINT16);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_UINT16;
     out->basic_value.val.val_uint16 = x;
     return out;
 }
@@ -159,12 +336,11 @@ CanopyVarValue st_cloudvar_value_uint16(uint16_t x)
 CanopyVarValue st_cloudvar_value_uint32(uint32_t x)
 {
     CanopyVarValue out;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_UINT32);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_UINT32;
     out->basic_value.val.val_uint32 = x;
     return out;
 }
@@ -173,16 +349,18 @@ CanopyVarValue st_cloudvar_value_struct(va_list ap)
 {
     CanopyVarValue out;
     char *fieldname;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_STRUCT);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_STRUCT;
-    out->struct_hash = RedHash_New(0);
     if (!out->struct_hash)
     {
-        free(out);
+        out->struct_hash = RedHash_New(0);
+    }
+    if (!out->struct_hash)
+    {
+        _value_recycle(out);
         return NULL;
     }
 
@@ -201,16 +379,18 @@ CanopyVarValue st_cloudvar_value_array(va_list ap)
 {
     CanopyVarValue out;
     int index;
-    out = calloc(1, sizeof(STCloudVarValue_t));
+    out = _value_alloc(CANOPY_DATATYPE_ARRAY);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_ARRAY;
-    out->array_hash = RedHash_New(0);
     if (!out->array_hash)
     {
-        free(out);
+        out->array_hash = RedHash_New(0);
+    }
+    if (!out->array_hash)
+    {
+        _value_recycle(out);
         return NULL;
     }
 
@@ -225,33 +405,61 @@ CanopyVarValue st_cloudvar_value_array(va_list ap)
     return out;
 }
 
+// Recycles <value> and everything it contains.
 void st_cloudvar_value_free(CanopyVarValue value)
 {
-    /*switch (value->datatype)
+    RedHashIterator_t iter;
+    const void *key;
+    const void *hashValue;
+    size_t keySize;
+
+    if (!value)
+    {
+        return;
+    }
+
+    switch (value->datatype)
     {
-        case CANOPY_DATATYPE_FLOAT32:
-            free(value);
-            break;
         case CANOPY_DATATYPE_STRING:
-            free(value->val.val_string);
-            free(value);
+        {
+            // NULL if ownership was transferred to a cloud variable.
+            free(value->basic_value.val.val_string);
             break;
+        }
+        case CANOPY_DATATYPE_STRUCT:
+        {
+            RED_HASH_FOREACH(iter, value->struct_hash, &key, &keySize, &hashValue)
+            {
+                st_cloudvar_value_free((CanopyVarValue)hashValue);
+            }
+            RedHash_Clear(value->struct_hash);
+            break;
+        }
+        case CANOPY_DATATYPE_ARRAY:
+        {
+            RED_HASH_FOREACH(iter, value->array_hash, &key, &keySize, &hashValue)
+            {
+                st_cloudvar_value_free((CanopyVarValue)hashValue);
+            }
+            RedHash_Clear(value->array_hash);
+            break;
+        }
         default:
-            assert(1);
+        {
             break;
-    }*/
-    assert(!"Not implemented");
+        }
+    }
+    _value_recycle(value);
 }
 
 CanopyVarReader st_cloudvar_reader_bool(bool *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_BOOL);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_BOOL;
     out->dest.dest_bool = dest;
     return out;
 }
@@ -259,12 +467,11 @@ CanopyVarReader st_cloudvar_reader_bool(bool *dest)
 CanopyVarReader st_cloudvar_reader_int8(int8_t *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_INT8);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_INT8;
     out->dest.dest_int8 = dest;
     return out;
 }
@@ -272,12 +479,11 @@ CanopyVarReader st_cloudvar_reader_int8(int8_t *dest)
 CanopyVarReader st_cloudvar_reader_uint8(uint8_t *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_UINT8);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_UINT8;
     out->dest.dest_uint8 = dest;
     return out;
 }
@@ -285,12 +491,11 @@ CanopyVarReader st_cloudvar_reader_uint8(uint8_t *dest)
 CanopyVarReader st_cloudvar_reader_int16(int16_t *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_INT16);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_INT16;
     out->dest.dest_int16 = dest;
     return out;
 }
@@ -298,12 +503,11 @@ CanopyVarReader st_cloudvar_reader_int16(int16_t *dest)
 CanopyVarReader st_cloudvar_reader_uint16(uint16_t *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_UINT16);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_UINT16;
     out->dest.dest_uint16 = dest;
     return out;
 }
@@ -311,12 +515,11 @@ CanopyVarReader st_cloudvar_reader_uint16(uint16_t *dest)
 CanopyVarReader st_cloudvar_reader_int32(int32_t *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_INT32);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_INT32;
     out->dest.dest_int32 = dest;
     return out;
 }
@@ -324,12 +527,11 @@ CanopyVarReader st_cloudvar_reader_int32(int32_t *dest)
 CanopyVarReader st_cloudvar_reader_uint32(uint32_t *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_UINT32);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_UINT32;
     out->dest.dest_uint32 = dest;
     return out;
 }
@@ -337,12 +539,11 @@ CanopyVarReader st_cloudvar_reader_uint32(uint32_t *dest)
 CanopyVarReader st_cloudvar_reader_float32(float *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_FLOAT32);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_FLOAT32;
     out->dest.dest_float32 = dest;
     return out;
 }
@@ -350,12 +551,11 @@ CanopyVarReader st_cloudvar_reader_float32(float *dest)
 CanopyVarReader st_cloudvar_reader_float64(double *dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_FLOAT64);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_FLOAT64;
     out->dest.dest_float64 = dest;
     return out;
 }
@@ -363,12 +563,11 @@ CanopyVarReader st_cloudvar_reader_float64(double *dest)
 CanopyVarReader st_cloudvar_reader_string(char **dest)
 {
     CanopyVarReader out;
-    out = malloc(sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_STRING);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_STRING;
     out->dest.dest_string = dest;
     return out;
 }
@@ -378,16 +577,15 @@ CanopyVarReader st_cloudvar_reader_struct(va_list ap)
     CanopyVarReader out;
     char *fieldname;
 
-    out = calloc(1, sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_STRUCT);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_STRUCT;
-    out->dest.struct_hash = RedHash_New(0);
+    out->dest.struct_hash = _reader_hash(out);
     if (!out->dest.struct_hash)
     {
-        free(out);
+        _reader_recycle(out);
         return NULL;
     }
 
@@ -406,16 +604,15 @@ CanopyVarReader st_cloudvar_reader_array(va_list ap)
 {
     CanopyVarReader out;
     int index;
-    out = calloc(1, sizeof(STCloudVarReader_t));
+    out = _reader_alloc(CANOPY_DATATYPE_ARRAY);
     if (!out)
     {
         return NULL;
     }
-    out->datatype = CANOPY_DATATYPE_ARRAY;
-    out->dest.array_hash = RedHash_New(0);
+    out->dest.array_hash = _reader_hash(out);
     if (!out->dest.array_hash)
     {
-        free(out);
+        _reader_recycle(out);
         return NULL;
     }
 
@@ -430,6 +627,31 @@ CanopyVarReader st_cloudvar_reader_array(va_list ap)
     return out;
 }
 
+// Recycles <reader> and any element/member readers it contains.
+void st_cloudvar_reader_free(CanopyVarReader reader)
+{
+    RedHashIterator_t iter;
+    const void *key;
+    const void *hashValue;
+    size_t keySize;
+
+    if (!reader)
+    {
+        return;
+    }
+
+    if ((reader->datatype == CANOPY_DATATYPE_STRUCT ||
+            reader->datatype == CANOPY_DATATYPE_ARRAY) && reader->hash)
+    {
+        RED_HASH_FOREACH(iter, reader->hash, &key, &keySize, &hashValue)
+        {
+            st_cloudvar_reader_free((CanopyVarReader)hashValue);
+        }
+        RedHash_Clear(reader->hash);
+    }
+    _reader_recycle(reader);
+}
+
 const char * st_cloudvar_name(STCloudVar var)
 {
     return sddl_var_name(var->decl);
@@ -438,7 +660,7 @@ const char * st_cloudvar_name(STCloudVar var)
 bool st_cloudvar_has_value(STCloudVar var)
 {
     // TODO: should this be recursive routine?
-    return (var->basic_value != NULL) || !(st_cloudvar_is_basic(var));
+    return var->has_basic_value || !(st_cloudvar_is_basic(var));
 }
 
 typedef struct
@@ -449,21 +671,70 @@ typedef struct
     STCloudVarSystem sys;
 } _CallbackEntry_t;
 
+// Build <var>'s full name in <sys>'s arena: the top-level variable's name,
+// followed by ".<member>" for each struct member on the way down to <var>
+// (for example, "gps.status.ok").
+static char * _full_name(STCloudVarSystem sys, STCloudVar var)
+{
+    STCloudVar v;
+    size_t len = 0;
+    char *out, *end;
+
+    for (v = var; v; v = v->parent)
+    {
+        len += strlen(st_cloudvar_name(v)) + 1;
+    }
+    out = st_arena_alloc(sys->arena, len);
+    if (!out)
+    {
+        return NULL;
+    }
+
+    // Fill in from the end, since the walk goes from <var> up.
+    end = out + len - 1;
+    *end = '\0';
+    for (v = var; v; v = v->parent)
+    {
+        size_t nameLen = strlen(st_cloudvar_name(v));
+        end -= nameLen;
+        memcpy(end, st_cloudvar_name(v), nameLen);
+        if (v->parent)
+        {
+            *--end = '.';
+        }
+    }
+    return out;
+}
+
 CanopyResultEnum st_cloudvar_register_on_change_callback(STCloudVar var, CanopyOnChangeCallback cb, void *userdata)
 {
     _CallbackEntry_t * entry;
+    STCloudVarSystem sys;
+    STCloudVar root;
 
-    entry = calloc(1, sizeof(_CallbackEntry_t));
+    // Only the top-level variable knows its system.
+    root = var;
+    while (root->parent)
+    {
+        root = root->parent;
+    }
+    sys = root->sys;
+
+    entry = st_arena_alloc(sys->arena, sizeof(_CallbackEntry_t));
     if (!entry)
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
     entry->cb = cb;
     entry->userdata = userdata;
-    entry->varname = RedString_strdup(st_cloudvar_name(var));
-    entry->sys = var->sys; // TODO: reference?
+    entry->varname = _full_name(sys, var);
+    if (!entry->varname)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    entry->sys = sys; // TODO: reference?
 
-    RedHash_InsertS(var->sys->callbacks, entry->varname, entry);
+    RedHash_InsertS(sys->callbacks, entry->varname, entry);
 
     // TODO: needed?
     //var->dirty = true;
@@ -568,6 +839,11 @@ void st_cloudvar_value_mark_used(CanopyVarValue value)
     value->used = true;
 }
 
+bool st_cloudvar_reader_already_used(CanopyVarReader reader)
+{
+    return reader->used;
+}
+
 const char * st_cloudvar_direction_string(STCloudVar var)
 {
     CanopyDirectionEnum direction = (CanopyDirectionEnum)sddl_var_direction(var->decl);
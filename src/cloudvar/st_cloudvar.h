@@ -17,6 +17,8 @@
 
 #include <canopy.h>
 #include <stdbool.h>
+#include "arena/st_arena.h"
+#include "codec/st_codec.h"
 #include "options/st_options.h"
 #include <red_json.h>
 
@@ -28,6 +30,10 @@ typedef struct STCloudVarInitOptions_t * STCloudVarInitOptions;
 // variables.
 STCloudVarSystem st_cloudvar_system_new(CanopyContext ctx);
 
+// Get the arena that <sys>'s cloud variable trees are allocated from.  Only
+// used while variables are being initialized.
+STArena st_cloudvar_system_arena(STCloudVarSystem sys);
+
 // Shutdown Cloud Var "system"
 void st_cloudvar_system_free(STCloudVarSystem sys);
 
@@ -38,23 +44,63 @@ bool st_cloudvar_system_contains(STCloudVarSystem sys, const char *varname);
 STCloudVar st_cloudvar_system_lookup_var(STCloudVarSystem sys, const char *varname);
 
 // Have any Cloud Variables been touched since the last call to
-// st_cloudvar_system_clear_dirty?
+// st_cloudvar_system_take_dirty?
 bool st_cloudvar_system_is_dirty(STCloudVarSystem sys);
 
-// Clear system's dirty flag
-void st_cloudvar_system_clear_dirty(STCloudVarSystem sys);
+// Schedule every cloud variable, including its SDDL, to be sent in full at
+// the next sync.  Used when it's unknown what the server has received.
+void st_cloudvar_system_mark_all_dirty(STCloudVarSystem sys);
+
+// Start a sync snapshot: take the list of dirty Cloud Variables, leaving an
+// empty one behind for variables touched from now on, and clear the
+// system's dirty flag.  Returns the number of variables taken.  The taken
+// variables' values stay marked dirty until they are encoded and cleared
+// one at a time (each under its own lock), so writers are never blocked for
+// the whole snapshot.  Only the thread that calls canopy_sync may use the
+// taken list.
+uint32_t st_cloudvar_system_take_dirty(STCloudVarSystem sys);
 
-// Get number of dirty Cloud Variables
-uint32_t st_cloudvar_system_num_dirty(STCloudVarSystem sys);
+// Access a particular taken Cloud Variable by index, in O(1).  Returns NULL
+// if <idx> is out of range.
+STCloudVar st_cloudvar_system_taken_var(STCloudVarSystem sys, uint32_t idx);
 
-// Access a particular dirty Cloud Variable by index.
-STCloudVar st_cloudvar_system_dirty_var(STCloudVarSystem sys, uint32_t idx);
+// Give up on a snapshot: mark every taken Cloud Variable dirty again, in
+// full, so that it goes out with the next one.
+void st_cloudvar_system_restore_taken(STCloudVarSystem sys);
+
+// Loop over each taken Cloud Variable, in the order they were first touched.
+//
+//      uint32_t i;
+//      STCloudVar var;
+//      ST_CLOUDVAR_SYSTEM_FOREACH_TAKEN(sys, i, var)
+//      {
+//          ...
+//      }
+#define ST_CLOUDVAR_SYSTEM_FOREACH_TAKEN(sys, i, var) \
+    for ((i) = 0; \
+            ((var) = st_cloudvar_system_taken_var((sys), (i))) != NULL; \
+            (i)++)
+
+// Make room in the dirty list for <numVars> Cloud Variables, so that
+// st_cloudvar_system_mark_dirty never needs to allocate.
+CanopyResultEnum st_cloudvar_system_reserve_dirty(STCloudVarSystem sys, uint32_t numVars);
 
 // Register a callback that gets triggered when a cloud variable's value
 // changes.
 // TODO: What if multiple callbakcs are registered for single variable?
 CanopyResultEnum st_cloudvar_register_on_change_callback(STCloudVar var, CanopyOnChangeCallback cb, void *userdata);
 
+// Lock/unlock the top-level Cloud Variable that <var> belongs to.  Its lock
+// protects the value and dirty flags of the whole variable, and must be held
+// around st_cloudvar_set_var, st_cloudvar_read_var, st_cloudvar_encode,
+// st_cloudvar_decode and the dirty flag routines.  The typed setters
+// (st_cloudvar_set_float32, ...) and st_cloudvar_get_string take it
+// themselves.  Non-string basic values are guarded by a seqlock as well, so
+// the other typed getters, and st_cloudvar_read_var on a non-string basic
+// variable, don't need it at all.
+void st_cloudvar_lock(STCloudVar var);
+void st_cloudvar_unlock(STCloudVar var);
+
 // Sets Cloud Variable's value.  Consumes <value> (meaning <value> should never
 // be used again)
 CanopyResultEnum st_cloudvar_set_var(STCloudVar var, CanopyVarValue value);
@@ -62,12 +108,14 @@ CanopyResultEnum st_cloudvar_set_var(STCloudVar var, CanopyVarValue value);
 // Get Cloud Variable's value using reader.
 CanopyResultEnum st_cloudvar_read_var(STCloudVar var, CanopyVarReader dest);
 
-// Update Cloud Variable's value from JSON.
-CanopyResultEnum st_cloudvar_update_from_json(STCloudVar var, RedJsonValue json);
+// Update Cloud Variable's value from an incoming payload, reading the next
+// value from <decoder>.
+CanopyResultEnum st_cloudvar_decode(STCloudVar var, STDecoder decoder);
 
 CanopyResultEnum st_cloudvar_set_local_value_from_json(STCloudVarSystem vars, const char *varname, RedJsonValue value);
 
-CanopyResultEnum st_cloudvar_value_to_json(RedJsonValue *out, STCloudVar var);
+// Encode Cloud Variable's value into a payload, recursively.
+CanopyResultEnum st_cloudvar_encode(STEncoder encoder, STCloudVar var);
 
 CanopyVarValue st_cloudvar_value_bool(bool x);
 CanopyVarValue st_cloudvar_value_int8(int8_t x);
@@ -83,6 +131,10 @@ CanopyVarValue st_cloudvar_value_struct(va_list ap);
 CanopyVarValue st_cloudvar_value_array(va_list ap);
 CanopyVarValue st_cloudvar_value_tuple(va_list ap);
 
+// Values and readers are recycled through a per-thread pool rather than
+// freed, so that the CANOPY_VALUE_* and CANOPY_READ_* constructors normally
+// don't allocate.  These release <value>/<reader> and everything nested in
+// it; it must not be used afterwards.
 void st_cloudvar_value_free(CanopyVarValue value);
 
 CanopyVarReader st_cloudvar_reader_bool(bool *dest);
@@ -107,6 +159,7 @@ bool st_cloudvar_has_value(STCloudVar var);
 
 bool st_cloudvar_value_already_used(CanopyVarValue value);
 void st_cloudvar_value_mark_used(CanopyVarValue value);
+bool st_cloudvar_reader_already_used(CanopyVarReader reader);
 
 // Get Cloud Variable's datatype as string
 const char * st_cloudvar_datatype_string(STCloudVar var);
@@ -128,42 +181,162 @@ void st_cloudvar_system_mark_dirty(STCloudVarSystem sys, STCloudVar var);
 
 CanopyDatatypeEnum st_cloudvar_datatype(STCloudVar var);
 
+// Create a cloud variable tree from <options>.  Everything the tree needs
+// for its lifetime is allocated from <arena> (the system's), except for
+// values and name hashes, which st_cloudvar_release frees.
 CanopyResultEnum st_cloudvar_basic_new(
+        STArena arena,
         STCloudVar *out, 
         STCloudVarInitOptions options);
 
 CanopyResultEnum st_cloudvar_array_new(
+        STArena arena,
         STCloudVar *out, 
         STCloudVarInitOptions options);
 
 CanopyResultEnum st_cloudvar_generic_new(
+        STArena arena,
         STCloudVar *out,
         STCloudVarInitOptions options);
 
+// Free the parts of <var>'s subtree that don't live in the system's arena:
+// string values, name hashes and the top-level variable's lock.  Used when
+// the system is freed.
+void st_cloudvar_release(STCloudVar var);
+void st_cloudvar_basic_release(STCloudVar var);
+void st_cloudvar_array_release(STCloudVar var);
+
 CanopyResultEnum st_cloudvar_generic_set(STCloudVar var, CanopyVarValue value);
 
+// Record that <var>'s value has been touched, so that it gets sent at the
+// next sync.  Marks <var> and its ancestors, and puts the top-level variable
+// in the system's dirty list.
+void st_cloudvar_mark_dirty(STCloudVar var);
+
+// Mark every element/member of <var>, recursively, so that its whole value
+// gets sent at the next sync.
+void st_cloudvar_mark_tree_dirty(STCloudVar var);
+
+// Set the value-dirty flags of <var>'s subtree only, without adding it to
+// the system's dirty list.
+void st_cloudvar_mark_subtree_dirty(STCloudVar var);
+
+// Has <var>'s value been touched since the last sync?
+bool st_cloudvar_is_value_dirty(STCloudVar var);
+
+// Clear the value-dirty flags of <var> and its subtree.
+void st_cloudvar_clear_value_dirty(STCloudVar var);
+
 void st_cloudvar_clear_sddl_dirty_flag(STCloudVar var);
 bool st_cloudvar_is_sddl_dirty(STCloudVar var);
 
 CanopyResultEnum st_cloudvar_basic_set(STCloudVar var, CanopyVarValue value);
-CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, RedJsonValue json);
+
+// Typed setters for basic Cloud Variables.  These write the value in place
+// and, apart from copying strings, never allocate.
+CanopyResultEnum st_cloudvar_set_bool(STCloudVar var, bool x);
+CanopyResultEnum st_cloudvar_set_int8(STCloudVar var, int8_t x);
+CanopyResultEnum st_cloudvar_set_uint8(STCloudVar var, uint8_t x);
+CanopyResultEnum st_cloudvar_set_int16(STCloudVar var, int16_t x);
+CanopyResultEnum st_cloudvar_set_uint16(STCloudVar var, uint16_t x);
+CanopyResultEnum st_cloudvar_set_int32(STCloudVar var, int32_t x);
+CanopyResultEnum st_cloudvar_set_uint32(STCloudVar var, uint32_t x);
+CanopyResultEnum st_cloudvar_set_float32(STCloudVar var, float x);
+CanopyResultEnum st_cloudvar_set_float64(STCloudVar var, double x);
+CanopyResultEnum st_cloudvar_set_string(STCloudVar var, const char *sz);
+
+// Typed getters for basic Cloud Variables.  These read the value directly
+// without going through a CanopyVarReader.  Apart from
+// st_cloudvar_get_string, they never block: a read that overlaps a write is
+// simply retried.  st_cloudvar_get_string sets <*dest> to a newly-allocated
+// copy of the string.
+CanopyResultEnum st_cloudvar_get_bool(STCloudVar var, bool *dest);
+CanopyResultEnum st_cloudvar_get_float32(STCloudVar var, float *dest);
+CanopyResultEnum st_cloudvar_get_float64(STCloudVar var, double *dest);
+CanopyResultEnum st_cloudvar_get_int8(STCloudVar var, int8_t *dest);
+CanopyResultEnum st_cloudvar_get_int16(STCloudVar var, int16_t *dest);
+CanopyResultEnum st_cloudvar_get_int32(STCloudVar var, int32_t *dest);
+CanopyResultEnum st_cloudvar_get_string(STCloudVar var, char **dest);
+CanopyResultEnum st_cloudvar_get_uint8(STCloudVar var, uint8_t *dest);
+CanopyResultEnum st_cloudvar_get_uint16(STCloudVar var, uint16_t *dest);
+CanopyResultEnum st_cloudvar_get_uint32(STCloudVar var, uint32_t *dest);
+// Discard the samples buffered by a CANOPY_VAR_BUFFER_SAMPLES variable.
+void st_cloudvar_basic_clear_samples(STCloudVar var);
+
+CanopyResultEnum st_cloudvar_basic_decode(STCloudVar var, STDecoder decoder);
+CanopyResultEnum st_cloudvar_array_decode(STCloudVar var, STDecoder decoder);
+CanopyResultEnum st_cloudvar_struct_decode(STCloudVar var, STDecoder decoder);
 
 CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value);
 
+// Mark every element of array <var> as touched, or as untouched.
+void st_cloudvar_array_mark_elements_dirty(STCloudVar var);
+void st_cloudvar_array_clear_elements_dirty(STCloudVar var);
+
+// Copy <count> elements between array <var> and <src>/<dest>, starting at
+// element <offset>.  The elements must have type <datatype>, which can't be
+// CANOPY_DATATYPE_STRING.  Getting fails with CANOPY_ERROR_VARIABLE_NOT_SET
+// if any element in the range has never been set.
+CanopyResultEnum st_cloudvar_array_set_elements(
+        STCloudVar var,
+        CanopyDatatypeEnum datatype,
+        const void *src,
+        size_t offset,
+        size_t count);
+CanopyResultEnum st_cloudvar_array_get_elements(
+        STCloudVar var,
+        CanopyDatatypeEnum datatype,
+        void *dest,
+        size_t offset,
+        size_t count);
+
+// Typed wrappers around st_cloudvar_array_set_elements and
+// st_cloudvar_array_get_elements.
+CanopyResultEnum st_cloudvar_set_array_bool(STCloudVar var, const bool *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_int8(STCloudVar var, const int8_t *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_uint8(STCloudVar var, const uint8_t *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_int16(STCloudVar var, const int16_t *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_uint16(STCloudVar var, const uint16_t *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_int32(STCloudVar var, const int32_t *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_uint32(STCloudVar var, const uint32_t *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_float32(STCloudVar var, const float *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_set_array_float64(STCloudVar var, const double *src, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_bool(STCloudVar var, bool *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_int8(STCloudVar var, int8_t *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_uint8(STCloudVar var, uint8_t *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_int16(STCloudVar var, int16_t *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_uint16(STCloudVar var, uint16_t *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_int32(STCloudVar var, int32_t *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_uint32(STCloudVar var, uint32_t *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_float32(STCloudVar var, float *dest, size_t offset, size_t count);
+CanopyResultEnum st_cloudvar_get_array_float64(STCloudVar var, double *dest, size_t offset, size_t count);
+
 bool st_cloudvar_is_basic(STCloudVar var);
 
-CanopyResultEnum st_cloudvar_array_value_to_json(RedJsonValue *out, STCloudVar var);
-CanopyResultEnum st_cloudvar_basic_value_to_json(RedJsonValue *out, STCloudVar var);
+CanopyResultEnum st_cloudvar_array_encode(STEncoder encoder, STCloudVar var);
+CanopyResultEnum st_cloudvar_basic_encode(STEncoder encoder, STCloudVar var);
 
 CanopyResultEnum st_cloudvar_basic_read_var(STCloudVar var, CanopyVarReader reader);
 CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader reader);
 
-CanopyResultEnum st_cloudvar_struct_value_to_json(RedJsonValue *out, STCloudVar var);
-CanopyResultEnum st_cloudvar_struct_new(STCloudVar *out, STCloudVarInitOptions options);
+CanopyResultEnum st_cloudvar_struct_encode(STEncoder encoder, STCloudVar var);
+CanopyResultEnum st_cloudvar_struct_new(STArena arena, STCloudVar *out, STCloudVarInitOptions options);
 CanopyResultEnum st_cloudvar_struct_validate_value(STCloudVar var, CanopyVarValue value);
 CanopyResultEnum st_cloudvar_struct_set(STCloudVar var, CanopyVarValue value);
 CanopyResultEnum st_cloudvar_struct_read_var(STCloudVar var, CanopyVarReader reader);
 
+// Look up member <name> of struct <var>, returning its position in
+// declaration order, or -1 if there is no such member (or <var> isn't a
+// struct).
+int st_cloudvar_struct_member_index(STCloudVar var, const char *name);
+
+// Get the member of struct <var> at position <index>, or NULL if out of
+// range.
+STCloudVar st_cloudvar_struct_member_at(STCloudVar var, unsigned index);
+
+// Get the number of members of struct <var> (0 if not a struct).
+unsigned st_cloudvar_struct_num_members(STCloudVar var);
+
 CanopyResultEnum st_cloudvar_tuple_value_to_json(RedJsonValue *out, STCloudVar var);
 CanopyResultEnum st_cloudvar_tuple_new(STCloudVar *out, STCloudVarInitOptions options);
 CanopyResultEnum st_cloudvar_tuple_validate_value(STCloudVar var, CanopyVarValue value);
@@ -172,6 +345,10 @@ CanopyResultEnum st_cloudvar_tuple_read_var(STCloudVar var, CanopyVarReader read
 
 CanopyVarInitObject st_cloudvar_init_field(const char *decl, va_list ap);
 
+// Free options parsed from a canopy_var_init declaration, including any
+// struct members' options.
+void st_cloudvar_free_init_options(STCloudVarInitOptions options);
+
 RedJsonObject st_cloudvar_definition_json(STCloudVar var);
 
 #endif // ST_VARS_INCLUDED
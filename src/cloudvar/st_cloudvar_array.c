@@ -16,33 +16,159 @@
 #include "cloudvar/st_cloudvar_internal.h"
 #include "red_string.h"
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-// Convert array cloud variable's value to JSON, recursively
-CanopyResultEnum st_cloudvar_array_value_to_json(RedJsonValue *out, STCloudVar var)
+// Element bitmaps are arrays of 64-bit words, so that runs of untouched
+// elements can be skipped a word at a time.
+#define _WORD_BITS 64
+#define _NUM_WORDS(numItems) (((numItems) + _WORD_BITS - 1) / _WORD_BITS)
+
+static bool _bit_test(const uint64_t *bits, size_t i)
 {
-    RedJsonObject jsonObj = RedJsonObject_New();
-    unsigned i;
-    for (i = 0; i < var->array_num_items; i++)
+    return (bits[i / _WORD_BITS] >> (i % _WORD_BITS)) & 1;
+}
+
+static void _bit_set(uint64_t *bits, size_t i)
+{
+    bits[i / _WORD_BITS] |= (uint64_t)1 << (i % _WORD_BITS);
+}
+
+// Get a pointer to element <idx>'s value.
+static void * _elem(STCloudVar var, size_t idx)
+{
+    return (char *)var->array_data + idx*var->array_elem_size;
+}
+
+// Copy element <idx> into <out>.
+static void _elem_load(STCloudVar var, size_t idx, STCloudVarBasicValue_t *out)
+{
+    memcpy(&out->val, _elem(var, idx), var->array_elem_size);
+}
+
+// Overwrite element <idx> with <value>, taking ownership of its string (if
+// any) and freeing the previous one.  Doesn't mark the element dirty, since
+// values received from the server mustn't be sent back.
+static void _elem_store(STCloudVar var, size_t idx, const STCloudVarBasicValue_t *value)
+{
+    void *elem = _elem(var, idx);
+    if (var->array_datatype == CANOPY_DATATYPE_STRING &&
+            _bit_test(var->array_set_bits, idx))
+    {
+        free(*(char **)elem);
+    }
+    memcpy(elem, &value->val, var->array_elem_size);
+    _bit_set(var->array_set_bits, idx);
+}
+
+// Like _elem_store, but for local sets: also records that the element was
+// touched, so that it gets sent at the next sync.
+static void _elem_store_dirty(STCloudVar var, size_t idx, const STCloudVarBasicValue_t *value)
+{
+    _elem_store(var, idx, value);
+    _bit_set(var->array_dirty_bits, idx);
+}
+
+void st_cloudvar_array_mark_elements_dirty(STCloudVar var)
+{
+    size_t numWords = _NUM_WORDS(var->array_num_items);
+    memset(var->array_dirty_bits, 0xff, numWords*sizeof(uint64_t));
+}
+
+void st_cloudvar_array_clear_elements_dirty(STCloudVar var)
+{
+    size_t numWords = _NUM_WORDS(var->array_num_items);
+    memset(var->array_dirty_bits, 0, numWords*sizeof(uint64_t));
+}
+
+// Encode array cloud variable's value.  Only elements that have been touched
+// since the last sync are written, as an object keyed by index, so that
+// changing one element of a large array sends just that element.
+CanopyResultEnum st_cloudvar_array_encode(STEncoder encoder, STCloudVar var)
+{
+    size_t numWords = _NUM_WORDS(var->array_num_items);
+    STCloudVarBasicValue_t value;
+    size_t w;
+    char key[24];
+
+    st_encoder_begin_object(encoder);
+    for (w = 0; w < numWords; w++)
     {
-        CanopyResultEnum result;
-        RedJsonValue childValueJson;
-        if (st_cloudvar_has_value(var->array_items[i]))
+        uint64_t bits = var->array_dirty_bits[w] & var->array_set_bits[w];
+        while (bits)
         {
-            result = st_cloudvar_value_to_json(&childValueJson, var->array_items[i]);
+            CanopyResultEnum result;
+            size_t i = w*_WORD_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            snprintf(key, sizeof(key), "%u", (unsigned)i);
+            st_encoder_key(encoder, key);
+            _elem_load(var, i, &value);
+            result = st_cloudvar_basic_encode_value(encoder, var->array_datatype, &value);
             if (result != CANOPY_SUCCESS)
             {
                 return result;
             }
-            char *key = RedString_PrintfToNewChars("%d", i);
-            if (!key)
+        }
+    }
+    st_encoder_end_object(encoder);
+    return st_encoder_result(encoder);
+}
+
+// Update array cloud variable's value from an incoming payload.  Accepts
+// either an array, or an object keyed by element index (the form that
+// st_cloudvar_array_encode produces).
+CanopyResultEnum st_cloudvar_array_decode(STCloudVar var, STDecoder decoder)
+{
+    STCloudVarBasicValue_t value;
+    STTokenEnum token;
+    CanopyResultEnum result;
+    size_t idx = 0;
+    bool isObject;
+
+    token = st_decoder_next(decoder);
+    if (token == ST_TOKEN_ERROR)
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    if (token != ST_TOKEN_BEGIN_ARRAY && token != ST_TOKEN_BEGIN_OBJECT)
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    isObject = (token == ST_TOKEN_BEGIN_OBJECT);
+
+    while (1)
+    {
+        if (isObject)
+        {
+            char *endptr;
+            token = st_decoder_next(decoder);
+            if (token == ST_TOKEN_END_OBJECT)
+                break;
+            if (token != ST_TOKEN_KEY)
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            idx = strtoul(st_decoder_string(decoder), &endptr, 10);
+            if (*endptr != '\0')
+                return CANOPY_ERROR_PROCESSING_PAYLOAD;
+        }
+        else
+        {
+            // Elements are read by st_cloudvar_basic_decode_value, so only
+            // peek for the closing bracket here.
+            if (st_decoder_peek_end(decoder))
             {
-                return CANOPY_ERROR_OUT_OF_MEMORY;
+                st_decoder_next(decoder);
+                break;
             }
-            RedJsonObject_Set(jsonObj, key, childValueJson);
         }
+
+        if (idx >= var->array_num_items)
+            return CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS;
+
+        result = st_cloudvar_basic_decode_value(decoder, var->array_datatype, &value);
+        if (result != CANOPY_SUCCESS)
+            return result;
+        _elem_store(var, idx, &value);
+        idx++;
     }
 
-    *out = RedJsonValue_FromObject(jsonObj);
     return CANOPY_SUCCESS;
 }
 
@@ -50,55 +176,70 @@ CanopyResultEnum st_cloudvar_array_value_to_json(RedJsonValue *out, STCloudVar v
 // Caller is responsible for setting up relationships to parent & cloudvar
 // system.
 CanopyResultEnum st_cloudvar_array_new(
+        STArena arena,
         STCloudVar *out, 
         STCloudVarInitOptions options)
 {
     STCloudVar var;
-    size_t i;
+    size_t numWords;
 
     // Create STCloudVar object for array itself
-    var = calloc(1, sizeof(STCloudVar_t));
+    var = st_arena_alloc(arena, sizeof(STCloudVar_t));
     if (!var)
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
     // TODO: validate numItems
     var->array_num_items = options->array_num_items;
+    var->array_datatype = (CanopyDatatypeEnum)options->array_datatype;
+    var->array_elem_size = st_cloudvar_basic_datatype_size(var->array_datatype);
+    if (var->array_elem_size == 0)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
 
     // Create SDDL declaration
     var->decl = sddl_var_new_array(
             options->array_datatype, 
             options->array_num_items, 
             options->direction, 
-            options->name);
+            RedString_strdup(options->name));
     if (!var->decl)
     {
         return CANOPY_ERROR_UNKNOWN;
     }
 
-    // Create child STCloudVar objects for each array element
-    var->array_items = calloc(var->array_num_items, sizeof(STCloudVar));
-    for (i = 0; i < var->array_num_items; i++)
+    // One buffer for all the elements, plus the two bitmaps.
+    numWords = _NUM_WORDS(var->array_num_items);
+    var->array_data = st_arena_calloc(arena,
+            var->array_num_items ? var->array_num_items : 1,
+            var->array_elem_size);
+    var->array_set_bits = st_arena_calloc(arena, numWords ? numWords : 1, sizeof(uint64_t));
+    var->array_dirty_bits = st_arena_calloc(arena, numWords ? numWords : 1, sizeof(uint64_t));
+    if (!var->array_data || !var->array_set_bits || !var->array_dirty_bits)
     {
-        CanopyResultEnum result;
-
-        // Fake an options object for the array elements.
-        // TODO: This doesn't seem like the cleanest way to handle array
-        // elements.
-        STCloudVarInitOptions_t childOptions;
-        memcpy(&childOptions, options, sizeof(STCloudVarInitOptions_t));
-        childOptions.datatype = childOptions.array_datatype;
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
 
-        result = st_cloudvar_generic_new(&(var->array_items[i]), &childOptions); 
+    *out = var;
+    return CANOPY_SUCCESS;
+}
 
-        if (result != CANOPY_SUCCESS)
+void st_cloudvar_array_release(STCloudVar var)
+{
+    size_t i;
+    if (var->array_datatype != CANOPY_DATATYPE_STRING)
+    {
+        return;
+    }
+    for (i = 0; i < var->array_num_items; i++)
+    {
+        if (_bit_test(var->array_set_bits, i))
         {
-            return result;
+            free(*(char **)_elem(var, i));
         }
     }
-
-    *out = var;
-    return CANOPY_SUCCESS;
+    memset(var->array_set_bits, 0, _NUM_WORDS(var->array_num_items)*sizeof(uint64_t));
 }
 
 CanopyResultEnum st_cloudvar_array_validate_value(STCloudVar var, CanopyVarValue value)
@@ -109,7 +250,6 @@ CanopyResultEnum st_cloudvar_array_validate_value(STCloudVar var, CanopyVarValue
 // Sets an array cloud variable's value
 CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value)
 {
-    CanopyResultEnum result;
     assert(st_cloudvar_datatype(var) == CANOPY_DATATYPE_ARRAY);
 
     // Is variable writeable?
@@ -118,15 +258,7 @@ CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value)
         return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
     }
 
-    // TODO: Validate value before assignment
-    /*result = st_cloudvar_array_validate_value(var, value);
-    if (result != CANOPY_SUCCESS)
-    {
-        return result;
-    }*/
-
-    // Assign value recursively
-    // Loop over each value
+    // Assign each element
     RedHashIterator_t iter;
     const void *key;
     const void *hashValue;
@@ -146,13 +278,19 @@ CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value)
         {
             return CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS;
         }
+        if (elementValue->datatype != var->array_datatype)
+        {
+            return CANOPY_ERROR_INCORRECT_DATATYPE;
+        }
 
-        // Assign value
-        result = st_cloudvar_generic_set(var->array_items[idx], elementValue);
-        if (result != CANOPY_SUCCESS)
+        // Strings are moved rather than copied, so that <elementValue> no
+        // longer owns its string.
+        _elem_store_dirty(var, idx, &elementValue->basic_value);
+        if (elementValue->datatype == CANOPY_DATATYPE_STRING)
         {
-            return result;
+            elementValue->basic_value.val.val_string = NULL;
         }
+        st_cloudvar_mark_dirty(var);
     }
 
     return CANOPY_SUCCESS;
@@ -161,6 +299,7 @@ CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value)
 // Gets an array cloud variable's value
 CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader reader)
 {
+    STCloudVarBasicValue_t value;
     CanopyResultEnum result;
     if (reader->datatype != CANOPY_DATATYPE_ARRAY)
     {
@@ -171,8 +310,7 @@ CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader read
         return CANOPY_ERROR_INCORRECT_DATATYPE;
     }
 
-    // Read values recursively
-    // Loop over each reader
+    // Read each requested element
     RedHashIterator_t iter;
     const void *key;
     const void *hashValue;
@@ -192,9 +330,17 @@ CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader read
         {
             return CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS;
         }
+        if (elementReader->datatype != var->array_datatype)
+        {
+            return CANOPY_ERROR_INCORRECT_DATATYPE;
+        }
+        if (!_bit_test(var->array_set_bits, idx))
+        {
+            return CANOPY_ERROR_VARIABLE_NOT_SET;
+        }
 
-        // Assign value
-        result = st_cloudvar_read_var(var->array_items[idx], elementReader);
+        _elem_load(var, idx, &value);
+        result = st_cloudvar_basic_read_value(elementReader, &value);
         if (result != CANOPY_SUCCESS)
         {
             return result;
@@ -203,3 +349,166 @@ CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader read
 
     return CANOPY_SUCCESS;
 }
+
+// Check that [<offset>, <offset> + <count>) lies within array <var>, whose
+// elements must have type <datatype>.
+static CanopyResultEnum _check_range(
+        STCloudVar var,
+        CanopyDatatypeEnum datatype,
+        size_t offset,
+        size_t count)
+{
+    if (st_cloudvar_datatype(var) != CANOPY_DATATYPE_ARRAY)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (var->array_datatype != datatype)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (offset > var->array_num_items || count > var->array_num_items - offset)
+    {
+        return CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Set or test every bit of <bits> in [<offset>, <offset> + <count>).
+// Whole words in the middle of the range are handled at once.
+static void _bits_set_range(uint64_t *bits, size_t offset, size_t count)
+{
+    size_t end = offset + count;
+    while (offset < end && offset % _WORD_BITS)
+    {
+        _bit_set(bits, offset++);
+    }
+    while (end - offset >= _WORD_BITS)
+    {
+        bits[offset / _WORD_BITS] = ~(uint64_t)0;
+        offset += _WORD_BITS;
+    }
+    while (offset < end)
+    {
+        _bit_set(bits, offset++);
+    }
+}
+
+static bool _bits_all_set(const uint64_t *bits, size_t offset, size_t count)
+{
+    size_t end = offset + count;
+    while (offset < end && offset % _WORD_BITS)
+    {
+        if (!_bit_test(bits, offset++))
+            return false;
+    }
+    while (end - offset >= _WORD_BITS)
+    {
+        if (bits[offset / _WORD_BITS] != ~(uint64_t)0)
+            return false;
+        offset += _WORD_BITS;
+    }
+    while (offset < end)
+    {
+        if (!_bit_test(bits, offset++))
+            return false;
+    }
+    return true;
+}
+
+CanopyResultEnum st_cloudvar_array_set_elements(
+        STCloudVar var,
+        CanopyDatatypeEnum datatype,
+        const void *src,
+        size_t offset,
+        size_t count)
+{
+    CanopyResultEnum result;
+    assert(datatype != CANOPY_DATATYPE_STRING);
+
+    result = _check_range(var, datatype, offset, count);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    if (st_cloudvar_concrete_direction(var) == CANOPY_DIRECTION_IN)
+    {
+        return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
+    }
+    if (count == 0)
+    {
+        return CANOPY_SUCCESS;
+    }
+
+    st_cloudvar_lock(var);
+    memcpy(_elem(var, offset), src, count*var->array_elem_size);
+    _bits_set_range(var->array_set_bits, offset, count);
+    _bits_set_range(var->array_dirty_bits, offset, count);
+    st_cloudvar_mark_dirty(var);
+    st_cloudvar_unlock(var);
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_cloudvar_array_get_elements(
+        STCloudVar var,
+        CanopyDatatypeEnum datatype,
+        void *dest,
+        size_t offset,
+        size_t count)
+{
+    CanopyResultEnum result;
+    assert(datatype != CANOPY_DATATYPE_STRING);
+
+    result = _check_range(var, datatype, offset, count);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+
+    st_cloudvar_lock(var);
+    if (!_bits_all_set(var->array_set_bits, offset, count))
+    {
+        st_cloudvar_unlock(var);
+        return CANOPY_ERROR_VARIABLE_NOT_SET;
+    }
+    memcpy(dest, _elem(var, offset), count*var->array_elem_size);
+    st_cloudvar_unlock(var);
+    return CANOPY_SUCCESS;
+}
+
+// Generate the typed bulk accessors.  The macro expands to something like:
+//
+//      CanopyResultEnum st_cloudvar_set_array_float32(STCloudVar var,
+//              const float *src, size_t offset, size_t count)
+//      {
+//          return st_cloudvar_array_set_elements(var,
+//                  CANOPY_DATATYPE_FLOAT32, src, offset, count);
+//      }
+//
+// plus the matching st_cloudvar_get_array_float32.
+#define _ARRAY_ACCESSORS(suffix, ctype, datatype) \
+    CanopyResultEnum st_cloudvar_set_array_##suffix( \
+            STCloudVar var, \
+            const ctype *src, \
+            size_t offset, \
+            size_t count) \
+    { \
+        return st_cloudvar_array_set_elements(var, datatype, src, offset, count); \
+    } \
+    CanopyResultEnum st_cloudvar_get_array_##suffix( \
+            STCloudVar var, \
+            ctype *dest, \
+            size_t offset, \
+            size_t count) \
+    { \
+        return st_cloudvar_array_get_elements(var, datatype, dest, offset, count); \
+    }
+
+_ARRAY_ACCESSORS(bool, bool, CANOPY_DATATYPE_BOOL)
+_ARRAY_ACCESSORS(int8, int8_t, CANOPY_DATATYPE_INT8)
+_ARRAY_ACCESSORS(uint8, uint8_t, CANOPY_DATATYPE_UINT8)
+_ARRAY_ACCESSORS(int16, int16_t, CANOPY_DATATYPE_INT16)
+_ARRAY_ACCESSORS(uint16, uint16_t, CANOPY_DATATYPE_UINT16)
+_ARRAY_ACCESSORS(int32, int32_t, CANOPY_DATATYPE_INT32)
+_ARRAY_ACCESSORS(uint32, uint32_t, CANOPY_DATATYPE_UINT32)
+_ARRAY_ACCESSORS(float32, float, CANOPY_DATATYPE_FLOAT32)
+_ARRAY_ACCESSORS(float64, double, CANOPY_DATATYPE_FLOAT64)
@@ -16,129 +16,388 @@
 #include "cloudvar/st_cloudvar_internal.h"
 #include "red_string.h"
 #include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+// Start updating the value slot.  Called with the variable's lock held, so
+// there is only ever one writer.
+static void _basic_write_begin(STCloudVar var)
+{
+    __atomic_store_n(&var->value_seq, var->value_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-// Convert basic cloud variable's value to JSON
-CanopyResultEnum st_cloudvar_basic_value_to_json(RedJsonValue *out, STCloudVar var)
+// Finish updating the value slot.
+static void _basic_write_end(STCloudVar var)
+{
+    __atomic_store_n(&var->value_seq, var->value_seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copy the first <size> bytes of the value slot to <dest> without taking the
+// variable's lock.  Returns false if the variable has no value.  Only for
+// non-string datatypes: a string may be freed as soon as it is replaced.
+static bool _basic_load(STCloudVar var, void *dest, size_t size)
+{
+    uint32_t seq;
+    bool hasValue;
+
+    for (;;)
+    {
+        seq = __atomic_load_n(&var->value_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            // A writer is in the middle of an update, which only takes a
+            // few instructions unless it has been preempted.
+            sched_yield();
+            continue;
+        }
+        memcpy(dest, &var->basic_value.val, size);
+        hasValue = var->has_basic_value;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&var->value_seq, __ATOMIC_RELAXED) == seq)
+        {
+            return hasValue;
+        }
+    }
+}
+
+// Overwrite basic cloud variable's value slot with <val>, taking ownership of
+// <val>'s string (if any) and freeing the previous one.
+static void _basic_store(STCloudVar var, const STCloudVarBasicValue_t *val)
+{
+    char *oldString = NULL;
+
+    if (var->has_basic_value &&
+            st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRING)
+    {
+        oldString = var->basic_value.val.val_string;
+    }
+    _basic_write_begin(var);
+    memcpy(&var->basic_value, val, sizeof(STCloudVarBasicValue_t));
+    var->has_basic_value = true;
+    _basic_write_end(var);
+    free(oldString);
+}
+
+// Copy <sz>, about to be stored in a string variable, for its sample buffer.
+// The slot's own string is freed by the next set, so a sample needs a copy.
+// It is made before the set changes anything, so that running out of memory
+// fails the whole set.  *<out> is NULL for unbuffered variables.
+static CanopyResultEnum _basic_copy_sample_string(STCloudVar var, const char *sz, char **out)
 {
-    CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
     *out = NULL;
+    if (var->sample_capacity == 0)
+    {
+        return CANOPY_SUCCESS;
+    }
+    *out = RedString_strdup(sz);
+    if (!*out)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Append the variable's current value to its sample buffer, overwriting the
+// oldest sample if the buffer is full.  For string variables, the sample
+// takes ownership of <sampleString> (from _basic_copy_sample_string).  Does
+// nothing for unbuffered variables.
+static void _basic_record_sample(STCloudVar var, char *sampleString)
+{
+    STCloudVarSample_t *sample;
+    bool isString = (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRING);
+
+    if (var->sample_capacity == 0)
+    {
+        return;
+    }
+
+    if (var->num_samples < var->sample_capacity)
+    {
+        sample = &var->samples[(var->sample_start + var->num_samples) % var->sample_capacity];
+        var->num_samples++;
+    }
+    else
+    {
+        sample = &var->samples[var->sample_start];
+        var->sample_start = (var->sample_start + 1) % var->sample_capacity;
+        if (isString)
+        {
+            free(sample->value.val.val_string);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &sample->time);
+    memcpy(&sample->value, &var->basic_value, sizeof(STCloudVarBasicValue_t));
+    if (isString)
+    {
+        sample->value.val.val_string = sampleString;
+    }
+}
+
+// Finish a local set: buffer the new value and schedule it to be sent.
+static void _basic_touched(STCloudVar var, char *sampleString)
+{
+    st_cloudvar_mark_dirty(var);
+    _basic_record_sample(var, sampleString);
+}
+
+void st_cloudvar_basic_clear_samples(STCloudVar var)
+{
+    uint32_t i;
+    if (st_cloudvar_is_basic(var) &&
+            st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRING)
+    {
+        for (i = 0; i < var->num_samples; i++)
+        {
+            free(var->samples[(var->sample_start + i) % var->sample_capacity].value.val.val_string);
+        }
+    }
+    var->sample_start = 0;
+    var->num_samples = 0;
+}
+
+size_t st_cloudvar_basic_datatype_size(CanopyDatatypeEnum datatype)
+{
+    switch (datatype)
+    {
+        case CANOPY_DATATYPE_BOOL:
+            return sizeof(bool);
+        case CANOPY_DATATYPE_INT8:
+        case CANOPY_DATATYPE_UINT8:
+            return sizeof(int8_t);
+        case CANOPY_DATATYPE_INT16:
+        case CANOPY_DATATYPE_UINT16:
+            return sizeof(int16_t);
+        case CANOPY_DATATYPE_INT32:
+        case CANOPY_DATATYPE_UINT32:
+            return sizeof(int32_t);
+        case CANOPY_DATATYPE_FLOAT32:
+            return sizeof(float);
+        case CANOPY_DATATYPE_FLOAT64:
+            return sizeof(double);
+        case CANOPY_DATATYPE_STRING:
+            return sizeof(char *);
+        case CANOPY_DATATYPE_DATETIME:
+            return sizeof(struct tm);
+        default:
+            return 0;
+    }
+}
+
+CanopyResultEnum st_cloudvar_basic_encode_value(
+        STEncoder encoder,
+        CanopyDatatypeEnum datatype,
+        const STCloudVarBasicValue_t *value)
+{
     switch (datatype)
     {
         case CANOPY_DATATYPE_VOID:
-            *out = RedJsonValue_Null();
+            st_encoder_null(encoder);
             break;
         case CANOPY_DATATYPE_BOOL:
-            *out = RedJsonValue_FromBoolean(var->basic_value->val.val_bool);
+            st_encoder_bool(encoder, value->val.val_bool);
             break;
         case CANOPY_DATATYPE_FLOAT32:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_float32);
+            st_encoder_float32(encoder, value->val.val_float32);
             break;
         case CANOPY_DATATYPE_FLOAT64:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_float64);
+            st_encoder_float64(encoder, value->val.val_float64);
             break;
         case CANOPY_DATATYPE_INT8:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_int8);
+            st_encoder_int(encoder, value->val.val_int8);
             break;
         case CANOPY_DATATYPE_INT16:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_int16);
+            st_encoder_int(encoder, value->val.val_int16);
             break;
         case CANOPY_DATATYPE_INT32:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_int32);
+            st_encoder_int(encoder, value->val.val_int32);
             break;
         case CANOPY_DATATYPE_STRING:
-            *out = RedJsonValue_FromString(var->basic_value->val.val_string);
+            st_encoder_string(encoder, value->val.val_string);
             break;
         case CANOPY_DATATYPE_UINT8:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_uint8);
+            st_encoder_uint(encoder, value->val.val_uint8);
             break;
         case CANOPY_DATATYPE_UINT16:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_uint16);
+            st_encoder_uint(encoder, value->val.val_uint16);
             break;
         case CANOPY_DATATYPE_UINT32:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_uint32);
+            st_encoder_uint(encoder, value->val.val_uint32);
             break;
         default:
             return CANOPY_ERROR_UNKNOWN;
             break;
     }
-    if (*out == NULL)
+    return CANOPY_SUCCESS;
+}
+
+// Format <time> as an RFC 3339 UTC timestamp with microseconds, such as
+// "2014-06-01T12:00:00.250000Z".
+static void _format_timestamp(const struct timespec *time, char *buf, size_t len)
+{
+    struct tm utc;
+    size_t n;
+    gmtime_r(&time->tv_sec, &utc);
+    n = strftime(buf, len, "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(buf + n, len - n, ".%06ldZ", time->tv_nsec / 1000);
+}
+
+// Encode basic cloud variable's value.  If samples have been buffered since
+// the last sync, they are all written, oldest first, as:
+//
+//      [ {"t" : "2014-06-01T12:00:00.250000Z", "v" : VALUE}, ... ]
+//
+// Otherwise just the latest value is written.
+CanopyResultEnum st_cloudvar_basic_encode(STEncoder encoder, STCloudVar var)
+{
+    CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
+    CanopyResultEnum result;
+    char timestamp[40];
+    uint32_t i;
+
+    if (var->num_samples == 0)
     {
-        return CANOPY_ERROR_OUT_OF_MEMORY;
+        result = st_cloudvar_basic_encode_value(encoder, datatype, &var->basic_value);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
+        return st_encoder_result(encoder);
+    }
+
+    st_encoder_begin_array(encoder);
+    for (i = 0; i < var->num_samples; i++)
+    {
+        const STCloudVarSample_t *sample =
+            &var->samples[(var->sample_start + i) % var->sample_capacity];
+        st_encoder_begin_object(encoder);
+        st_encoder_key(encoder, "t");
+        _format_timestamp(&sample->time, timestamp, sizeof(timestamp));
+        st_encoder_string(encoder, timestamp);
+        st_encoder_key(encoder, "v");
+        result = st_cloudvar_basic_encode_value(encoder, datatype, &sample->value);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
+        st_encoder_end_object(encoder);
     }
+    st_encoder_end_array(encoder);
+    return st_encoder_result(encoder);
+}
+
 
+// Decode one number into <out>, for incoming values.
+static CanopyResultEnum _read_number(STDecoder decoder, double *out)
+{
+    STTokenEnum token = st_decoder_next(decoder);
+    if (token == ST_TOKEN_ERROR)
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    if (token != ST_TOKEN_NUMBER || !st_decoder_number(decoder, out))
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
     return CANOPY_SUCCESS;
 }
 
-// This is used for incoming values from the cloud server
-CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, RedJsonValue json)
+CanopyResultEnum st_cloudvar_basic_decode_value(
+        STDecoder decoder,
+        CanopyDatatypeEnum datatype,
+        STCloudVarBasicValue_t *out)
 {
     STCloudVarBasicValue_t newVal;
-    CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
+    STTokenEnum token;
+    CanopyResultEnum result;
+    double number;
     switch (datatype)
     {
         case CANOPY_DATATYPE_BOOL:
-            if (!RedJsonValue_IsBoolean(json))
+            token = st_decoder_next(decoder);
+            if (token == ST_TOKEN_ERROR)
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            if (token != ST_TOKEN_TRUE && token != ST_TOKEN_FALSE)
                 return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_bool = RedJsonValue_GetBoolean(json);
+            newVal.val.val_bool = (token == ST_TOKEN_TRUE);
             break;
-        case CANOPY_DATATYPE_FLOAT32:
-            if (!RedJsonValue_IsNumber(json))
+        case CANOPY_DATATYPE_STRING:
+            token = st_decoder_next(decoder);
+            if (token == ST_TOKEN_ERROR)
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            if (token != ST_TOKEN_STRING)
                 return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_float32 = (float)(RedJsonValue_GetNumber(json));
+            // The variable outlives the payload buffer, so the string must be
+            // copied.
+            newVal.val.val_string = RedString_strdup(st_decoder_string(decoder));
+            if (!newVal.val.val_string)
+                return CANOPY_ERROR_OUT_OF_MEMORY;
             break;
+        case CANOPY_DATATYPE_FLOAT32:
         case CANOPY_DATATYPE_FLOAT64:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_float64 = RedJsonValue_GetNumber(json);
-            break;
         case CANOPY_DATATYPE_INT8:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_int8 = (int8_t)RedJsonValue_GetNumber(json);
-            break;
         case CANOPY_DATATYPE_INT16:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_int16 = (int16_t)RedJsonValue_GetNumber(json);
-            break;
         case CANOPY_DATATYPE_INT32:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_int32 = (int32_t)RedJsonValue_GetNumber(json);
-            break;
-        case CANOPY_DATATYPE_STRING:
-            if (!RedJsonValue_IsString(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_string = RedJsonValue_GetString(json);
-            break;
         case CANOPY_DATATYPE_UINT8:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_uint8 = (uint8_t)RedJsonValue_GetNumber(json);
-            break;
         case CANOPY_DATATYPE_UINT16:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_uint16 = (uint16_t)RedJsonValue_GetNumber(json);
-            break;
         case CANOPY_DATATYPE_UINT32:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_uint32 = (uint32_t)RedJsonValue_GetNumber(json);
+            result = _read_number(decoder, &number);
+            if (result != CANOPY_SUCCESS)
+                return result;
+            switch (datatype)
+            {
+                case CANOPY_DATATYPE_FLOAT32:
+                    newVal.val.val_float32 = (float)number;
+                    break;
+                case CANOPY_DATATYPE_FLOAT64:
+                    newVal.val.val_float64 = number;
+                    break;
+                case CANOPY_DATATYPE_INT8:
+                    newVal.val.val_int8 = (int8_t)number;
+                    break;
+                case CANOPY_DATATYPE_INT16:
+                    newVal.val.val_int16 = (int16_t)number;
+                    break;
+                case CANOPY_DATATYPE_INT32:
+                    newVal.val.val_int32 = (int32_t)number;
+                    break;
+                case CANOPY_DATATYPE_UINT8:
+                    newVal.val.val_uint8 = (uint8_t)number;
+                    break;
+                case CANOPY_DATATYPE_UINT16:
+                    newVal.val.val_uint16 = (uint16_t)number;
+                    break;
+                case CANOPY_DATATYPE_UINT32:
+                    newVal.val.val_uint32 = (uint32_t)number;
+                    break;
+                default:
+                    break;
+            }
             break;
         default:
             return CANOPY_ERROR_UNKNOWN;
             break;
     }
 
-    // Copy value
-    var->basic_value = calloc(1, sizeof(STCloudVarBasicValue_t));
-    if (!var->basic_value)
+    *out = newVal;
+    return CANOPY_SUCCESS;
+}
+
+// This is used for incoming values from the cloud server.  Reads the next
+// value from <decoder> and stores it directly in the variable's value slot.
+CanopyResultEnum st_cloudvar_basic_decode(STCloudVar var, STDecoder decoder)
+{
+    STCloudVarBasicValue_t newVal;
+    CanopyResultEnum result;
+
+    result = st_cloudvar_basic_decode_value(decoder, st_cloudvar_datatype(var), &newVal);
+    if (result != CANOPY_SUCCESS)
     {
-        return CANOPY_ERROR_OUT_OF_MEMORY;
+        return result;
     }
-    memcpy(var->basic_value, &newVal, sizeof(STCloudVarBasicValue_t));
+
+    // Copy value into the variable's slot
+    _basic_store(var, &newVal);
 
     return CANOPY_SUCCESS;
 }
@@ -147,13 +406,14 @@ CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, RedJsonValue
 // Caller is responsible for setting up relationships to parent & cloudvar
 // system.
 CanopyResultEnum st_cloudvar_basic_new(
+        STArena arena,
         STCloudVar *out, 
         STCloudVarInitOptions options)
 {
     STCloudVar var;
 
     // Create STCloudVar object
-    var = calloc(1, sizeof(STCloudVar_t));
+    var = st_arena_alloc(arena, sizeof(STCloudVar_t));
     if (!var)
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
@@ -167,12 +427,33 @@ CanopyResultEnum st_cloudvar_basic_new(
         return CANOPY_ERROR_UNKNOWN;
     }
 
+    if (options->buffer_samples > 0)
+    {
+        var->samples = st_arena_calloc(arena, options->buffer_samples, sizeof(STCloudVarSample_t));
+        if (!var->samples)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        var->sample_capacity = options->buffer_samples;
+    }
+
     // TODO: other properties
 
     *out = var;
     return CANOPY_SUCCESS;
 }
 
+void st_cloudvar_basic_release(STCloudVar var)
+{
+    st_cloudvar_basic_clear_samples(var);
+    if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRING && var->has_basic_value)
+    {
+        free(var->basic_value.val.val_string);
+        var->basic_value.val.val_string = NULL;
+        var->has_basic_value = false;
+    }
+}
+
 CanopyResultEnum st_cloudvar_basic_validate_value(STCloudVar var, CanopyVarValue value)
 {
     // Do datatypes match?
@@ -189,6 +470,7 @@ CanopyResultEnum st_cloudvar_basic_validate_value(STCloudVar var, CanopyVarValue
 CanopyResultEnum st_cloudvar_basic_set(STCloudVar var, CanopyVarValue value)
 {
     CanopyResultEnum result;
+    char *sampleString = NULL;
 
     assert(sddl_var_is_basic(var->decl));
 
@@ -204,64 +486,90 @@ CanopyResultEnum st_cloudvar_basic_set(STCloudVar var, CanopyVarValue value)
         return result;
     }
 
-    // Copy value
-    var->basic_value = calloc(1, sizeof(STCloudVarBasicValue_t));
-    if (!var->basic_value)
+    if (value->datatype == CANOPY_DATATYPE_STRING)
     {
-        return CANOPY_ERROR_OUT_OF_MEMORY;
+        result = _basic_copy_sample_string(var, value->basic_value.val.val_string, &sampleString);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
     }
-    memcpy(var->basic_value, &value->basic_value, sizeof(STCloudVarBasicValue_t));
 
-    // TODO: rethink the dirty flag now that things are recursive
-    if (var->sys)
-        st_cloudvar_system_mark_dirty(var->sys, var);
+    // Copy value into the variable's slot.  Strings are moved rather than
+    // copied, so that <value> no longer owns its string.
+    _basic_store(var, &value->basic_value);
+    if (value->datatype == CANOPY_DATATYPE_STRING)
+    {
+        value->basic_value.val.val_string = NULL;
+    }
 
+    _basic_touched(var, sampleString);
     return CANOPY_SUCCESS;
 }
 
+// Non-string values are read without the variable's lock (see
+// _basic_load); strings need it.
 CanopyResultEnum st_cloudvar_basic_read_var(STCloudVar var, CanopyVarReader reader)
 {
+    STCloudVarBasicValue_t value;
+
     if (st_cloudvar_datatype(var) != reader->datatype)
     {
         return CANOPY_ERROR_INCORRECT_DATATYPE;
     }
 
-    if (!st_cloudvar_has_value(var))
+    if (reader->datatype == CANOPY_DATATYPE_STRING)
+    {
+        if (!var->has_basic_value)
+        {
+            return CANOPY_ERROR_VARIABLE_NOT_SET;
+        }
+        *reader->dest.dest_string = RedString_strdup(var->basic_value.val.val_string);
+        return CANOPY_SUCCESS;
+    }
+
+    if (!_basic_load(var, &value.val, sizeof(value.val)))
     {
         return CANOPY_ERROR_VARIABLE_NOT_SET;
     }
+    return st_cloudvar_basic_read_value(reader, &value);
+}
 
+CanopyResultEnum st_cloudvar_basic_read_value(
+        CanopyVarReader reader,
+        const STCloudVarBasicValue_t *value)
+{
     switch (reader->datatype)
     {
         case CANOPY_DATATYPE_BOOL:
-            *reader->dest.dest_bool = var->basic_value->val.val_bool;
+            *reader->dest.dest_bool = value->val.val_bool;
             break;
         case CANOPY_DATATYPE_FLOAT32:
-            *reader->dest.dest_float32 = var->basic_value->val.val_float32;
+            *reader->dest.dest_float32 = value->val.val_float32;
             break;
         case CANOPY_DATATYPE_FLOAT64:
-            *reader->dest.dest_float64 = var->basic_value->val.val_float64;
+            *reader->dest.dest_float64 = value->val.val_float64;
             break;
         case CANOPY_DATATYPE_INT8:
-            *reader->dest.dest_int8 = var->basic_value->val.val_int8;
+            *reader->dest.dest_int8 = value->val.val_int8;
             break;
         case CANOPY_DATATYPE_INT16:
-            *reader->dest.dest_int16 = var->basic_value->val.val_int16;
+            *reader->dest.dest_int16 = value->val.val_int16;
             break;
         case CANOPY_DATATYPE_INT32:
-            *reader->dest.dest_int32 = var->basic_value->val.val_int32;
+            *reader->dest.dest_int32 = value->val.val_int32;
             break;
         case CANOPY_DATATYPE_STRING:
-            *reader->dest.dest_string = RedString_strdup(var->basic_value->val.val_string);
+            *reader->dest.dest_string = RedString_strdup(value->val.val_string);
             break;
         case CANOPY_DATATYPE_UINT8:
-            *reader->dest.dest_uint8 = var->basic_value->val.val_uint8;
+            *reader->dest.dest_uint8 = value->val.val_uint8;
             break;
         case CANOPY_DATATYPE_UINT16:
-            *reader->dest.dest_uint16 = var->basic_value->val.val_uint16;
+            *reader->dest.dest_uint16 = value->val.val_uint16;
             break;
         case CANOPY_DATATYPE_UINT32:
-            *reader->dest.dest_uint32 = var->basic_value->val.val_uint32;
+            *reader->dest.dest_uint32 = value->val.val_uint32;
             break;
         default:
             return CANOPY_ERROR_UNKNOWN;
@@ -270,3 +578,161 @@ CanopyResultEnum st_cloudvar_basic_read_var(STCloudVar var, CanopyVarReader read
     return CANOPY_SUCCESS;
 }
 
+
+// Check that a basic cloud variable can be assigned a value of <datatype>
+// locally.
+static CanopyResultEnum _basic_check_settable(STCloudVar var, CanopyDatatypeEnum datatype)
+{
+    if (st_cloudvar_datatype(var) != datatype)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (st_cloudvar_concrete_direction(var) == CANOPY_DIRECTION_IN)
+    {
+        return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Generate the typed setters, which write straight into the variable's value
+// slot without going through a CanopyVarValue.  The macro expands to
+// something like:
+//
+//      CanopyResultEnum st_cloudvar_set_float32(STCloudVar var, float x)
+//      {
+//          ...
+//          var->basic_value.val.val_float32 = x;
+//          ...
+//      }
+#define _BASIC_SETTER(suffix, ctype, datatype) \
+    CanopyResultEnum st_cloudvar_set_##suffix(STCloudVar var, ctype x) \
+    { \
+        CanopyResultEnum result; \
+        result = _basic_check_settable(var, datatype); \
+        if (result != CANOPY_SUCCESS) \
+        { \
+            return result; \
+        } \
+        st_cloudvar_lock(var); \
+        _basic_write_begin(var); \
+        var->basic_value.val.val_##suffix = x; \
+        var->has_basic_value = true; \
+        _basic_write_end(var); \
+        _basic_touched(var, NULL); \
+        st_cloudvar_unlock(var); \
+        return CANOPY_SUCCESS; \
+    }
+
+_BASIC_SETTER(bool, bool, CANOPY_DATATYPE_BOOL)
+_BASIC_SETTER(int8, int8_t, CANOPY_DATATYPE_INT8)
+_BASIC_SETTER(uint8, uint8_t, CANOPY_DATATYPE_UINT8)
+_BASIC_SETTER(int16, int16_t, CANOPY_DATATYPE_INT16)
+_BASIC_SETTER(uint16, uint16_t, CANOPY_DATATYPE_UINT16)
+_BASIC_SETTER(int32, int32_t, CANOPY_DATATYPE_INT32)
+_BASIC_SETTER(uint32, uint32_t, CANOPY_DATATYPE_UINT32)
+_BASIC_SETTER(float32, float, CANOPY_DATATYPE_FLOAT32)
+_BASIC_SETTER(float64, double, CANOPY_DATATYPE_FLOAT64)
+
+CanopyResultEnum st_cloudvar_set_string(STCloudVar var, const char *sz)
+{
+    CanopyResultEnum result;
+    STCloudVarBasicValue_t newVal;
+    char *sampleString;
+
+    result = _basic_check_settable(var, CANOPY_DATATYPE_STRING);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+
+    newVal.val.val_string = RedString_strdup(sz);
+    if (!newVal.val.val_string)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    st_cloudvar_lock(var);
+    result = _basic_copy_sample_string(var, sz, &sampleString);
+    if (result != CANOPY_SUCCESS)
+    {
+        st_cloudvar_unlock(var);
+        free(newVal.val.val_string);
+        return result;
+    }
+    _basic_store(var, &newVal);
+    _basic_touched(var, sampleString);
+    st_cloudvar_unlock(var);
+    return CANOPY_SUCCESS;
+}
+
+// Check that a basic cloud variable can be read as <datatype>.
+static CanopyResultEnum _basic_check_gettable(STCloudVar var, CanopyDatatypeEnum datatype)
+{
+    if (st_cloudvar_datatype(var) != datatype)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (!var->has_basic_value)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_SET;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Generate the typed getters.  These never take the variable's lock, so a
+// reader (such as a control loop) is never held up by a thread that is
+// setting the variable, or by a sync.  The macro expands to something like:
+//
+//      CanopyResultEnum st_cloudvar_get_float32(STCloudVar var, float *dest)
+//      {
+//          ...
+//          _basic_load(var, &x, sizeof(float));
+//          ...
+//      }
+#define _BASIC_GETTER(suffix, ctype, datatype) \
+    CanopyResultEnum st_cloudvar_get_##suffix(STCloudVar var, ctype *dest) \
+    { \
+        ctype x; \
+        if (st_cloudvar_datatype(var) != datatype) \
+        { \
+            return CANOPY_ERROR_INCORRECT_DATATYPE; \
+        } \
+        if (!_basic_load(var, &x, sizeof(ctype))) \
+        { \
+            return CANOPY_ERROR_VARIABLE_NOT_SET; \
+        } \
+        *dest = x; \
+        return CANOPY_SUCCESS; \
+    }
+
+_BASIC_GETTER(bool, bool, CANOPY_DATATYPE_BOOL)
+_BASIC_GETTER(int8, int8_t, CANOPY_DATATYPE_INT8)
+_BASIC_GETTER(uint8, uint8_t, CANOPY_DATATYPE_UINT8)
+_BASIC_GETTER(int16, int16_t, CANOPY_DATATYPE_INT16)
+_BASIC_GETTER(uint16, uint16_t, CANOPY_DATATYPE_UINT16)
+_BASIC_GETTER(int32, int32_t, CANOPY_DATATYPE_INT32)
+_BASIC_GETTER(uint32, uint32_t, CANOPY_DATATYPE_UINT32)
+_BASIC_GETTER(float32, float, CANOPY_DATATYPE_FLOAT32)
+_BASIC_GETTER(float64, double, CANOPY_DATATYPE_FLOAT64)
+
+CanopyResultEnum st_cloudvar_get_string(STCloudVar var, char **dest)
+{
+    CanopyResultEnum result;
+    char *out;
+
+    st_cloudvar_lock(var);
+    result = _basic_check_gettable(var, CANOPY_DATATYPE_STRING);
+    if (result != CANOPY_SUCCESS)
+    {
+        st_cloudvar_unlock(var);
+        return result;
+    }
+    out = RedString_strdup(var->basic_value.val.val_string);
+    st_cloudvar_unlock(var);
+
+    if (!out)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    *dest = out;
+    return CANOPY_SUCCESS;
+}
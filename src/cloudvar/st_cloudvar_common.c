@@ -55,15 +55,6 @@ CanopyResultEnum st_cloudvar_parse_init_options(
     options->array_datatype = arrayElementDatatype;
     options->name = RedString_strdup(name);
 
-    if (datatype == SDDL_DATATYPE_STRUCT)
-    {
-        options->struct_hash = RedHash_New(0);
-        if (!options->struct_hash)
-        {
-            return CANOPY_ERROR_OUT_OF_MEMORY;
-        }
-    }
-
     // process varargs
     while ((param = va_arg(ap, CanopyVarConfigEnum)) != 0)
     {
@@ -73,16 +64,30 @@ CanopyResultEnum st_cloudvar_parse_init_options(
             {
                 if (datatype != SDDL_DATATYPE_STRUCT)
                 {
+                    st_cloudvar_free_init_options(options);
                     return CANOPY_ERROR_INVALID_OPT;
                 }
 
                 CanopyVarInitObject childObj = va_arg(ap, CanopyVarInitObject);
                 if (!childObj)
                 {
+                    st_cloudvar_free_init_options(options);
                     return CANOPY_ERROR_INVALID_VALUE;
                 }
 
-                RedHash_InsertS(options->struct_hash, childObj->options->name, childObj->options);
+                STCloudVarInitOptions *members;
+                members = realloc(options->struct_members,
+                        (options->num_struct_members + 1)*sizeof(STCloudVarInitOptions));
+                if (!members)
+                {
+                    st_cloudvar_free_init_options(childObj->options);
+                    free(childObj);
+                    st_cloudvar_free_init_options(options);
+                    return CANOPY_ERROR_OUT_OF_MEMORY;
+                }
+                members[options->num_struct_members++] = childObj->options;
+                options->struct_members = members;
+                free(childObj);
                 break;
             }
             case CANOPY_VAR_DESCRIPTION:
@@ -91,8 +96,25 @@ CanopyResultEnum st_cloudvar_parse_init_options(
                 options->description = RedString_strdup(description);
                 break;
             }
+            case CANOPY_VAR_BUFFER_SAMPLES:
+            {
+                int numSamples = va_arg(ap, int);
+                if (!sddl_datatype_is_basic(datatype))
+                {
+                    st_cloudvar_free_init_options(options);
+                    return CANOPY_ERROR_INVALID_OPT;
+                }
+                if (numSamples < 0)
+                {
+                    st_cloudvar_free_init_options(options);
+                    return CANOPY_ERROR_INVALID_VALUE;
+                }
+                options->buffer_samples = (uint32_t)numSamples;
+                break;
+            }
             default:
             {
+                st_cloudvar_free_init_options(options);
                 return CANOPY_ERROR_INVALID_OPT;
             }
         }
@@ -102,23 +124,44 @@ CanopyResultEnum st_cloudvar_parse_init_options(
     return CANOPY_SUCCESS;
 }
 
+// Options are only needed while the cloud variable is being created, so
+// they live on the heap rather than in the system's arena (children are
+// parsed by CANOPY_INIT_FIELD before the context is even known).
+void st_cloudvar_free_init_options(STCloudVarInitOptions options)
+{
+    unsigned i;
+    if (!options)
+    {
+        return;
+    }
+    for (i = 0; i < options->num_struct_members; i++)
+    {
+        st_cloudvar_free_init_options(options->struct_members[i]);
+    }
+    free(options->struct_members);
+    free(options->name);
+    free(options->description);
+    free(options);
+}
+
 
 // Recursive routine for creating a Cloud Variable instance.
 CanopyResultEnum st_cloudvar_generic_new(
+        STArena arena,
         STCloudVar *out,
         STCloudVarInitOptions options)
 {
     if (sddl_datatype_is_basic(options->datatype))
     {
-        return st_cloudvar_basic_new(out, options);
+        return st_cloudvar_basic_new(arena, out, options);
     }
     else if (options->datatype == SDDL_DATATYPE_ARRAY)
     {
-        return st_cloudvar_array_new(out, options);
+        return st_cloudvar_array_new(arena, out, options);
     }
     else if (options->datatype == SDDL_DATATYPE_STRUCT)
     {
-        return st_cloudvar_struct_new(out, options);
+        return st_cloudvar_struct_new(arena, out, options);
     }
     return CANOPY_ERROR_UNKNOWN;
 }
@@ -140,18 +183,30 @@ CanopyResultEnum st_cloudvar_init_var(STCloudVarSystem sys, const char *decl, va
     var = st_cloudvar_system_lookup_var(sys, options->name);
     if (var)
     {
+        st_cloudvar_free_init_options(options);
         return CANOPY_ERROR_VARIABLE_ALREADY_INITIALIZED;
     }
 
-    // Create new top-level cloud variable and children.
-    result = st_cloudvar_generic_new(&var, options);
+    // Make sure the dirty list can hold every top-level variable.
+    result = st_cloudvar_system_reserve_dirty(sys, RedHash_NumItems(sys->vars) + 1);
+    if (result != CANOPY_SUCCESS)
+    {
+        st_cloudvar_free_init_options(options);
+        return result;
+    }
+
+    // Create new top-level cloud variable and children.  If this fails
+    // part-way, whatever was allocated stays in the arena until shutdown.
+    result = st_cloudvar_generic_new(st_cloudvar_system_arena(sys), &var, options);
+    st_cloudvar_free_init_options(options);
     if (result != CANOPY_SUCCESS)
     {
         return result;
     }
 
     // Add it to the system
-    RedHash_InsertS(sys->vars, options->name, var);
+    pthread_mutex_init(&var->lock, NULL);
+    RedHash_InsertS(sys->vars, st_cloudvar_name(var), var);
     st_cloudvar_system_mark_dirty(sys, var);
     var->sddl_dirty_flag = true;
     var->sys = sys;
@@ -159,6 +214,32 @@ CanopyResultEnum st_cloudvar_init_var(STCloudVarSystem sys, const char *decl, va
     return CANOPY_SUCCESS;
 }
 
+void st_cloudvar_release(STCloudVar var)
+{
+    unsigned i;
+    if (st_cloudvar_is_basic(var))
+    {
+        st_cloudvar_basic_release(var);
+    }
+    else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_ARRAY)
+    {
+        st_cloudvar_array_release(var);
+    }
+    for (i = 0; i < var->struct_num_members; i++)
+    {
+        st_cloudvar_release(var->struct_members[i]);
+    }
+    if (var->struct_hash)
+    {
+        RedHash_Free(var->struct_hash);
+        var->struct_hash = NULL;
+    }
+    if (!var->parent)
+    {
+        pthread_mutex_destroy(&var->lock);
+    }
+}
+
 // recursive
 CanopyResultEnum st_cloudvar_generic_set(STCloudVar var, CanopyVarValue value)
 {
@@ -190,12 +271,99 @@ CanopyResultEnum st_cloudvar_set_var(
         return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
     }
 
-    st_cloudvar_system_mark_dirty(var->sys, var);
-
-    // recursive part
+    // recursive part: each element/member that gets assigned marks itself
+    // (and us) dirty.
     return st_cloudvar_generic_set(var, value);
 }
 
+void st_cloudvar_lock(STCloudVar var)
+{
+    while (var->parent)
+    {
+        var = var->parent;
+    }
+    pthread_mutex_lock(&var->lock);
+}
+
+void st_cloudvar_unlock(STCloudVar var)
+{
+    while (var->parent)
+    {
+        var = var->parent;
+    }
+    pthread_mutex_unlock(&var->lock);
+}
+
+void st_cloudvar_mark_dirty(STCloudVar var)
+{
+    // Walk up to the top-level variable.  Stop early at an ancestor that is
+    // already dirty: everything above it is dirty too.
+    while (!var->value_dirty)
+    {
+        var->value_dirty = true;
+        if (!var->parent)
+        {
+            break;
+        }
+        var = var->parent;
+    }
+    while (var->parent)
+    {
+        var = var->parent;
+    }
+    if (var->sys)
+    {
+        st_cloudvar_system_mark_dirty(var->sys, var);
+    }
+}
+
+void st_cloudvar_mark_subtree_dirty(STCloudVar var)
+{
+    unsigned i;
+
+    var->value_dirty = true;
+    if (var->array_dirty_bits)
+    {
+        st_cloudvar_array_mark_elements_dirty(var);
+    }
+    for (i = 0; i < var->struct_num_members; i++)
+    {
+        st_cloudvar_mark_subtree_dirty(var->struct_members[i]);
+    }
+}
+
+void st_cloudvar_mark_tree_dirty(STCloudVar var)
+{
+    st_cloudvar_mark_subtree_dirty(var);
+    st_cloudvar_mark_dirty(var);
+}
+
+bool st_cloudvar_is_value_dirty(STCloudVar var)
+{
+    return var->value_dirty;
+}
+
+void st_cloudvar_clear_value_dirty(STCloudVar var)
+{
+    unsigned i;
+
+    // A clean variable has a clean subtree, so only descend into dirty ones.
+    if (!var->value_dirty)
+    {
+        return;
+    }
+    var->value_dirty = false;
+    st_cloudvar_basic_clear_samples(var);
+    if (var->array_dirty_bits)
+    {
+        st_cloudvar_array_clear_elements_dirty(var);
+    }
+    for (i = 0; i < var->struct_num_members; i++)
+    {
+        st_cloudvar_clear_value_dirty(var->struct_members[i]);
+    }
+}
+
 void st_cloudvar_clear_sddl_dirty_flag(STCloudVar var)
 {
     var->sddl_dirty_flag = false;
@@ -206,32 +374,40 @@ bool st_cloudvar_is_sddl_dirty(STCloudVar var)
     return var->sddl_dirty_flag;
 }
 
-// Convert cloud variable's value to JSON, recursively
-CanopyResultEnum st_cloudvar_value_to_json(RedJsonValue *out, STCloudVar var)
+// Encode cloud variable's value, recursively
+CanopyResultEnum st_cloudvar_encode(STEncoder encoder, STCloudVar var)
 {
-    // Call appropriate value_to_json routine
+    // Call appropriate encode routine
     if (st_cloudvar_is_basic(var))
     {
-        return st_cloudvar_basic_value_to_json(out, var);
+        return st_cloudvar_basic_encode(encoder, var);
     }
     else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_ARRAY)
     {
-        return st_cloudvar_array_value_to_json(out, var);
+        return st_cloudvar_array_encode(encoder, var);
     }
     else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRUCT)
     {
-        return st_cloudvar_struct_value_to_json(out, var);
+        return st_cloudvar_struct_encode(encoder, var);
     }
 
    return CANOPY_ERROR_UNKNOWN;
 }
 
 // This is used for incoming values from the cloud server
-CanopyResultEnum st_cloudvar_update_from_json(STCloudVar var, RedJsonValue json)
+CanopyResultEnum st_cloudvar_decode(STCloudVar var, STDecoder decoder)
 {
     if (st_cloudvar_is_basic(var))
     {
-        return st_cloudvar_basic_update_from_json(var, json);
+        return st_cloudvar_basic_decode(var, decoder);
+    }
+    else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_ARRAY)
+    {
+        return st_cloudvar_array_decode(var, decoder);
+    }
+    else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRUCT)
+    {
+        return st_cloudvar_struct_decode(var, decoder);
     }
     return CANOPY_ERROR_NOT_IMPLEMENTED;
 }
@@ -268,6 +444,7 @@ CanopyVarInitObject st_cloudvar_init_field(const char *decl, va_list ap)
     result = st_cloudvar_parse_init_options(&out->options, decl, ap);
     if (result != CANOPY_SUCCESS)
     {
+        free(out);
         return NULL;
     }
     return out;
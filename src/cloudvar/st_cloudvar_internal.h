@@ -18,6 +18,8 @@
 #include <sddl.h>
 #include <red_hash.h>
 #include <canopy.h>
+#include "codec/st_codec.h"
+#include <pthread.h>
 #include <time.h>
 
 // Recursive structure representing options passed to canopy_var_init.
@@ -68,9 +70,9 @@ typedef struct STCloudVarInitOptions_t
     // (Array only) Datatype of array elements
     SDDLDatatypeEnum array_datatype;
 
-    // (Struct only) Options for child members
-    // Hash: "name" -> STCloudVarOptions
-    RedHash struct_hash;
+    // (Struct only) Options for child members, in declaration order
+    struct STCloudVarInitOptions_t **struct_members;
+    unsigned num_struct_members;
 
     // (Tuple only) Options for child members
     // Hash: "name" -> STCloudVarOptions
@@ -78,14 +80,55 @@ typedef struct STCloudVarInitOptions_t
 
     // Description provided with CANOPY_VAR_DESCRIPTION
     char *description;
+
+    // (Basic only) Sample buffer size provided with CANOPY_VAR_BUFFER_SAMPLES
+    uint32_t buffer_samples;
 } STCloudVarInitOptions_t;
 
+// Concurrency model:
+//
+//  - <vars> and <callbacks> are only modified while variables are being
+//    initialized, which must be finished before the context is shared
+//    between threads.  After that, looking variables up needs no lock.
+//
+//  - Each top-level cloud variable has its own <lock>, which protects its
+//    value, samples and dirty flags, and those of all its elements and
+//    members.  Setters on different variables never contend.
+//
+//  - <dirty_lock> protects the dirty list, <dirty> and each variable's
+//    <dirty> flag.  It is only held for a few instructions at a time, and is
+//    taken with a variable's lock already held (never the other way round).
+//
+//  - A sync snapshot moves the dirty list aside (see
+//    st_cloudvar_system_take_dirty) and then encodes the variables in it one
+//    at a time, each under its own lock, so it never blocks writers for
+//    longer than it takes to encode one variable.
 struct STCloudVarSystem_t {
     bool dirty;
     CanopyContext context;
     RedHash vars; // maps (char *varname) -> (STCloudVar var)
-    RedHash dirty_vars; // maps (char *varname) -> void 
     RedHash callbacks; // maps (char *varname) -> (STOptions)
+
+    // Holds every cloud variable tree and callback entry, so that they are
+    // all freed at once with the system.
+    STArena arena;
+
+    pthread_mutex_t dirty_lock;
+
+    // Dense list of the top-level cloud variables that have been touched
+    // since the last sync, in the order they were first touched.  A variable
+    // is in this list iff its <dirty> flag is set, so it never holds more
+    // entries than <vars>.  Capacity is grown when variables are initialized,
+    // so that marking a variable dirty never allocates.
+    STCloudVar *dirty_list;
+    uint32_t num_dirty;
+    uint32_t dirty_list_capacity;
+
+    // The dirty list taken by the sync in progress.  Same capacity as
+    // <dirty_list>; the two are swapped rather than copied.  Only used by
+    // the thread that calls canopy_sync.
+    STCloudVar *taken_list;
+    uint32_t num_taken;
 };
 
 typedef struct STCloudVarBasicValue_t {
@@ -105,6 +148,12 @@ typedef struct STCloudVarBasicValue_t {
     } val;
 } STCloudVarBasicValue_t;
 
+// A basic value, and when it was set.
+typedef struct STCloudVarSample_t {
+    struct timespec time;
+    STCloudVarBasicValue_t value;
+} STCloudVarSample_t;
+
 // STCloudVar_t is a recursive structure representing a cloud variable
 // instance.
 //
@@ -118,24 +167,76 @@ typedef struct STCloudVar_t
     // Cloud variable system that owns this cloud variable.
     STCloudVarSystem sys;
 
+    // (Top-level only) Protects the value and dirty flags of this variable
+    // and its whole subtree.  See st_cloudvar_lock.
+    pthread_mutex_t lock;
+
+    // Array or struct that this cloud variable is an element/member of, or
+    // NULL for a top-level cloud variable.
+    STCloudVar parent;
+
     // Cloud variable's declaration: Recursive structure containing datatype,
     // qualifiers, and metadata for this cloud variable.
     SDDLVarDecl decl;
 
-    // If cloud variable has a basic datatype, this holds its value.
-    STCloudVarBasicValue_t * basic_value;
+    // If cloud variable has a basic datatype, this holds its value.  The slot
+    // is part of the variable itself so that setting a value never allocates
+    // (except to copy strings).  <has_basic_value> is false until the first
+    // set.
+    STCloudVarBasicValue_t basic_value;
+    bool has_basic_value;
+
+    // Sequence counter (seqlock) guarding <basic_value> and
+    // <has_basic_value>, so that non-string values can be read without
+    // taking <lock>.  Writers (which still hold <lock>) make it odd while
+    // they update the slot and even again afterwards; a reader retries if it
+    // saw an odd count, or if the count changed while it was copying.
+    uint32_t value_seq;
 
-    // If cloud variable is an array, this holds its child elements.
+    // If cloud variable was initialized with CANOPY_VAR_BUFFER_SAMPLES, ring
+    // buffer of the values set locally since the last sync.  The oldest
+    // sample is at samples[sample_start].  Allocated once, at init.
+    STCloudVarSample_t *samples;
+    uint32_t sample_capacity;
+    uint32_t sample_start;
+    uint32_t num_samples;
+
+    // If cloud variable is an array, its elements are stored contiguously in
+    // <array_data>: <array_num_items> values of <array_datatype>, each
+    // <array_elem_size> bytes (laid out like the matching member of
+    // STCloudVarBasicValue_t; a string element is a char * that the array
+    // owns).  Elements have no STCloudVar of their own; they share the
+    // array's declaration.  Bit i of <array_set_bits> is set once element i
+    // has a value, and bit i of <array_dirty_bits> while it has been touched
+    // since the last sync.  Everything is allocated once, at init.
     size_t array_num_items;
-    STCloudVar *array_items;
+    CanopyDatatypeEnum array_datatype;
+    size_t array_elem_size;
+    void *array_data;
+    uint64_t *array_set_bits;
+    uint64_t *array_dirty_bits;
 
-    // If cloud variable is a struct, this holds its child members.
+    // If cloud variable is a struct, its members in declaration order.  The
+    // table is built once, at init, and never changes afterwards, so a
+    // member's position (<member_index>) can be used in place of its name.
+    // <struct_hash> maps names to members, for resolving names once.
     // Hash Table: name --> STCloudVar
+    STCloudVar *struct_members;
+    unsigned struct_num_members;
     RedHash struct_hash;
 
-    // Has this cloud variable's value been touched since last sync?
+    // (Struct members only) Position in the parent's <struct_members>.
+    unsigned member_index;
+
+    // Is this (top-level) cloud variable in the system's dirty list?
     bool dirty;
 
+    // Has this cloud variable's value been touched since last sync?  For
+    // arrays and structs: has any element's/member's value been touched?
+    // Whenever a variable's flag is set, so are all its ancestors', so a
+    // clean variable always has a clean subtree.
+    bool value_dirty;
+
     // Has this cloud variable's SDDL been changed since last sync?
     bool sddl_dirty_flag;
 } STCloudVar_t;
@@ -151,6 +252,10 @@ typedef struct STCloudVarValue_t {
     RedHash struct_hash;
 
     bool used;
+
+    // Next object in the thread's pool of recycled values (see
+    // st_cloudvar_value_free).  Recycled values keep their (emptied) hashes.
+    struct STCloudVarValue_t *next_free;
 } STCloudVarValue_t;
 
 typedef struct STCloudVarReader_t {
@@ -173,6 +278,13 @@ typedef struct STCloudVarReader_t {
         RedHash struct_hash;
     } dest;
 
+    // Hash that backs <dest.array_hash> or <dest.struct_hash>.  Kept apart
+    // from <dest> so that it survives recycling (see st_cloudvar_reader_free)
+    // and can be reused, emptied, by the next array or struct reader.
+    RedHash hash;
+
+    // Next object in the thread's pool of recycled readers.
+    struct STCloudVarReader_t *next_free;
 } STCloudVarReader_t;
 
 typedef struct STCloudVarInitObject_t
@@ -182,4 +294,28 @@ typedef struct STCloudVarInitObject_t
     STCloudVarInitOptions options;
 } STCloudVarInitObject_t;
 
+// Get the number of bytes a value of basic <datatype> takes in
+// STCloudVarBasicValue_t (and in an array's element buffer), or 0 if
+// <datatype> isn't basic.
+size_t st_cloudvar_basic_datatype_size(CanopyDatatypeEnum datatype);
+
+// Encode one basic value of <datatype>.
+CanopyResultEnum st_cloudvar_basic_encode_value(
+        STEncoder encoder,
+        CanopyDatatypeEnum datatype,
+        const STCloudVarBasicValue_t *value);
+
+// Decode one basic value of <datatype> into <out>.  A string is copied into
+// a new allocation, which <out> then owns.
+CanopyResultEnum st_cloudvar_basic_decode_value(
+        STDecoder decoder,
+        CanopyDatatypeEnum datatype,
+        STCloudVarBasicValue_t *out);
+
+// Copy <value> to <reader>'s destination.  The reader's datatype must
+// already have been checked.  A string is copied into a new allocation.
+CanopyResultEnum st_cloudvar_basic_read_value(
+        CanopyVarReader reader,
+        const STCloudVarBasicValue_t *value);
+
 #endif // ST_CLOUDVAR_INTERNAL_INCLUDED
@@ -17,31 +17,61 @@
 #include "red_string.h"
 #include <assert.h>
 
-// Convert struct cloud variable's value to JSON, recursively
-CanopyResultEnum st_cloudvar_struct_value_to_json(RedJsonValue *out, STCloudVar var)
+// Encode struct cloud variable's value, recursively.  Only members that have
+// been touched since the last sync are written, in declaration order.
+CanopyResultEnum st_cloudvar_struct_encode(STEncoder encoder, STCloudVar var)
 {
-    RedJsonObject jsonObj = RedJsonObject_New();
-    RedHashIterator_t iter;
-    const void *key;
-    const void *hashValue;
-    size_t keySize;
-    RED_HASH_FOREACH(iter, var->struct_hash, &key, &keySize, &hashValue)
+    unsigned i;
+    st_encoder_begin_object(encoder);
+    for (i = 0; i < var->struct_num_members; i++)
     {
         CanopyResultEnum result;
-        RedJsonValue childValueJson;
-        STCloudVar childVar = (STCloudVar)hashValue;
-        if (st_cloudvar_has_value(childVar))
+        STCloudVar childVar = var->struct_members[i];
+        if (st_cloudvar_has_value(childVar) && st_cloudvar_is_value_dirty(childVar))
         {
-            result = st_cloudvar_value_to_json(&childValueJson, childVar);
+            st_encoder_key(encoder, st_cloudvar_name(childVar));
+            result = st_cloudvar_encode(encoder, childVar);
             if (result != CANOPY_SUCCESS)
             {
                 return result;
             }
-            RedJsonObject_Set(jsonObj, key, childValueJson);
         }
     }
+    st_encoder_end_object(encoder);
+    return st_encoder_result(encoder);
+}
+
+// Update struct cloud variable's value from an incoming payload, recursively.
+// Members that aren't part of the struct are skipped.
+CanopyResultEnum st_cloudvar_struct_decode(STCloudVar var, STDecoder decoder)
+{
+    STTokenEnum token;
+    CanopyResultEnum result;
+
+    token = st_decoder_next(decoder);
+    if (token == ST_TOKEN_ERROR)
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    if (token != ST_TOKEN_BEGIN_OBJECT)
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+
+    while ((token = st_decoder_next(decoder)) == ST_TOKEN_KEY)
+    {
+        STCloudVar fieldVar;
+        fieldVar = RedHash_GetWithDefaultS(var->struct_hash, st_decoder_string(decoder), NULL);
+        if (!fieldVar)
+        {
+            result = st_decoder_skip_value(decoder);
+        }
+        else
+        {
+            result = st_cloudvar_decode(fieldVar, decoder);
+        }
+        if (result != CANOPY_SUCCESS)
+            return result;
+    }
 
-    *out = RedJsonValue_FromObject(jsonObj);
+    if (token != ST_TOKEN_END_OBJECT)
+        return CANOPY_ERROR_PARSING_PAYLOAD;
     return CANOPY_SUCCESS;
 }
 
@@ -49,44 +79,50 @@ CanopyResultEnum st_cloudvar_struct_value_to_json(RedJsonValue *out, STCloudVar
 // Caller is responsible for setting up relationships to parent & cloudvar
 // system.
 CanopyResultEnum st_cloudvar_struct_new(
+        STArena arena,
         STCloudVar *out, 
         STCloudVarInitOptions options)
 {
     STCloudVar var;
+    unsigned i;
 
     // Create STCloudVar object for struct itself
-    var = calloc(1, sizeof(STCloudVar_t));
+    var = st_arena_alloc(arena, sizeof(STCloudVar_t));
     if (!var)
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
-    // TODO: validate numItems
     var->struct_hash = RedHash_New(0);
-    if (!var->struct_hash)
+    var->struct_members = st_arena_calloc(arena,
+            options->num_struct_members ? options->num_struct_members : 1,
+            sizeof(STCloudVar));
+    if (!var->struct_hash || !var->struct_members)
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
 
     // Create SDDL declaration
-    var->decl = sddl_var_new_struct(options->direction, options->name);
+    var->decl = sddl_var_new_struct(options->direction, RedString_strdup(options->name));
     if (!var->decl)
     {
         return CANOPY_ERROR_UNKNOWN;
     }
 
-    // Create child STCloudVar objects for each struct member
-    RedHashIterator_t iter;
-    const void *key;
-    const void *hashValue;
-    size_t keySize;
-    RED_HASH_FOREACH(iter, options->struct_hash, &key, &keySize, &hashValue)
+    // Create child STCloudVar objects for each struct member, in the order
+    // they were declared.
+    for (i = 0; i < options->num_struct_members; i++)
     {
         CanopyResultEnum result;
         STCloudVar childVar;
         bool ok;
-        STCloudVarInitOptions childOptions = (STCloudVarInitOptions)hashValue;
+        STCloudVarInitOptions childOptions = options->struct_members[i];
 
-        result = st_cloudvar_generic_new(&childVar, childOptions); 
+        if (RedHash_HasKeyS(var->struct_hash, childOptions->name))
+        {
+            return CANOPY_ERROR_BAD_VARIABLE_DECLARATION;
+        }
+
+        result = st_cloudvar_generic_new(arena, &childVar, childOptions); 
 
         if (result != CANOPY_SUCCESS)
         {
@@ -102,8 +138,11 @@ CanopyResultEnum st_cloudvar_struct_new(
         }
 
         // add newly created variable to CloudVar
+        childVar->parent = var;
+        childVar->member_index = i;
+        var->struct_members[i] = childVar;
+        var->struct_num_members++;
         RedHash_InsertS(var->struct_hash, st_cloudvar_name(childVar), childVar);
-
     }
 
     *out = var;
@@ -207,3 +246,28 @@ CanopyResultEnum st_cloudvar_struct_read_var(STCloudVar var, CanopyVarReader rea
     return CANOPY_SUCCESS;
 }
 
+
+int st_cloudvar_struct_member_index(STCloudVar var, const char *name)
+{
+    STCloudVar member;
+    if (!var->struct_hash)
+    {
+        return -1;
+    }
+    member = RedHash_GetWithDefaultS(var->struct_hash, name, NULL);
+    return member ? (int)member->member_index : -1;
+}
+
+STCloudVar st_cloudvar_struct_member_at(STCloudVar var, unsigned index)
+{
+    if (index >= var->struct_num_members)
+    {
+        return NULL;
+    }
+    return var->struct_members[index];
+}
+
+unsigned st_cloudvar_struct_num_members(STCloudVar var)
+{
+    return var->struct_num_members;
+}
@@ -14,80 +14,197 @@
 
 #include "cloudvar/st_cloudvar.h"
 #include "cloudvar/st_cloudvar_internal.h"
+#include <assert.h>
 
 STCloudVarSystem st_cloudvar_system_new(CanopyContext ctx)
 {
     STCloudVarSystem sys;
 
     sys = calloc(1, sizeof(struct STCloudVarSystem_t));
+    if (!sys)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&sys->dirty_lock, NULL);
     sys->dirty = true;
     sys->context = ctx;
     sys->vars = RedHash_New(0);
-    sys->dirty_vars = RedHash_New(0);
     sys->callbacks = RedHash_New(0);
+    sys->arena = st_arena_new(0);
+    if (!sys->vars || !sys->callbacks || !sys->arena)
+    {
+        st_cloudvar_system_free(sys);
+        return NULL;
+    }
     return sys;
 }
 
 void st_cloudvar_system_free(STCloudVarSystem sys)
 {
+    RedHashIterator_t iter;
+    const void *key;
+    const void *hashValue;
+    size_t keySize;
+
     if (sys)
     {
-        // TODO: free all entries in hash table
-        //RedHash_Free(sys->vars);
-        //RedHash_Free(sys->dirty_vars);
+        // The trees themselves are in the arena; only release what they hold
+        // outside of it.  SDDL declarations belong to libsddl.
+        if (sys->vars)
+        {
+            RED_HASH_FOREACH(iter, sys->vars, &key, &keySize, &hashValue)
+            {
+                STCloudVar var = (STCloudVar)hashValue;
+                st_cloudvar_release(var);
+                sddl_var_free(var->decl);
+            }
+            RedHash_Free(sys->vars);
+        }
+        if (sys->callbacks)
+        {
+            RedHash_Free(sys->callbacks);
+        }
+        st_arena_free(sys->arena);
+        free(sys->dirty_list);
+        free(sys->taken_list);
+        pthread_mutex_destroy(&sys->dirty_lock);
         free(sys);
     }
 }
 
+STArena st_cloudvar_system_arena(STCloudVarSystem sys)
+{
+    return sys->arena;
+}
+
 bool st_cloudvar_system_contains(STCloudVarSystem sys, const char *varname)
 {
     return RedHash_HasKeyS(sys->vars, varname);
 }
 
-void st_cloudvar_system_clear_dirty(STCloudVarSystem sys)
+uint32_t st_cloudvar_system_take_dirty(STCloudVarSystem sys)
 {
+    STCloudVar *list;
+    uint32_t i;
+
+    // Swap the lists, so that setters start a fresh dirty list while the
+    // taken one is being encoded.
+    pthread_mutex_lock(&sys->dirty_lock);
+    list = sys->taken_list;
+    sys->taken_list = sys->dirty_list;
+    sys->num_taken = sys->num_dirty;
+    sys->dirty_list = list;
+    sys->num_dirty = 0;
     sys->dirty = false;
-    RedHash_Clear(sys->dirty_vars);
+    for (i = 0; i < sys->num_taken; i++)
+    {
+        sys->taken_list[i]->dirty = false;
+    }
+    pthread_mutex_unlock(&sys->dirty_lock);
+    return sys->num_taken;
 }
 
-void st_cloudvar_system_mark_dirty(STCloudVarSystem sys, STCloudVar var)
+void st_cloudvar_system_restore_taken(STCloudVarSystem sys)
 {
-    const char *name = st_cloudvar_name(var);
-    RedHash_UpdateOrInsertS(sys->dirty_vars, NULL, name, (void *)true);
-    sys->dirty = true;
+    uint32_t i;
+    for (i = 0; i < sys->num_taken; i++)
+    {
+        STCloudVar var = sys->taken_list[i];
+        st_cloudvar_lock(var);
+        st_cloudvar_mark_tree_dirty(var);
+        st_cloudvar_unlock(var);
+    }
+    sys->num_taken = 0;
 }
 
-bool st_cloudvar_system_is_dirty(STCloudVarSystem sys)
+STCloudVar st_cloudvar_system_taken_var(STCloudVarSystem sys, uint32_t idx)
 {
-    return sys->dirty;
+    if (idx >= sys->num_taken)
+    {
+        return NULL;
+    }
+    return sys->taken_list[idx];
 }
 
-uint32_t st_cloudvar_system_num_dirty(STCloudVarSystem sys)
+CanopyResultEnum st_cloudvar_system_reserve_dirty(STCloudVarSystem sys, uint32_t numVars)
 {
-    return RedHash_NumItems(sys->dirty_vars);
+    STCloudVar *newList;
+    uint32_t newCapacity;
+
+    // Only called while variables are being initialized, so the lists
+    // aren't in use by other threads.
+    if (numVars <= sys->dirty_list_capacity)
+    {
+        return CANOPY_SUCCESS;
+    }
+
+    newCapacity = sys->dirty_list_capacity ? sys->dirty_list_capacity : 16;
+    while (newCapacity < numVars)
+    {
+        newCapacity *= 2;
+    }
+
+    newList = realloc(sys->dirty_list, newCapacity * sizeof(STCloudVar));
+    if (!newList)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    sys->dirty_list = newList;
+    newList = realloc(sys->taken_list, newCapacity * sizeof(STCloudVar));
+    if (!newList)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    sys->taken_list = newList;
+    sys->dirty_list_capacity = newCapacity;
+    return CANOPY_SUCCESS;
 }
 
-STCloudVar st_cloudvar_system_lookup_var(STCloudVarSystem sys, const char *varname)
+void st_cloudvar_system_mark_dirty(STCloudVarSystem sys, STCloudVar var)
 {
-    return RedHash_GetWithDefaultS(sys->vars, varname, NULL);
+    pthread_mutex_lock(&sys->dirty_lock);
+    sys->dirty = true;
+    if (!var->dirty)
+    {
+        // Capacity was reserved by st_cloudvar_init_var, so this can't
+        // overflow.
+        assert(sys->num_dirty < sys->dirty_list_capacity);
+        sys->dirty_list[sys->num_dirty++] = var;
+        var->dirty = true;
+    }
+    pthread_mutex_unlock(&sys->dirty_lock);
 }
 
-STCloudVar st_cloudvar_system_dirty_var(STCloudVarSystem sys, uint32_t idx)
+void st_cloudvar_system_mark_all_dirty(STCloudVarSystem sys)
 {
-    // TODO: Inefficient!
     RedHashIterator_t iter;
     const void *key;
+    const void *hashValue;
     size_t keySize;
-    uint32_t i = 0;
-    RED_HASH_FOREACH(iter, sys->dirty_vars, &key, &keySize, NULL)
+
+    RED_HASH_FOREACH(iter, sys->vars, &key, &keySize, &hashValue)
     {
-        const char *varname = (const char *)key;
-        if (i == idx)
-        {
-            return RedHash_GetWithDefaultS(sys->vars, varname, NULL);
-        }
-        i++;
+        STCloudVar var = (STCloudVar)hashValue;
+        st_cloudvar_lock(var);
+        var->sddl_dirty_flag = true;
+        st_cloudvar_mark_tree_dirty(var);
+        st_cloudvar_unlock(var);
     }
-    return NULL;
+    pthread_mutex_lock(&sys->dirty_lock);
+    sys->dirty = true;
+    pthread_mutex_unlock(&sys->dirty_lock);
 }
 
+bool st_cloudvar_system_is_dirty(STCloudVarSystem sys)
+{
+    bool dirty;
+    pthread_mutex_lock(&sys->dirty_lock);
+    dirty = sys->dirty;
+    pthread_mutex_unlock(&sys->dirty_lock);
+    return dirty;
+}
+
+STCloudVar st_cloudvar_system_lookup_var(STCloudVarSystem sys, const char *varname)
+{
+    return RedHash_GetWithDefaultS(sys->vars, varname, NULL);
+}
@@ -0,0 +1,290 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// In-situ pull parser for CBOR.
+
+#include "codec/st_cbor_reader.h"
+#include <math.h>
+#include <string.h>
+
+#define _MAJOR_UINT 0
+#define _MAJOR_NEGINT 1
+#define _MAJOR_BYTES 2
+#define _MAJOR_TEXT 3
+#define _MAJOR_ARRAY 4
+#define _MAJOR_MAP 5
+#define _MAJOR_TAG 6
+#define _MAJOR_SIMPLE 7
+
+#define _INDEFINITE 31
+#define _BREAK 0xFF
+
+void st_cbor_reader_init(STCborReader reader, char *buf, size_t len)
+{
+    memset(reader, 0, sizeof(STCborReader_t));
+    reader->pos = (unsigned char *)buf;
+    reader->end = (unsigned char *)buf + len;
+}
+
+static STTokenEnum _fail(STCborReader reader)
+{
+    reader->error = true;
+    return ST_TOKEN_ERROR;
+}
+
+// Read the argument that follows an initial byte with additional info <ai>.
+static bool _read_arg(STCborReader reader, unsigned ai, uint64_t *out)
+{
+    unsigned numBytes, i;
+    if (ai < 24)
+    {
+        *out = ai;
+        return true;
+    }
+    switch (ai)
+    {
+        case 24: numBytes = 1; break;
+        case 25: numBytes = 2; break;
+        case 26: numBytes = 4; break;
+        case 27: numBytes = 8; break;
+        default: return false;
+    }
+    if ((size_t)(reader->end - reader->pos) < numBytes)
+    {
+        return false;
+    }
+    *out = 0;
+    for (i = 0; i < numBytes; i++)
+    {
+        *out = (*out << 8) | *reader->pos++;
+    }
+    return true;
+}
+
+static double _decode_half(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    double value;
+    if (exponent == 0)
+        value = ldexp(mantissa, -24);
+    else if (exponent != 31)
+        value = ldexp(mantissa + 1024, exponent - 25);
+    else
+        value = mantissa == 0 ? INFINITY : NAN;
+    return (half & 0x8000) ? -value : value;
+}
+
+// Is the innermost container finished?  Consumes the break byte of an
+// indefinite-length container.
+static bool _at_container_end(STCborReader reader, bool consume)
+{
+    int64_t remaining = reader->remaining[reader->depth - 1];
+    if (remaining == 0)
+    {
+        return true;
+    }
+    if (remaining < 0 && reader->pos < reader->end && *reader->pos == _BREAK)
+    {
+        if (consume)
+            reader->pos++;
+        return true;
+    }
+    return false;
+}
+
+// Is the next item in the innermost container a map key?  Map entries
+// alternate key, value, so keys are the even-numbered items.
+static bool _expect_key(STCborReader reader)
+{
+    return reader->depth > 0 &&
+        reader->in_object[reader->depth - 1] &&
+        reader->count[reader->depth - 1] % 2 == 0;
+}
+
+STTokenEnum st_cbor_reader_next(STCborReader reader)
+{
+    unsigned char initial;
+    unsigned major, ai;
+    uint64_t arg;
+    bool isKey = false;
+
+    if (reader->error)
+        return ST_TOKEN_ERROR;
+
+    if (reader->depth == 0 && reader->done)
+    {
+        if (reader->pos != reader->end)
+            return _fail(reader);
+        return ST_TOKEN_END;
+    }
+
+    if (reader->depth > 0)
+    {
+        bool inObject = reader->in_object[reader->depth - 1];
+        if (_at_container_end(reader, true))
+        {
+            // An indefinite-length map can't end between key and value.
+            if (inObject && reader->count[reader->depth - 1] % 2 != 0)
+                return _fail(reader);
+            reader->depth--;
+            reader->done = (reader->depth == 0);
+            return inObject ? ST_TOKEN_END_OBJECT : ST_TOKEN_END_ARRAY;
+        }
+        isKey = _expect_key(reader);
+        reader->count[reader->depth - 1]++;
+        if (reader->remaining[reader->depth - 1] > 0)
+        {
+            reader->remaining[reader->depth - 1]--;
+        }
+    }
+    else
+    {
+        reader->done = true;
+    }
+
+    // Skip any tags preceding the item.
+    do
+    {
+        if (reader->pos >= reader->end)
+            return _fail(reader);
+        initial = *reader->pos++;
+        major = initial >> 5;
+        ai = initial & 0x1F;
+        // Only strings, arrays and maps have an indefinite length.
+        if (ai == _INDEFINITE &&
+                (major == _MAJOR_UINT || major == _MAJOR_NEGINT || major == _MAJOR_TAG))
+            return _fail(reader);
+        if (major == _MAJOR_SIMPLE || ai == _INDEFINITE)
+        {
+            arg = 0;
+        }
+        else if (!_read_arg(reader, ai, &arg))
+        {
+            return _fail(reader);
+        }
+    } while (major == _MAJOR_TAG);
+
+    if (isKey && major != _MAJOR_TEXT)
+        return _fail(reader);
+
+    switch (major)
+    {
+        case _MAJOR_UINT:
+            reader->number = (double)arg;
+            return ST_TOKEN_NUMBER;
+        case _MAJOR_NEGINT:
+            reader->number = -1.0 - (double)arg;
+            return ST_TOKEN_NUMBER;
+        case _MAJOR_TEXT:
+        {
+            unsigned char *text = reader->pos;
+            if (ai == _INDEFINITE)
+                return _fail(reader);
+            if ((uint64_t)(reader->end - reader->pos) < arg)
+                return _fail(reader);
+            // Shift the text back over its header to make room for the NUL.
+            memmove(text - 1, text, (size_t)arg);
+            *(text - 1 + arg) = '\0';
+            reader->str = (char *)text - 1;
+            reader->str_len = (size_t)arg;
+            reader->pos += arg;
+            return isKey ? ST_TOKEN_KEY : ST_TOKEN_STRING;
+        }
+        case _MAJOR_ARRAY:
+        case _MAJOR_MAP:
+            if (reader->depth >= ST_CBOR_READER_MAX_DEPTH)
+                return _fail(reader);
+            reader->in_object[reader->depth] = (major == _MAJOR_MAP);
+            if (ai == _INDEFINITE)
+            {
+                reader->remaining[reader->depth] = -1;
+            }
+            else
+            {
+                // Every item takes at least a byte, so a larger count is
+                // bogus (and could overflow into the indefinite marker).
+                if (arg > (uint64_t)(reader->end - reader->pos))
+                    return _fail(reader);
+                reader->remaining[reader->depth] = (int64_t)arg * (major == _MAJOR_MAP ? 2 : 1);
+            }
+            reader->count[reader->depth] = 0;
+            reader->depth++;
+            reader->done = false;
+            return (major == _MAJOR_MAP) ? ST_TOKEN_BEGIN_OBJECT : ST_TOKEN_BEGIN_ARRAY;
+        case _MAJOR_SIMPLE:
+        {
+            uint64_t bits;
+            switch (ai)
+            {
+                case 20:
+                    return ST_TOKEN_FALSE;
+                case 21:
+                    return ST_TOKEN_TRUE;
+                case 22:
+                case 23:
+                    return ST_TOKEN_NULL;
+                case 25:
+                case 26:
+                case 27:
+                    if (!_read_arg(reader, ai, &bits))
+                        return _fail(reader);
+                    if (ai == 25)
+                    {
+                        reader->number = _decode_half((uint16_t)bits);
+                    }
+                    else if (ai == 26)
+                    {
+                        float f;
+                        uint32_t bits32 = (uint32_t)bits;
+                        memcpy(&f, &bits32, sizeof(f));
+                        reader->number = f;
+                    }
+                    else
+                    {
+                        memcpy(&reader->number, &bits, sizeof(double));
+                    }
+                    return ST_TOKEN_NUMBER;
+                default:
+                    return _fail(reader);
+            }
+        }
+        default:
+            // Byte strings aren't part of the JSON data model.
+            return _fail(reader);
+    }
+}
+
+bool st_cbor_reader_peek_end(STCborReader reader)
+{
+    if (reader->error || reader->depth == 0)
+        return false;
+    return _at_container_end(reader, false);
+}
+
+const char * st_cbor_reader_string(STCborReader reader)
+{
+    return reader->str;
+}
+
+size_t st_cbor_reader_string_len(STCborReader reader)
+{
+    return reader->str_len;
+}
+
+bool st_cbor_reader_number(STCborReader reader, double *out)
+{
+    *out = reader->number;
+    return true;
+}
@@ -0,0 +1,91 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_CBOR_READER_INCLUDED
+#define ST_CBOR_READER_INCLUDED
+
+// In-situ pull parser for CBOR (RFC 7049).
+//
+// The binary counterpart of STJsonReader: same tokens, same calls, nothing
+// allocated.  CBOR text strings aren't NUL-terminated on the wire, so each
+// key or string is shifted back by one byte (over its own header) to make
+// room for a terminator.  The buffer is modified in the process.
+//
+// Supports the subset of CBOR that maps onto JSON: integers, floats (half,
+// single and double precision), definite-length text strings, true, false,
+// null, and definite- or indefinite-length arrays and maps with text keys.
+// Tags are skipped.
+
+#include <canopy.h>
+#include <stddef.h>
+#include "codec/st_token.h"
+
+// Maximum nesting depth of maps and arrays.
+#define ST_CBOR_READER_MAX_DEPTH 32
+
+// Reader state.  This is declared here so that readers can be placed on the
+// stack; the fields should only be accessed through the st_cbor_reader_*
+// routines.
+typedef struct STCborReader_t
+{
+    unsigned char *pos;
+    unsigned char *end;
+
+    unsigned depth;
+    bool in_object[ST_CBOR_READER_MAX_DEPTH];
+
+    // Number of items left in each open map/array, or -1 for indefinite
+    // length.  Map entries count as two items (key and value).
+    int64_t remaining[ST_CBOR_READER_MAX_DEPTH];
+
+    // Number of items read so far in each open map/array.
+    uint64_t count[ST_CBOR_READER_MAX_DEPTH];
+
+    // The top-level item has been read completely.
+    bool done;
+
+    bool error;
+
+    // Current KEY or STRING token's text.
+    char *str;
+    size_t str_len;
+
+    // Current NUMBER token's value.
+    double number;
+} STCborReader_t;
+
+typedef STCborReader_t * STCborReader;
+
+// Prepare <reader> to parse the <len> bytes at <buf>.
+void st_cbor_reader_init(STCborReader reader, char *buf, size_t len);
+
+// Read the next token.  Returns ST_TOKEN_END once the top-level item has been
+// consumed, or ST_TOKEN_ERROR on malformed or unsupported input.
+STTokenEnum st_cbor_reader_next(STCborReader reader);
+
+// Does the next token close the innermost map or array?  Does not consume
+// anything.
+bool st_cbor_reader_peek_end(STCborReader reader);
+
+// Get the current KEY or STRING token's NUL-terminated text.  The pointer
+// points into the buffer being parsed.
+const char * st_cbor_reader_string(STCborReader reader);
+
+// Get the length in bytes of the current KEY or STRING token's text.
+size_t st_cbor_reader_string_len(STCborReader reader);
+
+// Get the current NUMBER token's value.
+bool st_cbor_reader_number(STCborReader reader, double *out);
+
+#endif // ST_CBOR_READER_INCLUDED
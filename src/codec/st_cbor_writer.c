@@ -0,0 +1,359 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Streaming CBOR writer for Canopy.
+
+#include "codec/st_cbor_writer.h"
+#include "json/st_json_reader.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CBOR major types (already shifted into the top 3 bits).
+#define _MAJOR_UINT 0x00
+#define _MAJOR_NEGINT 0x20
+#define _MAJOR_TEXT 0x60
+#define _MAJOR_ARRAY 0x80
+#define _MAJOR_MAP 0xA0
+#define _MAJOR_SIMPLE 0xE0
+
+#define _INDEFINITE 0x1F
+#define _BREAK 0xFF
+#define _FALSE 0xF4
+#define _TRUE 0xF5
+#define _NULL 0xF6
+#define _FLOAT32 0xFA
+#define _FLOAT64 0xFB
+
+struct STCborWriter_t
+{
+    // The allocation is <capacity> bytes at <base>: <pre> bytes of padding,
+    // the encoded bytes at <buf>, and <post> bytes of padding.
+    unsigned char *base;
+    unsigned char *buf;
+    size_t len;
+    size_t capacity;
+    size_t pre;
+    size_t post;
+    CanopyResultEnum error;
+};
+
+STCborWriter st_cbor_writer_new()
+{
+    return calloc(1, sizeof(struct STCborWriter_t));
+}
+
+void st_cbor_writer_free(STCborWriter writer)
+{
+    if (writer)
+    {
+        free(writer->base);
+        free(writer);
+    }
+}
+
+void st_cbor_writer_set_padding(STCborWriter writer, size_t pre, size_t post)
+{
+    assert(writer->len == 0);
+    writer->pre = pre;
+    writer->post = post;
+    writer->buf = writer->base ? &writer->base[pre] : NULL;
+}
+
+void st_cbor_writer_swap_buffer(STCborWriter writer, char **buf, size_t *capacity)
+{
+    unsigned char *base = writer->base;
+    size_t oldCapacity = writer->capacity;
+
+    writer->base = (unsigned char *)*buf;
+    writer->capacity = *capacity;
+    *buf = (char *)base;
+    *capacity = oldCapacity;
+
+    writer->len = 0;
+    st_cbor_writer_set_padding(writer, writer->pre, writer->post);
+    st_cbor_writer_reset(writer);
+}
+
+void st_cbor_writer_reset(STCborWriter writer)
+{
+    writer->len = 0;
+    writer->error = CANOPY_SUCCESS;
+}
+
+// Make sure there's room for <extra> more bytes.
+static bool _reserve(STCborWriter writer, size_t extra)
+{
+    size_t needed;
+    size_t newCapacity;
+    unsigned char *newBuf;
+
+    if (writer->error != CANOPY_SUCCESS)
+    {
+        return false;
+    }
+
+    needed = writer->pre + writer->len + extra + writer->post;
+    if (needed <= writer->capacity)
+    {
+        return true;
+    }
+
+    newCapacity = writer->capacity ? writer->capacity : 256;
+    while (newCapacity < needed)
+    {
+        newCapacity *= 2;
+    }
+    newBuf = realloc(writer->base, newCapacity);
+    if (!newBuf)
+    {
+        writer->error = CANOPY_ERROR_OUT_OF_MEMORY;
+        return false;
+    }
+    writer->base = newBuf;
+    writer->buf = &newBuf[writer->pre];
+    writer->capacity = newCapacity;
+    return true;
+}
+
+static void _append_byte(STCborWriter writer, unsigned char b)
+{
+    if (!_reserve(writer, 1))
+    {
+        return;
+    }
+    writer->buf[writer->len++] = b;
+}
+
+// Write a big-endian integer of <numBytes> bytes.
+static void _append_be(STCborWriter writer, uint64_t value, unsigned numBytes)
+{
+    unsigned i;
+    if (!_reserve(writer, numBytes))
+    {
+        return;
+    }
+    for (i = 0; i < numBytes; i++)
+    {
+        writer->buf[writer->len++] = (unsigned char)(value >> (8 * (numBytes - 1 - i)));
+    }
+}
+
+// Write an item header: major type plus argument, using the shortest form.
+static void _append_header(STCborWriter writer, unsigned char major, uint64_t arg)
+{
+    if (arg < 24)
+    {
+        _append_byte(writer, major | (unsigned char)arg);
+    }
+    else if (arg <= 0xFF)
+    {
+        _append_byte(writer, major | 24);
+        _append_be(writer, arg, 1);
+    }
+    else if (arg <= 0xFFFF)
+    {
+        _append_byte(writer, major | 25);
+        _append_be(writer, arg, 2);
+    }
+    else if (arg <= 0xFFFFFFFF)
+    {
+        _append_byte(writer, major | 26);
+        _append_be(writer, arg, 4);
+    }
+    else
+    {
+        _append_byte(writer, major | 27);
+        _append_be(writer, arg, 8);
+    }
+}
+
+static void _append_text(STCborWriter writer, const char *sz, size_t len)
+{
+    _append_header(writer, _MAJOR_TEXT, len);
+    if (!_reserve(writer, len))
+    {
+        return;
+    }
+    memcpy(&writer->buf[writer->len], sz, len);
+    writer->len += len;
+}
+
+void st_cbor_writer_begin_object(STCborWriter writer)
+{
+    _append_byte(writer, _MAJOR_MAP | _INDEFINITE);
+}
+
+void st_cbor_writer_end_object(STCborWriter writer)
+{
+    _append_byte(writer, _BREAK);
+}
+
+void st_cbor_writer_begin_array(STCborWriter writer)
+{
+    _append_byte(writer, _MAJOR_ARRAY | _INDEFINITE);
+}
+
+void st_cbor_writer_end_array(STCborWriter writer)
+{
+    _append_byte(writer, _BREAK);
+}
+
+void st_cbor_writer_key(STCborWriter writer, const char *key)
+{
+    _append_text(writer, key, strlen(key));
+}
+
+void st_cbor_writer_null(STCborWriter writer)
+{
+    _append_byte(writer, _NULL);
+}
+
+void st_cbor_writer_bool(STCborWriter writer, bool value)
+{
+    _append_byte(writer, value ? _TRUE : _FALSE);
+}
+
+void st_cbor_writer_int(STCborWriter writer, int64_t value)
+{
+    if (value >= 0)
+    {
+        _append_header(writer, _MAJOR_UINT, (uint64_t)value);
+    }
+    else
+    {
+        // CBOR stores negative n as (-1 - n).
+        _append_header(writer, _MAJOR_NEGINT, (uint64_t)(-1 - value));
+    }
+}
+
+void st_cbor_writer_uint(STCborWriter writer, uint64_t value)
+{
+    _append_header(writer, _MAJOR_UINT, value);
+}
+
+void st_cbor_writer_float32(STCborWriter writer, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    _append_byte(writer, _FLOAT32);
+    _append_be(writer, bits, 4);
+}
+
+void st_cbor_writer_float64(STCborWriter writer, double value)
+{
+    uint64_t bits;
+    if ((double)(float)value == value)
+    {
+        // No precision lost; save 4 bytes.
+        st_cbor_writer_float32(writer, (float)value);
+        return;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    _append_byte(writer, _FLOAT64);
+    _append_be(writer, bits, 8);
+}
+
+void st_cbor_writer_string(STCborWriter writer, const char *sz)
+{
+    if (!sz)
+    {
+        st_cbor_writer_null(writer);
+        return;
+    }
+    _append_text(writer, sz, strlen(sz));
+}
+
+// Write a number token from JSON text, preferring an integer encoding.
+static void _transcode_number(STCborWriter writer, double number)
+{
+    if (number >= -9.0e18 && number <= 9.0e18 && number == (double)(int64_t)number)
+    {
+        st_cbor_writer_int(writer, (int64_t)number);
+    }
+    else
+    {
+        st_cbor_writer_float64(writer, number);
+    }
+}
+
+void st_cbor_writer_json(STCborWriter writer, char *json)
+{
+    STJsonReader_t reader;
+    STTokenEnum token;
+    double number;
+
+    st_json_reader_init(&reader, json, strlen(json));
+    while ((token = st_json_reader_next(&reader)) != ST_TOKEN_END)
+    {
+        switch (token)
+        {
+            case ST_TOKEN_BEGIN_OBJECT:
+                st_cbor_writer_begin_object(writer);
+                break;
+            case ST_TOKEN_BEGIN_ARRAY:
+                st_cbor_writer_begin_array(writer);
+                break;
+            case ST_TOKEN_END_OBJECT:
+            case ST_TOKEN_END_ARRAY:
+                _append_byte(writer, _BREAK);
+                break;
+            case ST_TOKEN_KEY:
+            case ST_TOKEN_STRING:
+                _append_text(writer,
+                        st_json_reader_string(&reader),
+                        st_json_reader_string_len(&reader));
+                break;
+            case ST_TOKEN_NUMBER:
+                if (!st_json_reader_number(&reader, &number))
+                {
+                    goto fail;
+                }
+                _transcode_number(writer, number);
+                break;
+            case ST_TOKEN_TRUE:
+                st_cbor_writer_bool(writer, true);
+                break;
+            case ST_TOKEN_FALSE:
+                st_cbor_writer_bool(writer, false);
+                break;
+            case ST_TOKEN_NULL:
+                st_cbor_writer_null(writer);
+                break;
+            default:
+                goto fail;
+        }
+    }
+    return;
+fail:
+    if (writer->error == CANOPY_SUCCESS)
+    {
+        writer->error = CANOPY_ERROR_INVALID_VALUE;
+    }
+}
+
+CanopyResultEnum st_cbor_writer_result(STCborWriter writer)
+{
+    return writer->error;
+}
+
+const char * st_cbor_writer_bytes(STCborWriter writer)
+{
+    return (const char *)writer->buf;
+}
+
+size_t st_cbor_writer_len(STCborWriter writer)
+{
+    return writer->len;
+}
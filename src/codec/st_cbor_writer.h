@@ -0,0 +1,83 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_CBOR_WRITER_INCLUDED
+#define ST_CBOR_WRITER_INCLUDED
+
+// Streaming CBOR (RFC 7049) writer for Canopy.
+//
+// The binary counterpart of STJsonWriter, with the same calls and the same
+// reusable buffer and sticky error behavior.  Objects and arrays are written
+// with indefinite lengths, so that entries can be streamed without knowing
+// their count up front.  Numbers use the smallest encoding that represents
+// them exactly: integers take 1-9 bytes, and a float64 that survives a round
+// trip through float32 is written as a float32.
+
+#include <canopy.h>
+#include <stddef.h>
+
+typedef struct STCborWriter_t * STCborWriter;
+
+// Create a new CBOR writer with an empty buffer.
+STCborWriter st_cbor_writer_new();
+
+// Free CBOR writer and its buffer.
+void st_cbor_writer_free(STCborWriter writer);
+
+// Discard the contents of the buffer (keeping its capacity) and clear any
+// error.
+void st_cbor_writer_reset(STCborWriter writer);
+
+// Leave <pre> bytes of padding in front of, and <post> bytes after, the
+// encoded bytes in every buffer the writer uses.  Call it before writing
+// anything.
+void st_cbor_writer_set_padding(STCborWriter writer, size_t pre, size_t post);
+
+// Exchange the writer's buffer for another one, without copying.  On return,
+// *<buf> is the writer's allocation of *<capacity> bytes, with the bytes
+// written so far at offset <pre>.  The writer takes the buffer passed in
+// (from malloc, or NULL with a capacity of 0) and is reset.
+void st_cbor_writer_swap_buffer(STCborWriter writer, char **buf, size_t *capacity);
+
+void st_cbor_writer_begin_object(STCborWriter writer);
+void st_cbor_writer_end_object(STCborWriter writer);
+void st_cbor_writer_begin_array(STCborWriter writer);
+void st_cbor_writer_end_array(STCborWriter writer);
+
+// Write an object member's key.  Must be followed by exactly one value.
+void st_cbor_writer_key(STCborWriter writer, const char *key);
+
+void st_cbor_writer_null(STCborWriter writer);
+void st_cbor_writer_bool(STCborWriter writer, bool value);
+void st_cbor_writer_int(STCborWriter writer, int64_t value);
+void st_cbor_writer_uint(STCborWriter writer, uint64_t value);
+void st_cbor_writer_float32(STCborWriter writer, float value);
+void st_cbor_writer_float64(STCborWriter writer, double value);
+void st_cbor_writer_string(STCborWriter writer, const char *sz);
+
+// Transcode a value that has already been serialized to JSON text.  The
+// NUL-terminated <json> buffer is parsed in place and so is modified.
+void st_cbor_writer_json(STCborWriter writer, char *json);
+
+// Get the first error that occured since the last reset, or CANOPY_SUCCESS.
+CanopyResultEnum st_cbor_writer_result(STCborWriter writer);
+
+// Get the bytes written so far.  The pointer is owned by the writer and is
+// valid until the next call that modifies the writer.
+const char * st_cbor_writer_bytes(STCborWriter writer);
+
+// Get the number of bytes written so far.
+size_t st_cbor_writer_len(STCborWriter writer);
+
+#endif // ST_CBOR_WRITER_INCLUDED
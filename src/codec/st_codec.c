@@ -0,0 +1,441 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Pluggable wire encodings for sync payloads.
+
+#include "codec/st_codec.h"
+#include "codec/st_cbor_writer.h"
+#include "json/st_json_writer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Table of routines implementing an encoder.  <impl> is the writer object
+// returned by new_impl.
+typedef struct STEncoderVTable_t
+{
+    CanopyEncodingEnum encoding;
+    void * (*new_impl)();
+    void (*free_impl)(void *impl);
+    void (*reset)(void *impl);
+    void (*begin_object)(void *impl);
+    void (*end_object)(void *impl);
+    void (*begin_array)(void *impl);
+    void (*end_array)(void *impl);
+    void (*key)(void *impl, const char *key);
+    void (*null)(void *impl);
+    void (*boolean)(void *impl, bool value);
+    void (*int64)(void *impl, int64_t value);
+    void (*uint64)(void *impl, uint64_t value);
+    void (*float32)(void *impl, float value);
+    void (*float64)(void *impl, double value);
+    void (*string)(void *impl, const char *sz);
+    void (*json)(void *impl, char *json);
+    CanopyResultEnum (*result)(void *impl);
+    const char * (*bytes)(void *impl);
+    size_t (*len)(void *impl);
+    void (*set_padding)(void *impl, size_t pre, size_t post);
+    void (*swap_buffer)(void *impl, char **buf, size_t *capacity);
+} STEncoderVTable_t;
+
+// Table of routines implementing a decoder.  <reader> points to the
+// decoder's reader union member.
+struct STDecoderVTable_t
+{
+    CanopyEncodingEnum encoding;
+    void (*init)(void *reader, char *buf, size_t len);
+    STTokenEnum (*next)(void *reader);
+    bool (*peek_end)(void *reader);
+    const char * (*string)(void *reader);
+    size_t (*string_len)(void *reader);
+    bool (*number)(void *reader, double *out);
+};
+
+struct STEncoder_t
+{
+    const STEncoderVTable_t *vtable;
+    void *impl;
+};
+
+// The writers and readers take their own handle types, so each table entry
+// is a small thunk that casts <impl> back.  These macros generate them.
+#define _THUNK(prefix, handle, name) \
+    static void _##prefix##_##name(void *impl) \
+    { \
+        st_##prefix##_##name((handle)impl); \
+    }
+#define _THUNK_ARG(prefix, handle, name, argtype) \
+    static void _##prefix##_##name(void *impl, argtype arg) \
+    { \
+        st_##prefix##_##name((handle)impl, arg); \
+    }
+#define _THUNK_RET(prefix, handle, name, rettype) \
+    static rettype _##prefix##_##name(void *impl) \
+    { \
+        return st_##prefix##_##name((handle)impl); \
+    }
+
+#define _WRITER_THUNKS(prefix, handle) \
+    static void * _##prefix##_new() \
+    { \
+        return st_##prefix##_new(); \
+    } \
+    _THUNK(prefix, handle, free) \
+    _THUNK(prefix, handle, reset) \
+    _THUNK(prefix, handle, begin_object) \
+    _THUNK(prefix, handle, end_object) \
+    _THUNK(prefix, handle, begin_array) \
+    _THUNK(prefix, handle, end_array) \
+    _THUNK_ARG(prefix, handle, key, const char *) \
+    _THUNK(prefix, handle, null) \
+    _THUNK_ARG(prefix, handle, bool, bool) \
+    _THUNK_ARG(prefix, handle, int, int64_t) \
+    _THUNK_ARG(prefix, handle, uint, uint64_t) \
+    _THUNK_ARG(prefix, handle, float32, float) \
+    _THUNK_ARG(prefix, handle, float64, double) \
+    _THUNK_ARG(prefix, handle, string, const char *) \
+    _THUNK_RET(prefix, handle, result, CanopyResultEnum) \
+    _THUNK_RET(prefix, handle, len, size_t) \
+    static void _##prefix##_set_padding(void *impl, size_t pre, size_t post) \
+    { \
+        st_##prefix##_set_padding((handle)impl, pre, post); \
+    } \
+    static void _##prefix##_swap_buffer(void *impl, char **buf, size_t *capacity) \
+    { \
+        st_##prefix##_swap_buffer((handle)impl, buf, capacity); \
+    }
+
+#define _WRITER_VTABLE(encodingValue, prefix, jsonfn, bytesfn) \
+    { \
+        encodingValue, \
+        _##prefix##_new, \
+        _##prefix##_free, \
+        _##prefix##_reset, \
+        _##prefix##_begin_object, \
+        _##prefix##_end_object, \
+        _##prefix##_begin_array, \
+        _##prefix##_end_array, \
+        _##prefix##_key, \
+        _##prefix##_null, \
+        _##prefix##_bool, \
+        _##prefix##_int, \
+        _##prefix##_uint, \
+        _##prefix##_float32, \
+        _##prefix##_float64, \
+        _##prefix##_string, \
+        jsonfn, \
+        _##prefix##_result, \
+        bytesfn, \
+        _##prefix##_len, \
+        _##prefix##_set_padding, \
+        _##prefix##_swap_buffer \
+    }
+
+_WRITER_THUNKS(json_writer, STJsonWriter)
+_THUNK_RET(json_writer, STJsonWriter, chars, const char *)
+_THUNK_ARG(json_writer, STJsonWriter, raw, const char *)
+static void _json_writer_json(void *impl, char *json)
+{
+    // Already JSON: copy it through verbatim.
+    _json_writer_raw(impl, json);
+}
+
+_WRITER_THUNKS(cbor_writer, STCborWriter)
+_THUNK_RET(cbor_writer, STCborWriter, bytes, const char *)
+_THUNK_ARG(cbor_writer, STCborWriter, json, char *)
+
+static const STEncoderVTable_t _encoders[] = {
+    _WRITER_VTABLE(CANOPY_ENCODING_JSON, json_writer, _json_writer_json, _json_writer_chars),
+    _WRITER_VTABLE(CANOPY_ENCODING_CBOR, cbor_writer, _cbor_writer_json, _cbor_writer_bytes),
+};
+
+#define _READER_THUNKS(prefix, handle) \
+    static void _##prefix##_init(void *reader, char *buf, size_t len) \
+    { \
+        st_##prefix##_init((handle)reader, buf, len); \
+    } \
+    _THUNK_RET(prefix, handle, next, STTokenEnum) \
+    _THUNK_RET(prefix, handle, peek_end, bool) \
+    _THUNK_RET(prefix, handle, string, const char *) \
+    _THUNK_RET(prefix, handle, string_len, size_t) \
+    static bool _##prefix##_number(void *reader, double *out) \
+    { \
+        return st_##prefix##_number((handle)reader, out); \
+    }
+
+#define _READER_VTABLE(encodingValue, prefix) \
+    { \
+        encodingValue, \
+        _##prefix##_init, \
+        _##prefix##_next, \
+        _##prefix##_peek_end, \
+        _##prefix##_string, \
+        _##prefix##_string_len, \
+        _##prefix##_number \
+    }
+
+_READER_THUNKS(json_reader, STJsonReader)
+_READER_THUNKS(cbor_reader, STCborReader)
+
+static const STDecoderVTable_t _decoders[] = {
+    _READER_VTABLE(CANOPY_ENCODING_JSON, json_reader),
+    _READER_VTABLE(CANOPY_ENCODING_CBOR, cbor_reader),
+};
+
+#define _NUM_CODECS (sizeof(_encoders) / sizeof(_encoders[0]))
+
+STEncoder st_encoder_new(CanopyEncodingEnum encoding)
+{
+    STEncoder encoder;
+    size_t i;
+    for (i = 0; i < _NUM_CODECS; i++)
+    {
+        if (_encoders[i].encoding == encoding)
+        {
+            encoder = calloc(1, sizeof(struct STEncoder_t));
+            if (!encoder)
+            {
+                return NULL;
+            }
+            encoder->vtable = &_encoders[i];
+            encoder->impl = encoder->vtable->new_impl();
+            if (!encoder->impl)
+            {
+                free(encoder);
+                return NULL;
+            }
+            return encoder;
+        }
+    }
+    return NULL;
+}
+
+void st_encoder_free(STEncoder encoder)
+{
+    if (encoder)
+    {
+        encoder->vtable->free_impl(encoder->impl);
+        free(encoder);
+    }
+}
+
+CanopyEncodingEnum st_encoder_encoding(STEncoder encoder)
+{
+    return encoder->vtable->encoding;
+}
+
+void st_encoder_reset(STEncoder encoder)
+{
+    encoder->vtable->reset(encoder->impl);
+}
+
+void st_encoder_begin_object(STEncoder encoder)
+{
+    encoder->vtable->begin_object(encoder->impl);
+}
+
+void st_encoder_end_object(STEncoder encoder)
+{
+    encoder->vtable->end_object(encoder->impl);
+}
+
+void st_encoder_begin_array(STEncoder encoder)
+{
+    encoder->vtable->begin_array(encoder->impl);
+}
+
+void st_encoder_end_array(STEncoder encoder)
+{
+    encoder->vtable->end_array(encoder->impl);
+}
+
+void st_encoder_key(STEncoder encoder, const char *key)
+{
+    encoder->vtable->key(encoder->impl, key);
+}
+
+void st_encoder_null(STEncoder encoder)
+{
+    encoder->vtable->null(encoder->impl);
+}
+
+void st_encoder_bool(STEncoder encoder, bool value)
+{
+    encoder->vtable->boolean(encoder->impl, value);
+}
+
+void st_encoder_int(STEncoder encoder, int64_t value)
+{
+    encoder->vtable->int64(encoder->impl, value);
+}
+
+void st_encoder_uint(STEncoder encoder, uint64_t value)
+{
+    encoder->vtable->uint64(encoder->impl, value);
+}
+
+void st_encoder_float32(STEncoder encoder, float value)
+{
+    encoder->vtable->float32(encoder->impl, value);
+}
+
+void st_encoder_float64(STEncoder encoder, double value)
+{
+    encoder->vtable->float64(encoder->impl, value);
+}
+
+void st_encoder_string(STEncoder encoder, const char *sz)
+{
+    encoder->vtable->string(encoder->impl, sz);
+}
+
+void st_encoder_json(STEncoder encoder, char *json)
+{
+    encoder->vtable->json(encoder->impl, json);
+}
+
+CanopyResultEnum st_encoder_result(STEncoder encoder)
+{
+    return encoder->vtable->result(encoder->impl);
+}
+
+const char * st_encoder_bytes(STEncoder encoder)
+{
+    return encoder->vtable->bytes(encoder->impl);
+}
+
+size_t st_encoder_len(STEncoder encoder)
+{
+    return encoder->vtable->len(encoder->impl);
+}
+
+void st_encoder_set_padding(STEncoder encoder, size_t pre, size_t post)
+{
+    encoder->vtable->set_padding(encoder->impl, pre, post);
+}
+
+void st_encoder_swap_buffer(STEncoder encoder, char **buf, size_t *capacity)
+{
+    encoder->vtable->swap_buffer(encoder->impl, buf, capacity);
+}
+
+CanopyResultEnum st_decoder_init(
+        STDecoder decoder,
+        CanopyEncodingEnum encoding,
+        char *buf,
+        size_t len)
+{
+    size_t i;
+    for (i = 0; i < _NUM_CODECS; i++)
+    {
+        if (_decoders[i].encoding == encoding)
+        {
+            decoder->vtable = &_decoders[i];
+            decoder->vtable->init(&decoder->reader, buf, len);
+            return CANOPY_SUCCESS;
+        }
+    }
+    return CANOPY_ERROR_INVALID_VALUE;
+}
+
+CanopyEncodingEnum st_codec_detect_encoding(const char *buf, size_t len)
+{
+    if (len > 0 && ((unsigned char)buf[0] & 0xE0) == 0xA0)
+    {
+        return CANOPY_ENCODING_CBOR;
+    }
+    return CANOPY_ENCODING_JSON;
+}
+
+STTokenEnum st_decoder_next(STDecoder decoder)
+{
+    return decoder->vtable->next(&decoder->reader);
+}
+
+bool st_decoder_peek_end(STDecoder decoder)
+{
+    return decoder->vtable->peek_end(&decoder->reader);
+}
+
+const char * st_decoder_string(STDecoder decoder)
+{
+    return decoder->vtable->string(&decoder->reader);
+}
+
+size_t st_decoder_string_len(STDecoder decoder)
+{
+    return decoder->vtable->string_len(&decoder->reader);
+}
+
+bool st_decoder_number(STDecoder decoder, double *out)
+{
+    return decoder->vtable->number(&decoder->reader, out);
+}
+
+CanopyResultEnum st_decoder_skip_value(STDecoder decoder)
+{
+    unsigned depth = 0;
+    do
+    {
+        switch (st_decoder_next(decoder))
+        {
+            case ST_TOKEN_BEGIN_OBJECT:
+            case ST_TOKEN_BEGIN_ARRAY:
+                depth++;
+                break;
+            case ST_TOKEN_END_OBJECT:
+            case ST_TOKEN_END_ARRAY:
+                if (depth == 0)
+                    return CANOPY_ERROR_PARSING_PAYLOAD;
+                depth--;
+                break;
+            case ST_TOKEN_KEY:
+                // Keys are always followed by their value; keep going.
+                break;
+            case ST_TOKEN_ERROR:
+            case ST_TOKEN_END:
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            default:
+                break;
+        }
+    } while (depth > 0);
+    return CANOPY_SUCCESS;
+}
+
+const char * st_codec_encoding_name(CanopyEncodingEnum encoding)
+{
+    switch (encoding)
+    {
+        case CANOPY_ENCODING_JSON:
+            return "json";
+        case CANOPY_ENCODING_CBOR:
+            return "cbor";
+        default:
+            return NULL;
+    }
+}
+
+bool st_codec_encoding_from_name(const char *name, CanopyEncodingEnum *out)
+{
+    if (!strcmp(name, "json"))
+    {
+        *out = CANOPY_ENCODING_JSON;
+        return true;
+    }
+    if (!strcmp(name, "cbor"))
+    {
+        *out = CANOPY_ENCODING_CBOR;
+        return true;
+    }
+    return false;
+}
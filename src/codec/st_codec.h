@@ -0,0 +1,138 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_CODEC_INCLUDED
+#define ST_CODEC_INCLUDED
+
+// Pluggable wire encodings for sync payloads.
+//
+// Payloads are always the same document ({"vars" : ..., "sddl" : ...}); a
+// codec only decides how it is laid out on the wire.  An STEncoder streams a
+// document into a reusable buffer, and an STDecoder pulls tokens back out of
+// a received buffer.  Both dispatch through a per-encoding table of
+// routines, so cloud variable and sync code is written once against the
+// st_encoder_* / st_decoder_* calls below.
+//
+// To add an encoding: add a value to CanopyEncodingEnum, implement a writer
+// and an in-situ reader with the same shape as the JSON ones, and add them
+// to the tables in st_codec.c.
+
+#include <canopy.h>
+#include <stddef.h>
+#include "codec/st_cbor_reader.h"
+#include "codec/st_token.h"
+#include "json/st_json_reader.h"
+
+typedef struct STEncoder_t * STEncoder;
+
+// Create an encoder for <encoding>.  Returns NULL if out of memory or if the
+// encoding is unknown.
+STEncoder st_encoder_new(CanopyEncodingEnum encoding);
+
+// Free encoder and its buffer.
+void st_encoder_free(STEncoder encoder);
+
+// Get the encoding that <encoder> produces.
+CanopyEncodingEnum st_encoder_encoding(STEncoder encoder);
+
+// Discard the contents of the buffer (keeping its capacity) and clear any
+// error.
+void st_encoder_reset(STEncoder encoder);
+
+void st_encoder_begin_object(STEncoder encoder);
+void st_encoder_end_object(STEncoder encoder);
+void st_encoder_begin_array(STEncoder encoder);
+void st_encoder_end_array(STEncoder encoder);
+void st_encoder_key(STEncoder encoder, const char *key);
+void st_encoder_null(STEncoder encoder);
+void st_encoder_bool(STEncoder encoder, bool value);
+void st_encoder_int(STEncoder encoder, int64_t value);
+void st_encoder_uint(STEncoder encoder, uint64_t value);
+void st_encoder_float32(STEncoder encoder, float value);
+void st_encoder_float64(STEncoder encoder, double value);
+void st_encoder_string(STEncoder encoder, const char *sz);
+
+// Write a value that has already been serialized to (NUL-terminated) JSON
+// text, such as an SDDL definition.  <json> may be modified.
+void st_encoder_json(STEncoder encoder, char *json);
+
+// Get the first error that occured since the last reset, or CANOPY_SUCCESS.
+CanopyResultEnum st_encoder_result(STEncoder encoder);
+
+// Get the encoded bytes.  Owned by the encoder; valid until the next call
+// that modifies it.  For JSON, the bytes are also NUL-terminated.
+const char * st_encoder_bytes(STEncoder encoder);
+
+// Get the number of encoded bytes.
+size_t st_encoder_len(STEncoder encoder);
+
+// Leave <pre> bytes of padding in front of, and <post> bytes after, the
+// encoded bytes in every buffer the encoder uses, so that a transport can
+// frame them in place.  Call it before encoding anything.
+void st_encoder_set_padding(STEncoder encoder, size_t pre, size_t post);
+
+// Take the encoder's buffer without copying it, giving it another one in
+// exchange.  On return, *<buf> is an allocation of *<capacity> bytes holding
+// the encoded bytes at offset <pre> (NUL-terminated, for JSON).  The buffer
+// passed in must come from malloc (or be NULL, with a capacity of 0); the
+// encoder keeps it for reuse and is reset.
+void st_encoder_swap_buffer(STEncoder encoder, char **buf, size_t *capacity);
+
+typedef struct STDecoderVTable_t STDecoderVTable_t;
+
+// Decoder state.  Like the readers it wraps, it is meant to live on the
+// stack; only access it through the st_decoder_* routines.
+typedef struct STDecoder_t
+{
+    const STDecoderVTable_t *vtable;
+    union
+    {
+        STJsonReader_t json;
+        STCborReader_t cbor;
+    } reader;
+} STDecoder_t;
+
+typedef STDecoder_t * STDecoder;
+
+// Prepare <decoder> to parse the <len> bytes at <buf> using <encoding>.  The
+// buffer is parsed in place.
+CanopyResultEnum st_decoder_init(
+        STDecoder decoder,
+        CanopyEncodingEnum encoding,
+        char *buf,
+        size_t len);
+
+// Guess which encoding a received payload uses.  CBOR documents start with a
+// map header (0xA0-0xBF), which can never start a JSON document.
+CanopyEncodingEnum st_codec_detect_encoding(const char *buf, size_t len);
+
+STTokenEnum st_decoder_next(STDecoder decoder);
+bool st_decoder_peek_end(STDecoder decoder);
+const char * st_decoder_string(STDecoder decoder);
+size_t st_decoder_string_len(STDecoder decoder);
+bool st_decoder_number(STDecoder decoder, double *out);
+
+// Read and discard one complete value (including any nested objects and
+// arrays).  Typically used to skip the value of an unrecognized key.
+CanopyResultEnum st_decoder_skip_value(STDecoder decoder);
+
+// Get the name used for <encoding> during handshake negotiation ("json",
+// "cbor"), or NULL if unknown.
+const char * st_codec_encoding_name(CanopyEncodingEnum encoding);
+
+// Look up an encoding by its negotiation name.  Returns false if the name
+// isn't recognized.
+bool st_codec_encoding_from_name(const char *name, CanopyEncodingEnum *out);
+
+#endif // ST_CODEC_INCLUDED
@@ -0,0 +1,37 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_TOKEN_INCLUDED
+#define ST_TOKEN_INCLUDED
+
+// Tokens produced by the payload pull parsers (JSON and CBOR).  Both parsers
+// describe a document in terms of the same JSON-like data model, so code that
+// consumes tokens doesn't need to know which encoding it is reading.
+typedef enum
+{
+    ST_TOKEN_ERROR,
+    ST_TOKEN_END,
+    ST_TOKEN_BEGIN_OBJECT,
+    ST_TOKEN_END_OBJECT,
+    ST_TOKEN_BEGIN_ARRAY,
+    ST_TOKEN_END_ARRAY,
+    ST_TOKEN_KEY,
+    ST_TOKEN_STRING,
+    ST_TOKEN_NUMBER,
+    ST_TOKEN_TRUE,
+    ST_TOKEN_FALSE,
+    ST_TOKEN_NULL,
+} STTokenEnum;
+
+#endif // ST_TOKEN_INCLUDED
@@ -16,18 +16,62 @@
 #define ST_HTTP_INCLUDED
 
 // HTTP utility library for Canopy.
+//
+// Requests are asynchronous: st_http_post queues a request and returns right
+// away, and st_http_client_poll (called periodically by the thread that owns
+// the client) moves transfers along and completes each request's promise
+// when its response arrives.
 
 #include <canopy.h>
+#include <stddef.h>
+
+// Maximum number of requests that can be queued or in flight at once.
+#define ST_HTTP_MAX_REQUESTS 4
+
+// An STHttpClient holds one HTTP connection (kept alive between requests)
+// and the buffers used for requests and responses, so that consecutive
+// requests to the same server skip the TCP (and TLS) handshake and don't
+// allocate.  It must only be used by one thread at a time.
+typedef struct STHttpClient_t * STHttpClient;
+
+// Called from st_http_client_poll when a request fails.
+typedef void (*STHttpFailureCallback)(STHttpClient client, CanopyResultEnum result, void *userdata);
+
+// Create a new HTTP client.  Returns NULL if out of memory.
+STHttpClient st_http_client_new();
 
-// Send an HTTP POST request.
+// Free HTTP client, closing its connection.  Requests that haven't completed
+// are aborted, and their promises complete with
+// CANOPY_ERROR_CONNECTION_FAILED.
+void st_http_client_free(STHttpClient client);
+
+// Set a callback to be triggered whenever a request fails.
+void st_http_client_on_failure(STHttpClient client, STHttpFailureCallback cb, void *userdata);
+
+// Queue an HTTP POST request.
 // <url> is the URL to POST to.
-// <payload> is the request body.
-// <outPromise>, if non-NULL, gets set to the address of a newly-allocated
-// promise object that can be used to wait for completion of the request.
+// <payload> is the request body, <len> bytes long.  It is copied.
+// <timeout_ms> bounds the whole request, including time spent queued and
+// connecting.  0 means no timeout.
+// <promise>, if non-NULL, gets completed from st_http_client_poll once the
+// server has responded (or the request has failed).
+//
+// Returns CANOPY_ERROR_SYNC_IN_PROGRESS if ST_HTTP_MAX_REQUESTS requests are
+// already outstanding.
 CanopyResultEnum st_http_post(
-        CanopyContext ctx, 
+        STHttpClient client,
         const char *url, 
         const char *payload, 
-        CanopyPromise *outPromise);
+        size_t len,
+        uint32_t timeout_ms,
+        CanopyPromise promise);
+
+// Perform outstanding transfers, waiting up to <timeout_ms> for network
+// activity, and complete any requests that have finished.  Returns the
+// number of requests still outstanding.
+int st_http_client_poll(STHttpClient client, uint32_t timeout_ms);
+
+// Get the number of requests queued or in flight.
+int st_http_client_num_pending(STHttpClient client);
 
 #endif // ST_HTTP_INCLUDED
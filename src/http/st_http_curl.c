@@ -15,75 +15,293 @@
 // HTTP utility library for Canopy.
 
 #include "http/st_http.h"
-#include "red_string.h"
+#include "log/st_log.h"
+#include "promise/st_promise.h"
 #include <curl/curl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
-// Handler for CURL write callback.  Concatenates received bytes into a
-// RedStringList object, for easy conversion to a string when the whole
-// response has been received.
+// One request slot.  Slots (and their easy handles and buffers) are reused,
+// so that steady-state requests don't allocate.
+typedef struct _Request_t
+{
+    CURL *curl;
+    bool in_use;
+
+    // Copy of the request body; libcurl reads it during the transfer.
+    char *payload;
+    size_t payload_capacity;
+
+    // Response body.  Grown as needed; always NUL-terminated.
+    char *response;
+    size_t response_len;
+    size_t response_capacity;
+    bool response_oom;
+
+    CanopyPromise promise;
+} _Request_t;
+
+struct STHttpClient_t
+{
+    // Requests run on one multi handle, which owns the connection cache.
+    // At most one connection to the server is opened: requests queue up on
+    // it in order, and are multiplexed when the server speaks HTTP/2.
+    CURLM *multi;
+
+    struct curl_slist *headers;
+
+    _Request_t requests[ST_HTTP_MAX_REQUESTS];
+    int num_pending;
+
+    STHttpFailureCallback on_failure;
+    void *on_failure_userdata;
+};
+
+STHttpClient st_http_client_new()
+{
+    STHttpClient client;
+    int i;
+
+    client = calloc(1, sizeof(struct STHttpClient_t));
+    if (!client)
+    {
+        return NULL;
+    }
+
+    client->multi = curl_multi_init();
+    if (!client->multi)
+    {
+        free(client);
+        return NULL;
+    }
+    curl_multi_setopt(client->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(client->multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
+
+    client->headers = curl_slist_append(NULL, "Content-Type: application/json");
+    if (!client->headers)
+    {
+        st_http_client_free(client);
+        return NULL;
+    }
+
+    for (i = 0; i < ST_HTTP_MAX_REQUESTS; i++)
+    {
+        _Request_t *req = &client->requests[i];
+        req->curl = curl_easy_init();
+        if (!req->curl)
+        {
+            st_http_client_free(client);
+            return NULL;
+        }
+
+        // Options that are the same for every request.
+        curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, client->headers);
+        curl_easy_setopt(req->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+        // Timeouts would otherwise use signals, which aren't safe on the sync
+        // thread.
+        curl_easy_setopt(req->curl, CURLOPT_NOSIGNAL, 1L);
+    }
+    return client;
+}
+
+// Finish a request and release its slot.
+static void _complete(STHttpClient client, _Request_t *req, CanopyResultEnum result)
+{
+    curl_multi_remove_handle(client->multi, req->curl);
+    req->in_use = false;
+    client->num_pending--;
+    if (result != CANOPY_SUCCESS && client->on_failure)
+    {
+        client->on_failure(client, result, client->on_failure_userdata);
+    }
+    if (req->promise)
+    {
+        st_promise_complete(req->promise, result);
+        req->promise = NULL;
+    }
+}
+
+void st_http_client_free(STHttpClient client)
+{
+    int i;
+    if (!client)
+    {
+        return;
+    }
+    client->on_failure = NULL;
+    for (i = 0; i < ST_HTTP_MAX_REQUESTS; i++)
+    {
+        _Request_t *req = &client->requests[i];
+        if (req->in_use)
+        {
+            _complete(client, req, CANOPY_ERROR_CONNECTION_FAILED);
+        }
+        if (req->curl)
+        {
+            curl_easy_cleanup(req->curl);
+        }
+        free(req->payload);
+        free(req->response);
+    }
+    curl_multi_cleanup(client->multi);
+    curl_slist_free_all(client->headers);
+    free(client);
+}
+
+void st_http_client_on_failure(STHttpClient client, STHttpFailureCallback cb, void *userdata)
+{
+    client->on_failure = cb;
+    client->on_failure_userdata = userdata;
+}
+
+// Handler for CURL write callback.  Appends received bytes to the request's
+// response buffer.
 static size_t _curl_write_handler(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
-    RedStringList response = (RedStringList)userdata;
-    RedStringList_AppendChars(response, ptr);
-    return size*nmemb;
+    _Request_t *req = (_Request_t *)userdata;
+    size_t len = size*nmemb;
+
+    if (req->response_len + len + 1 > req->response_capacity)
+    {
+        size_t newCapacity = req->response_capacity ? req->response_capacity : 256;
+        char *newBuf;
+        while (newCapacity < req->response_len + len + 1)
+        {
+            newCapacity *= 2;
+        }
+        newBuf = realloc(req->response, newCapacity);
+        if (!newBuf)
+        {
+            // Returning less than <len> makes libcurl abort the transfer.
+            req->response_oom = true;
+            return 0;
+        }
+        req->response = newBuf;
+        req->response_capacity = newCapacity;
+    }
+    memcpy(&req->response[req->response_len], ptr, len);
+    req->response_len += len;
+    req->response[req->response_len] = '\0';
+    return len;
 }
 
-// Implemented using libcurl's "easy" API.
+// Implemented using libcurl's "multi" API.
 CanopyResultEnum st_http_post(
-        CanopyContext ctx, 
+        STHttpClient client,
         const char *url, 
         const char *payload, 
-        CanopyPromise *outPromise)
+        size_t len,
+        uint32_t timeout_ms,
+        CanopyPromise promise)
 {
-    // TODO: fix cleanup & error handling
-    CURL *curl = NULL;
-    RedStringList response_sl;
-    char *response_body;
-    //RedJsonObject response_json;
-
-    printf("Sending payload to %s:\n%s\n\n", url, payload);
-
-    response_sl = RedStringList_New();
+    _Request_t *req = NULL;
+    int i;
 
-    /*
-    results = calloc(1, sizeof(_CanopyHTTPResults));
-    if (!results)
+    for (i = 0; i < ST_HTTP_MAX_REQUESTS; i++)
     {
-        return CANOPY_ERROR_OUT_OF_MEMORY;
-    }*/
+        if (!client->requests[i].in_use)
+        {
+            req = &client->requests[i];
+            break;
+        }
+    }
+    if (!req)
+    {
+        return CANOPY_ERROR_SYNC_IN_PROGRESS;
+    }
 
-    curl = curl_easy_init();
-    if (!curl)
+    if (len > req->payload_capacity)
     {
-        goto cleanup;
+        char *newBuf = realloc(req->payload, len);
+        if (!newBuf)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        req->payload = newBuf;
+        req->payload_capacity = len;
     }
+    memcpy(req->payload, payload, len);
+    req->response_len = 0;
+    req->response_oom = false;
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _curl_write_handler);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response_sl);
+    st_log_debug("Queueing payload to %s: %.*s", url, (int)len, payload);
 
-    curl_easy_perform(curl);
+    curl_easy_setopt(req->curl, CURLOPT_URL, url);
+    curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, req->payload);
+    curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, _curl_write_handler);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+    curl_easy_setopt(req->curl, CURLOPT_TIMEOUT_MS,
+            timeout_ms > LONG_MAX ? LONG_MAX : (long)timeout_ms);
 
-    // TODO: check server response
-    response_body = RedStringList_ToNewChars(response_sl);
-    if (!response_body)
+    if (curl_multi_add_handle(client->multi, req->curl) != CURLM_OK)
+    {
+        return CANOPY_ERROR_UNKNOWN;
+    }
+    req->in_use = true;
+    req->promise = promise;
+    client->num_pending++;
+    return CANOPY_SUCCESS;
+}
+
+// Result of a finished transfer.
+static CanopyResultEnum _transfer_result(_Request_t *req, CURLcode curlResult)
+{
+    long status = 0;
+    if (req->response_oom)
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
-    printf("Response: %s\n", response_body);
+    if (curlResult != CURLE_OK)
+    {
+        st_log_warn("HTTP POST failed: %s", curl_easy_strerror(curlResult));
+        return (curlResult == CURLE_OPERATION_TIMEDOUT) ?
+            CANOPY_ERROR_TIMED_OUT : CANOPY_ERROR_CONNECTION_FAILED;
+    }
 
-    // Parse response body
-    /*response_json = RedJson_Parse(response_body);
-    if (!response_json)
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &status);
+    st_log_debug("Response (%ld): %s", status, req->response_len ? req->response : "");
+    if (status < 200 || status >= 300)
     {
-        return CANOPY_ERROR_UNKNOWN;
+        return CANOPY_ERROR_CONNECTION_FAILED;
     }
-    */
     return CANOPY_SUCCESS;
+}
+
+int st_http_client_poll(STHttpClient client, uint32_t timeout_ms)
+{
+    int running;
+    int msgsLeft;
+    CURLMsg *msg;
+
+    if (client->num_pending == 0)
+    {
+        return 0;
+    }
+
+    curl_multi_perform(client->multi, &running);
+    if (running > 0 && timeout_ms > 0)
+    {
+        curl_multi_wait(client->multi, NULL, 0, (int)timeout_ms, NULL);
+        curl_multi_perform(client->multi, &running);
+    }
 
-cleanup:
-    RedStringList_Free(response_sl);
-    return CANOPY_ERROR_UNKNOWN;
+    while ((msg = curl_multi_info_read(client->multi, &msgsLeft)) != NULL)
+    {
+        _Request_t *req;
+        if (msg->msg != CURLMSG_DONE)
+        {
+            continue;
+        }
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+        _complete(client, req, _transfer_result(req, msg->data.result));
+    }
+    return client->num_pending;
 }
 
+int st_http_client_num_pending(STHttpClient client)
+{
+    return client->num_pending;
+}
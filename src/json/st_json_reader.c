@@ -0,0 +1,358 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// In-situ pull parser for JSON.
+
+#include "json/st_json_reader.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Longest number (in characters) that st_json_reader_number will convert.
+#define _MAX_NUMBER_CHARS 63
+
+void st_json_reader_init(STJsonReader reader, char *buf, size_t len)
+{
+    memset(reader, 0, sizeof(STJsonReader_t));
+    reader->pos = buf;
+    reader->end = buf + len;
+    reader->first = true;
+}
+
+static STTokenEnum _fail(STJsonReader reader)
+{
+    reader->error = true;
+    return ST_TOKEN_ERROR;
+}
+
+static void _skip_whitespace(STJsonReader reader)
+{
+    while (reader->pos < reader->end)
+    {
+        char c = *reader->pos;
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        reader->pos++;
+    }
+}
+
+static int _hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Parse the 4 hex digits of a \uXXXX escape at <p>.  Returns -1 on error.
+static long _parse_hex4(const char *p, const char *end)
+{
+    long out = 0;
+    int i;
+    if (end - p < 4)
+        return -1;
+    for (i = 0; i < 4; i++)
+    {
+        int digit = _hex_digit(p[i]);
+        if (digit < 0)
+            return -1;
+        out = (out << 4) | digit;
+    }
+    return out;
+}
+
+// Encode <codepoint> as UTF-8 at <out>.  Returns number of bytes written.
+static size_t _encode_utf8(char *out, unsigned long codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800)
+    {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint < 0x10000)
+    {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+// Parse a string starting at the opening quote, unescaping it in place.  An
+// escape sequence is never shorter than what it decodes to, so the unescaped
+// text always fits in the space the escaped text occupied, with room left
+// over for a NUL terminator where the closing quote was.
+static bool _read_string(STJsonReader reader)
+{
+    char *read = reader->pos + 1;
+    char *write = read;
+    char *start = read;
+
+    while (1)
+    {
+        char c;
+        if (read >= reader->end)
+            return false;
+        c = *read;
+        if (c == '"')
+            break;
+        if ((unsigned char)c < 0x20)
+            return false;
+        if (c != '\\')
+        {
+            *write++ = *read++;
+            continue;
+        }
+
+        read++;
+        if (read >= reader->end)
+            return false;
+        switch (*read)
+        {
+            case '"': *write++ = '"'; read++; break;
+            case '\\': *write++ = '\\'; read++; break;
+            case '/': *write++ = '/'; read++; break;
+            case 'b': *write++ = '\b'; read++; break;
+            case 'f': *write++ = '\f'; read++; break;
+            case 'n': *write++ = '\n'; read++; break;
+            case 'r': *write++ = '\r'; read++; break;
+            case 't': *write++ = '\t'; read++; break;
+            case 'u':
+            {
+                long codepoint, low;
+                codepoint = _parse_hex4(read + 1, reader->end);
+                if (codepoint < 0)
+                    return false;
+                read += 5;
+                if (codepoint >= 0xD800 && codepoint <= 0xDBFF)
+                {
+                    // Surrogate pair
+                    if (reader->end - read < 6 || read[0] != '\\' || read[1] != 'u')
+                        return false;
+                    low = _parse_hex4(read + 2, reader->end);
+                    if (low < 0xDC00 || low > 0xDFFF)
+                        return false;
+                    read += 6;
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                write += _encode_utf8(write, codepoint);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    *write = '\0';
+    reader->str = start;
+    reader->str_len = write - start;
+    reader->pos = read + 1;
+    return true;
+}
+
+static bool _read_literal(STJsonReader reader, const char *literal)
+{
+    size_t len = strlen(literal);
+    if ((size_t)(reader->end - reader->pos) < len)
+        return false;
+    if (memcmp(reader->pos, literal, len))
+        return false;
+    reader->pos += len;
+    return true;
+}
+
+// Can <c> appear in a number?  Checked explicitly rather than with strchr,
+// which would also match a NUL in the received payload.
+static bool _is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') ||
+        c == '+' || c == '-' || c == '.' || c == 'e' || c == 'E';
+}
+
+static bool _read_number(STJsonReader reader)
+{
+    char *start = reader->pos;
+    while (reader->pos < reader->end && _is_number_char(*reader->pos))
+    {
+        reader->pos++;
+    }
+    reader->str = start;
+    reader->str_len = reader->pos - start;
+    return reader->str_len > 0;
+}
+
+// Parse a value at the current position.
+static STTokenEnum _read_value(STJsonReader reader)
+{
+    char c;
+
+    reader->after_key = false;
+    reader->first = false;
+    if (reader->depth == 0)
+    {
+        // Whatever follows is the whole document.
+        reader->done = true;
+    }
+
+    if (reader->pos >= reader->end)
+        return _fail(reader);
+
+    c = *reader->pos;
+    switch (c)
+    {
+        case '{':
+        case '[':
+            if (reader->depth >= ST_JSON_READER_MAX_DEPTH)
+                return _fail(reader);
+            reader->in_object[reader->depth++] = (c == '{');
+            reader->first = true;
+            reader->done = false;
+            reader->pos++;
+            return (c == '{') ? ST_TOKEN_BEGIN_OBJECT : ST_TOKEN_BEGIN_ARRAY;
+        case '"':
+            if (!_read_string(reader))
+                return _fail(reader);
+            return ST_TOKEN_STRING;
+        case 't':
+            if (!_read_literal(reader, "true"))
+                return _fail(reader);
+            return ST_TOKEN_TRUE;
+        case 'f':
+            if (!_read_literal(reader, "false"))
+                return _fail(reader);
+            return ST_TOKEN_FALSE;
+        case 'n':
+            if (!_read_literal(reader, "null"))
+                return _fail(reader);
+            return ST_TOKEN_NULL;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9'))
+            {
+                if (!_read_number(reader))
+                    return _fail(reader);
+                return ST_TOKEN_NUMBER;
+            }
+            return _fail(reader);
+    }
+}
+
+STTokenEnum st_json_reader_next(STJsonReader reader)
+{
+    bool inObject;
+
+    if (reader->error)
+        return ST_TOKEN_ERROR;
+
+    _skip_whitespace(reader);
+
+    if (reader->depth == 0)
+    {
+        if (!reader->done)
+            return _read_value(reader);
+
+        // Only whitespace may follow the top-level value.
+        if (reader->pos != reader->end)
+            return _fail(reader);
+        return ST_TOKEN_END;
+    }
+
+    if (reader->pos >= reader->end)
+        return _fail(reader);
+
+    if (reader->after_key)
+        return _read_value(reader);
+
+    // End of object or array?
+    inObject = reader->in_object[reader->depth - 1];
+    if (*reader->pos == (inObject ? '}' : ']'))
+    {
+        reader->pos++;
+        reader->depth--;
+        reader->first = false;
+        reader->done = (reader->depth == 0);
+        return inObject ? ST_TOKEN_END_OBJECT : ST_TOKEN_END_ARRAY;
+    }
+
+    // Entries after the first are preceded by a comma.
+    if (!reader->first)
+    {
+        if (*reader->pos != ',')
+            return _fail(reader);
+        reader->pos++;
+        _skip_whitespace(reader);
+        if (reader->pos >= reader->end)
+            return _fail(reader);
+    }
+
+    if (!inObject)
+        return _read_value(reader);
+
+    // Object member: read key and colon.
+    if (*reader->pos != '"' || !_read_string(reader))
+        return _fail(reader);
+    _skip_whitespace(reader);
+    if (reader->pos >= reader->end || *reader->pos != ':')
+        return _fail(reader);
+    reader->pos++;
+    reader->first = false;
+    reader->after_key = true;
+    return ST_TOKEN_KEY;
+}
+
+bool st_json_reader_peek_end(STJsonReader reader)
+{
+    if (reader->error || reader->depth == 0 || reader->after_key)
+        return false;
+    _skip_whitespace(reader);
+    if (reader->pos >= reader->end)
+        return false;
+    return *reader->pos == (reader->in_object[reader->depth - 1] ? '}' : ']');
+}
+
+const char * st_json_reader_string(STJsonReader reader)
+{
+    return reader->str;
+}
+
+size_t st_json_reader_string_len(STJsonReader reader)
+{
+    return reader->str_len;
+}
+
+bool st_json_reader_number(STJsonReader reader, double *out)
+{
+    // The number's text isn't NUL-terminated (the next character belongs to
+    // the following token), so convert a copy of it.
+    char buf[_MAX_NUMBER_CHARS + 1];
+    char *endptr;
+    if (!reader->str || reader->str_len == 0 || reader->str_len > _MAX_NUMBER_CHARS)
+        return false;
+    memcpy(buf, reader->str, reader->str_len);
+    buf[reader->str_len] = '\0';
+    *out = strtod(buf, &endptr);
+    return (endptr == buf + reader->str_len);
+}
@@ -0,0 +1,101 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_JSON_READER_INCLUDED
+#define ST_JSON_READER_INCLUDED
+
+// In-situ pull parser for JSON.
+//
+// Reads JSON text one token at a time, directly out of the caller's buffer.
+// Nothing is allocated: the reader lives on the stack, and keys and strings
+// are unescaped in place, so that the pointers it hands out point into the
+// buffer itself.  The buffer is modified in the process.
+//
+//      STJsonReader_t reader;
+//      st_json_reader_init(&reader, buf, len);
+//      if (st_json_reader_next(&reader) != ST_TOKEN_BEGIN_OBJECT)
+//          return CANOPY_ERROR_PARSING_PAYLOAD;
+//      while (st_json_reader_next(&reader) == ST_TOKEN_KEY)
+//      {
+//          const char *key = st_json_reader_string(&reader);
+//          ... read or skip the value ...
+//      }
+//
+// Tokens are the ones shared with the other payload parsers (see
+// codec/st_token.h).  Once an error is encountered, every subsequent call
+// returns ST_TOKEN_ERROR.
+
+#include <canopy.h>
+#include <stddef.h>
+#include "codec/st_token.h"
+
+// Maximum nesting depth of objects and arrays.
+#define ST_JSON_READER_MAX_DEPTH 32
+
+
+// Reader state.  This is declared here so that readers can be placed on the
+// stack; the fields should only be accessed through the st_json_reader_*
+// routines.
+typedef struct STJsonReader_t
+{
+    char *pos;
+    char *end;
+
+    unsigned depth;
+    bool in_object[ST_JSON_READER_MAX_DEPTH];
+
+    // No entry has been read yet in the innermost object/array.
+    bool first;
+
+    // A key has just been read, so a value comes next.
+    bool after_key;
+
+    // The top-level value has been read completely.
+    bool done;
+
+    bool error;
+
+    // Current KEY, STRING or NUMBER token's text.
+    char *str;
+    size_t str_len;
+} STJsonReader_t;
+
+typedef STJsonReader_t * STJsonReader;
+
+// Prepare <reader> to parse the <len> bytes at <buf>.  The buffer must stay
+// alive (and untouched by anyone else) while it is being read.
+void st_json_reader_init(STJsonReader reader, char *buf, size_t len);
+
+// Read the next token.  Returns ST_TOKEN_END once the top-level value
+// has been consumed, or ST_TOKEN_ERROR on malformed input.
+STTokenEnum st_json_reader_next(STJsonReader reader);
+
+// Does the next token close the innermost object or array?  Does not consume
+// anything.  Useful for reading array elements with a routine that expects a
+// value.
+bool st_json_reader_peek_end(STJsonReader reader);
+
+// Get the current KEY or STRING token's unescaped, NUL-terminated text.  The
+// pointer points into the buffer being parsed and stays valid for as long as
+// the buffer does.
+const char * st_json_reader_string(STJsonReader reader);
+
+// Get the length in bytes of the current KEY or STRING token's text.
+size_t st_json_reader_string_len(STJsonReader reader);
+
+// Convert the current NUMBER token to a double.  Returns false if the token
+// isn't a valid number.
+bool st_json_reader_number(STJsonReader reader, double *out);
+
+#endif // ST_JSON_READER_INCLUDED
@@ -0,0 +1,388 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Streaming JSON writer for Canopy.
+
+#include "json/st_json_writer.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum nesting depth of objects and arrays.
+#define _MAX_DEPTH 32
+
+// Room needed to print any number.
+#define _MAX_NUMBER_CHARS 32
+
+struct STJsonWriter_t
+{
+    // The allocation is <capacity> bytes at <base>: <pre> bytes of padding,
+    // the text at <buf>, its NUL terminator, and <post> bytes of padding.
+    char *base;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    size_t pre;
+    size_t post;
+
+    // Number of currently open objects/arrays.
+    unsigned depth;
+
+    // For each open object/array: has it got at least one entry yet (in
+    // which case the next entry needs a comma)?
+    bool has_entries[_MAX_DEPTH];
+
+    // Has a key just been written (in which case the next value doesn't need
+    // a comma)?
+    bool after_key;
+
+    CanopyResultEnum error;
+};
+
+STJsonWriter st_json_writer_new()
+{
+    return calloc(1, sizeof(struct STJsonWriter_t));
+}
+
+void st_json_writer_free(STJsonWriter writer)
+{
+    if (writer)
+    {
+        free(writer->base);
+        free(writer);
+    }
+}
+
+void st_json_writer_set_padding(STJsonWriter writer, size_t pre, size_t post)
+{
+    assert(writer->len == 0);
+    writer->pre = pre;
+    writer->post = post;
+    writer->buf = (writer->capacity >= pre + 1) ? &writer->base[pre] : NULL;
+    if (writer->buf)
+    {
+        writer->buf[0] = '\0';
+    }
+}
+
+void st_json_writer_swap_buffer(STJsonWriter writer, char **buf, size_t *capacity)
+{
+    char *base = writer->base;
+    size_t oldCapacity = writer->capacity;
+
+    writer->base = *buf;
+    writer->capacity = *capacity;
+    *buf = base;
+    *capacity = oldCapacity;
+
+    writer->len = 0;
+    st_json_writer_set_padding(writer, writer->pre, writer->post);
+    st_json_writer_reset(writer);
+}
+
+void st_json_writer_reset(STJsonWriter writer)
+{
+    writer->len = 0;
+    writer->depth = 0;
+    writer->after_key = false;
+    writer->error = CANOPY_SUCCESS;
+    if (writer->buf)
+    {
+        writer->buf[0] = '\0';
+    }
+}
+
+// Make sure there's room for <extra> more bytes plus a NUL terminator.
+static bool _reserve(STJsonWriter writer, size_t extra)
+{
+    size_t needed;
+    size_t newCapacity;
+    char *newBuf;
+
+    if (writer->error != CANOPY_SUCCESS)
+    {
+        return false;
+    }
+
+    needed = writer->pre + writer->len + extra + 1 + writer->post;
+    if (needed <= writer->capacity)
+    {
+        return true;
+    }
+
+    newCapacity = writer->capacity ? writer->capacity : 256;
+    while (newCapacity < needed)
+    {
+        newCapacity *= 2;
+    }
+    newBuf = realloc(writer->base, newCapacity);
+    if (!newBuf)
+    {
+        writer->error = CANOPY_ERROR_OUT_OF_MEMORY;
+        return false;
+    }
+    if (!writer->buf)
+    {
+        newBuf[writer->pre] = '\0';
+    }
+    writer->base = newBuf;
+    writer->buf = &newBuf[writer->pre];
+    writer->capacity = newCapacity;
+    return true;
+}
+
+static void _append(STJsonWriter writer, const char *data, size_t len)
+{
+    if (!_reserve(writer, len))
+    {
+        return;
+    }
+    memcpy(&writer->buf[writer->len], data, len);
+    writer->len += len;
+    writer->buf[writer->len] = '\0';
+}
+
+static void _append_char(STJsonWriter writer, char c)
+{
+    if (!_reserve(writer, 1))
+    {
+        return;
+    }
+    writer->buf[writer->len++] = c;
+    writer->buf[writer->len] = '\0';
+}
+
+// Emit a comma if needed before the next value (or key) at the current
+// nesting level.
+static void _begin_entry(STJsonWriter writer)
+{
+    if (writer->after_key)
+    {
+        writer->after_key = false;
+        return;
+    }
+    if (writer->depth > 0)
+    {
+        if (writer->has_entries[writer->depth - 1])
+        {
+            _append_char(writer, ',');
+        }
+        writer->has_entries[writer->depth - 1] = true;
+    }
+}
+
+static void _open(STJsonWriter writer, char c)
+{
+    _begin_entry(writer);
+    if (writer->depth >= _MAX_DEPTH)
+    {
+        if (writer->error == CANOPY_SUCCESS)
+        {
+            writer->error = CANOPY_ERROR_INVALID_VALUE;
+        }
+        return;
+    }
+    _append_char(writer, c);
+    writer->has_entries[writer->depth] = false;
+    writer->depth++;
+}
+
+static void _close(STJsonWriter writer, char c)
+{
+    if (writer->depth > 0)
+    {
+        writer->depth--;
+    }
+    _append_char(writer, c);
+}
+
+static void _append_escaped(STJsonWriter writer, const char *sz)
+{
+    const char *start = sz;
+    const char *p;
+
+    _append_char(writer, '"');
+    for (p = sz; *p; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        const char *escape = NULL;
+        char unicodeEscape[7];
+
+        switch (c)
+        {
+            case '"': escape = "\\\""; break;
+            case '\\': escape = "\\\\"; break;
+            case '\b': escape = "\\b"; break;
+            case '\f': escape = "\\f"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '\t': escape = "\\t"; break;
+            default:
+            {
+                if (c < 0x20)
+                {
+                    snprintf(unicodeEscape, sizeof(unicodeEscape), "\\u%04x", c);
+                    escape = unicodeEscape;
+                }
+                break;
+            }
+        }
+
+        if (escape)
+        {
+            // Flush the run of unescaped characters, then the escape.
+            _append(writer, start, p - start);
+            _append(writer, escape, strlen(escape));
+            start = p + 1;
+        }
+    }
+    _append(writer, start, p - start);
+    _append_char(writer, '"');
+}
+
+// Print a number directly into the buffer.
+static void _append_number(STJsonWriter writer, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (!_reserve(writer, _MAX_NUMBER_CHARS))
+    {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(&writer->buf[writer->len], _MAX_NUMBER_CHARS + 1, fmt, ap);
+    va_end(ap);
+    if (n > 0 && n <= _MAX_NUMBER_CHARS)
+    {
+        writer->len += n;
+    }
+    writer->buf[writer->len] = '\0';
+}
+
+void st_json_writer_begin_object(STJsonWriter writer)
+{
+    _open(writer, '{');
+}
+
+void st_json_writer_end_object(STJsonWriter writer)
+{
+    _close(writer, '}');
+}
+
+void st_json_writer_begin_array(STJsonWriter writer)
+{
+    _open(writer, '[');
+}
+
+void st_json_writer_end_array(STJsonWriter writer)
+{
+    _close(writer, ']');
+}
+
+void st_json_writer_key(STJsonWriter writer, const char *key)
+{
+    _begin_entry(writer);
+    _append_escaped(writer, key);
+    _append_char(writer, ':');
+    writer->after_key = true;
+}
+
+void st_json_writer_null(STJsonWriter writer)
+{
+    _begin_entry(writer);
+    _append(writer, "null", 4);
+}
+
+void st_json_writer_bool(STJsonWriter writer, bool value)
+{
+    _begin_entry(writer);
+    if (value)
+        _append(writer, "true", 4);
+    else
+        _append(writer, "false", 5);
+}
+
+void st_json_writer_int(STJsonWriter writer, int64_t value)
+{
+    _begin_entry(writer);
+    _append_number(writer, "%" PRId64, value);
+}
+
+void st_json_writer_uint(STJsonWriter writer, uint64_t value)
+{
+    _begin_entry(writer);
+    _append_number(writer, "%" PRIu64, value);
+}
+
+void st_json_writer_float32(STJsonWriter writer, float value)
+{
+    _begin_entry(writer);
+    // JSON has no representation for NaN or infinity.
+    if (!isfinite(value))
+    {
+        _append(writer, "null", 4);
+        return;
+    }
+    // 9 significant digits are enough to round-trip any float.
+    _append_number(writer, "%.9g", (double)value);
+}
+
+void st_json_writer_float64(STJsonWriter writer, double value)
+{
+    _begin_entry(writer);
+    if (!isfinite(value))
+    {
+        _append(writer, "null", 4);
+        return;
+    }
+    // 17 significant digits are enough to round-trip any double.
+    _append_number(writer, "%.17g", value);
+}
+
+void st_json_writer_string(STJsonWriter writer, const char *sz)
+{
+    _begin_entry(writer);
+    if (!sz)
+    {
+        _append(writer, "null", 4);
+        return;
+    }
+    _append_escaped(writer, sz);
+}
+
+void st_json_writer_raw(STJsonWriter writer, const char *json)
+{
+    _begin_entry(writer);
+    _append(writer, json, strlen(json));
+}
+
+CanopyResultEnum st_json_writer_result(STJsonWriter writer)
+{
+    return writer->error;
+}
+
+const char * st_json_writer_chars(STJsonWriter writer)
+{
+    return writer->buf ? writer->buf : "";
+}
+
+size_t st_json_writer_len(STJsonWriter writer)
+{
+    return writer->len;
+}
@@ -0,0 +1,96 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_JSON_WRITER_INCLUDED
+#define ST_JSON_WRITER_INCLUDED
+
+// Streaming JSON writer for Canopy.
+//
+// Writes JSON text straight into a byte buffer owned by the writer, without
+// building an intermediate document tree.  The buffer is kept between
+// payloads, so once it has grown to the size of a typical payload,
+// serializing does not allocate at all:
+//
+//      st_json_writer_reset(writer);
+//      st_json_writer_begin_object(writer);
+//      st_json_writer_key(writer, "temperature");
+//      st_json_writer_float32(writer, 38.0f);
+//      st_json_writer_end_object(writer);
+//      if (st_json_writer_result(writer) == CANOPY_SUCCESS)
+//      {
+//          send(st_json_writer_chars(writer), st_json_writer_len(writer));
+//      }
+//
+// Commas and nesting are handled by the writer.  Errors (out of memory,
+// nesting too deep) are sticky: once one occurs, further calls do nothing and
+// st_json_writer_result reports the first error.
+
+#include <canopy.h>
+#include <stddef.h>
+
+typedef struct STJsonWriter_t * STJsonWriter;
+
+// Create a new JSON writer with an empty buffer.
+STJsonWriter st_json_writer_new();
+
+// Free JSON writer and its buffer.
+void st_json_writer_free(STJsonWriter writer);
+
+// Discard the contents of the buffer (keeping its capacity) and clear any
+// error, so that the writer can be used for a new document.
+void st_json_writer_reset(STJsonWriter writer);
+
+void st_json_writer_begin_object(STJsonWriter writer);
+void st_json_writer_end_object(STJsonWriter writer);
+void st_json_writer_begin_array(STJsonWriter writer);
+void st_json_writer_end_array(STJsonWriter writer);
+
+// Leave <pre> bytes of padding in front of the text, and <post> bytes after
+// its NUL terminator, in every buffer the writer uses.  This lets a transport
+// frame the text in place (see st_json_writer_swap_buffer).  Call it before
+// writing anything.
+void st_json_writer_set_padding(STJsonWriter writer, size_t pre, size_t post);
+
+// Exchange the writer's buffer for another one, without copying.  On return,
+// *<buf> is the writer's allocation of *<capacity> bytes, with the text
+// written so far (and its NUL terminator) at offset <pre>.  The writer takes
+// the buffer passed in (from malloc, or NULL with a capacity of 0) and is
+// reset.
+void st_json_writer_swap_buffer(STJsonWriter writer, char **buf, size_t *capacity);
+
+// Write an object member's key.  Must be followed by exactly one value.
+void st_json_writer_key(STJsonWriter writer, const char *key);
+
+void st_json_writer_null(STJsonWriter writer);
+void st_json_writer_bool(STJsonWriter writer, bool value);
+void st_json_writer_int(STJsonWriter writer, int64_t value);
+void st_json_writer_uint(STJsonWriter writer, uint64_t value);
+void st_json_writer_float32(STJsonWriter writer, float value);
+void st_json_writer_float64(STJsonWriter writer, double value);
+void st_json_writer_string(STJsonWriter writer, const char *sz);
+
+// Write a value that has already been serialized to JSON text.
+void st_json_writer_raw(STJsonWriter writer, const char *json);
+
+// Get the first error that occured since the last reset, or CANOPY_SUCCESS.
+CanopyResultEnum st_json_writer_result(STJsonWriter writer);
+
+// Get the NUL-terminated JSON text written so far.  The pointer is owned by
+// the writer and is valid until the next call that modifies the writer.
+const char * st_json_writer_chars(STJsonWriter writer);
+
+// Get the length in bytes of the JSON text written so far.
+size_t st_json_writer_len(STJsonWriter writer);
+
+#endif // ST_JSON_WRITER_INCLUDED
@@ -57,6 +57,17 @@ STOptions st_options_new_default()
     _OPTION_SET_AND_FREE_OLD(options, CANOPY_CLOUD_SERVER, "canopy.link");
     _OPTION_SET(options, CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS);
     _OPTION_SET(options, CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS);
+    _OPTION_SET(options, CANOPY_PAYLOAD_ENCODING, CANOPY_ENCODING_CBOR);
+    _OPTION_SET(options, CANOPY_SYNC_BLOCKING, true);
+    _OPTION_SET(options, CANOPY_SYNC_TIMEOUT_MS, 10000);
+    _OPTION_SET(options, CANOPY_WS_QUEUE_HIGH_WATERMARK, 8);
+    _OPTION_SET(options, CANOPY_WS_QUEUE_LOW_WATERMARK, 2);
+    _OPTION_SET(options, CANOPY_WS_QUEUE_POLICY, CANOPY_QUEUE_POLICY_COALESCE);
+    _OPTION_SET(options, CANOPY_WS_RX_BUFFER_SIZE, 4096);
+    _OPTION_SET(options, CANOPY_WS_MAX_MESSAGE_SIZE, 1048576);
+    _OPTION_SET(options, CANOPY_WS_RECONNECT_MIN_MS, 1000);
+    _OPTION_SET(options, CANOPY_WS_RECONNECT_MAX_MS, 60000);
+    _OPTION_SET(options, CANOPY_WS_COMPRESSION, false);
 
     return options;
 }
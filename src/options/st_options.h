@@ -63,7 +63,16 @@
     _OPTION_LIST_FOREACH(CANOPY_SYNC_BLOCKING, bool, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_SYNC_TIMEOUT_MS, int, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_VAR_SEND_PROTOCOL, CanopyProtocolEnum, int, _noop, atoi) \
-    _OPTION_LIST_FOREACH(CANOPY_VAR_RECV_PROTOCOL, CanopyProtocolEnum, int, _noop, atoi)
+    _OPTION_LIST_FOREACH(CANOPY_VAR_RECV_PROTOCOL, CanopyProtocolEnum, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_PAYLOAD_ENCODING, CanopyEncodingEnum, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_QUEUE_HIGH_WATERMARK, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_QUEUE_LOW_WATERMARK, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_QUEUE_POLICY, CanopyQueuePolicyEnum, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_RX_BUFFER_SIZE, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_MAX_MESSAGE_SIZE, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_RECONNECT_MIN_MS, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_RECONNECT_MAX_MS, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_COMPRESSION, bool, int, _noop, atoi)
 
 #define _GLOBAL_OPTION_LIST \
     _OPTION_LIST_FOREACH(CANOPY_LOG_ENABLED, bool, int, _noop, atoi) \
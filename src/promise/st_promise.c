@@ -0,0 +1,137 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Promise implementation using POSIX threads.
+
+#include "promise/st_promise.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct CanopyPromise_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    bool abandoned;
+    CanopyResultEnum result;
+} CanopyPromise_t;
+
+CanopyPromise st_promise_new()
+{
+    CanopyPromise promise;
+    pthread_condattr_t attr;
+
+    promise = calloc(1, sizeof(CanopyPromise_t));
+    if (!promise)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&promise->lock, NULL);
+
+    // Use the monotonic clock for timed waits, so that timeouts aren't
+    // affected by changes to the wall clock.
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&promise->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return promise;
+}
+
+void st_promise_free(CanopyPromise promise)
+{
+    if (promise)
+    {
+        pthread_cond_destroy(&promise->cond);
+        pthread_mutex_destroy(&promise->lock);
+        free(promise);
+    }
+}
+
+void st_promise_reset(CanopyPromise promise)
+{
+    pthread_mutex_lock(&promise->lock);
+    promise->done = false;
+    promise->result = CANOPY_SUCCESS;
+    pthread_mutex_unlock(&promise->lock);
+}
+
+void st_promise_complete(CanopyPromise promise, CanopyResultEnum result)
+{
+    pthread_mutex_lock(&promise->lock);
+    if (promise->abandoned)
+    {
+        pthread_mutex_unlock(&promise->lock);
+        st_promise_free(promise);
+        return;
+    }
+    promise->done = true;
+    promise->result = result;
+    pthread_cond_broadcast(&promise->cond);
+    pthread_mutex_unlock(&promise->lock);
+}
+
+void st_promise_abandon(CanopyPromise promise)
+{
+    bool done;
+    pthread_mutex_lock(&promise->lock);
+    done = promise->done;
+    promise->abandoned = true;
+    pthread_mutex_unlock(&promise->lock);
+    if (done)
+    {
+        st_promise_free(promise);
+    }
+}
+
+CanopyResultEnum st_promise_wait(CanopyPromise promise, int64_t timeout_us)
+{
+    struct timespec deadline;
+    CanopyResultEnum result;
+    int err = 0;
+
+    if (timeout_us >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_us / CANOPY_SECONDS;
+        deadline.tv_nsec += (timeout_us % CANOPY_SECONDS) * 1000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&promise->lock);
+    while (!promise->done && err != ETIMEDOUT)
+    {
+        if (timeout_us >= 0)
+            err = pthread_cond_timedwait(&promise->cond, &promise->lock, &deadline);
+        else
+            pthread_cond_wait(&promise->cond, &promise->lock);
+    }
+    result = promise->done ? promise->result : CANOPY_ERROR_TIMED_OUT;
+    pthread_mutex_unlock(&promise->lock);
+    return result;
+}
+
+CanopyResultEnum st_promise_result(CanopyPromise promise)
+{
+    CanopyResultEnum result;
+    pthread_mutex_lock(&promise->lock);
+    result = promise->done ? promise->result : CANOPY_ERROR_PROMISE_NOT_COMPLETE;
+    pthread_mutex_unlock(&promise->lock);
+    return result;
+}
@@ -0,0 +1,55 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_PROMISE_INCLUDED
+#define ST_PROMISE_INCLUDED
+
+// Promise utility library for Canopy.
+//
+// A CanopyPromise is completed exactly once per operation, by whichever
+// thread performs the operation, and may be waited on from any other thread.
+// The public canopy_promise_* routines in canopy.c are thin wrappers around
+// these.
+
+#include <canopy.h>
+
+// Create a new, pending promise.  Returns NULL if out of memory.
+CanopyPromise st_promise_new();
+
+// Free promise.
+void st_promise_free(CanopyPromise promise);
+
+// Put <promise> back in the pending state, so that it can be reused for
+// another operation.
+void st_promise_reset(CanopyPromise promise);
+
+// Complete <promise> with <result>, waking any threads waiting on it.  If
+// the promise has been abandoned, it is freed instead.
+void st_promise_complete(CanopyPromise promise, CanopyResultEnum result);
+
+// Give up on a promise that is still owned by an operation in progress (for
+// example, after a timed-out wait).  It is freed now if already complete,
+// otherwise when the operation completes it.
+void st_promise_abandon(CanopyPromise promise);
+
+// Block until <promise> completes or <timeout_us> microseconds elapse.  A
+// negative timeout waits forever.  Returns the promise's result, or
+// CANOPY_ERROR_TIMED_OUT.
+CanopyResultEnum st_promise_wait(CanopyPromise promise, int64_t timeout_us);
+
+// Get the promise's result, or CANOPY_ERROR_PROMISE_NOT_COMPLETE if it is
+// still pending.
+CanopyResultEnum st_promise_result(CanopyPromise promise);
+
+#endif // ST_PROMISE_INCLUDED
@@ -0,0 +1,367 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Shared event loop for WebSocket connections, using epoll.
+
+#include "reactor/st_reactor.h"
+#include "log/st_log.h"
+#include "websocket/st_websocket_lws.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Maximum number of ready sockets handled per wakeup.  More are picked up on
+// the next one.
+#define _MAX_EVENTS 64
+
+// Longest wait, so that libwebsockets gets to check its own timeouts about
+// once a second.
+#define _MAX_WAIT_MS 1000
+
+// Receive buffer size for connections on the reactor.
+#define _RX_BUFFER_SIZE 4096
+
+// A pending st_websocket_reactor_process call.
+typedef struct _ReactorPost_t
+{
+    STWebSocket ws;
+    uint64_t at_us;
+} _ReactorPost_t;
+
+typedef struct CanopyReactor_t
+{
+    struct libwebsocket_context *lws_ctx;
+    struct libwebsocket_protocols protocols[2];
+    int epoll_fd;
+
+    // eventfd that wakes the reactor thread when something is posted.
+    int wake_fd;
+
+    pthread_t thread;
+
+    // Posts that are due, taken out of <posts>.  Reactor thread only.
+    _ReactorPost_t *batch;
+    size_t batch_capacity;
+
+    // Everything below is protected by <lock>.
+    pthread_mutex_t lock;
+    bool quit;
+    _ReactorPost_t *posts;
+    size_t num_posts;
+    size_t posts_capacity;
+} CanopyReactor_t;
+
+static uint64_t _now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*CANOPY_SECONDS + (t.tv_nsec/1000);
+}
+
+static uint32_t _to_epoll_events(int pollEvents)
+{
+    uint32_t events = 0;
+    if (pollEvents & POLLIN)
+        events |= EPOLLIN;
+    if (pollEvents & POLLOUT)
+        events |= EPOLLOUT;
+    return events;
+}
+
+static short _to_poll_events(uint32_t epollEvents)
+{
+    short events = 0;
+    if (epollEvents & EPOLLIN)
+        events |= POLLIN;
+    if (epollEvents & EPOLLOUT)
+        events |= POLLOUT;
+    if (epollEvents & EPOLLERR)
+        events |= POLLERR;
+    if (epollEvents & EPOLLHUP)
+        events |= POLLHUP;
+    return events;
+}
+
+// Protocol callback for the reactor's context.  Keeps the epoll set in step
+// with the sockets libwebsockets wants watched, and passes everything else
+// on to the STWebSocket the connection belongs to.
+static int _reactor_callback(
+        struct libwebsocket_context *context,
+        struct libwebsocket *wsi,
+        enum libwebsocket_callback_reasons reason,
+        void *user,
+        void *in,
+        size_t len)
+{
+    CanopyReactor reactor = (CanopyReactor)libwebsocket_context_user(context);
+    struct libwebsocket_pollargs *pa = (struct libwebsocket_pollargs *)in;
+    struct epoll_event ev;
+
+    switch (reason)
+    {
+        case LWS_CALLBACK_ADD_POLL_FD:
+        case LWS_CALLBACK_CHANGE_MODE_POLL_FD:
+            memset(&ev, 0, sizeof(ev));
+            ev.events = _to_epoll_events(pa->events);
+            ev.data.fd = pa->fd;
+            if (epoll_ctl(reactor->epoll_fd,
+                        (reason == LWS_CALLBACK_ADD_POLL_FD) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                        pa->fd,
+                        &ev))
+            {
+                st_log_error("epoll_ctl failed (%d)", errno);
+                return 1;
+            }
+            return 0;
+        case LWS_CALLBACK_DEL_POLL_FD:
+            epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, pa->fd, NULL);
+            return 0;
+        default:
+            return st_websocket_lws_callback(context, wsi, reason, user, in, len);
+    }
+}
+
+// Run every post that is due, or every post if <all>.  Returns how long to
+// wait for the next one, in milliseconds (at most _MAX_WAIT_MS).
+static int _run_posts(CanopyReactor reactor, bool all)
+{
+    size_t i, kept, numDue = 0;
+    uint64_t now = _now_us();
+    uint64_t next = now + (uint64_t)_MAX_WAIT_MS*1000;
+
+    // Move due posts into the batch, so they run without holding the lock
+    // (st_websocket_reactor_process may post again).
+    pthread_mutex_lock(&reactor->lock);
+    if (reactor->num_posts > reactor->batch_capacity)
+    {
+        _ReactorPost_t *newBatch = realloc(reactor->batch,
+                reactor->num_posts * sizeof(_ReactorPost_t));
+        if (newBatch)
+        {
+            reactor->batch = newBatch;
+            reactor->batch_capacity = reactor->num_posts;
+        }
+    }
+    kept = 0;
+    for (i = 0; i < reactor->num_posts; i++)
+    {
+        _ReactorPost_t *post = &reactor->posts[i];
+        if ((all || post->at_us <= now) && numDue < reactor->batch_capacity)
+        {
+            reactor->batch[numDue++] = *post;
+        }
+        else
+        {
+            if (post->at_us < next)
+            {
+                next = post->at_us;
+            }
+            reactor->posts[kept++] = *post;
+        }
+    }
+    reactor->num_posts = kept;
+    pthread_mutex_unlock(&reactor->lock);
+
+    for (i = 0; i < numDue; i++)
+    {
+        st_websocket_reactor_process(reactor->batch[i].ws);
+    }
+
+    return (next <= now) ? 0 : (int)((next - now + 999) / 1000);
+}
+
+// Reactor thread.
+static void * _reactor_main(void *arg)
+{
+    CanopyReactor reactor = (CanopyReactor)arg;
+    struct epoll_event events[_MAX_EVENTS];
+    int timeoutMs = 0;
+
+    while (1)
+    {
+        int i, n;
+
+        pthread_mutex_lock(&reactor->lock);
+        if (reactor->quit)
+        {
+            pthread_mutex_unlock(&reactor->lock);
+            break;
+        }
+        pthread_mutex_unlock(&reactor->lock);
+
+        n = epoll_wait(reactor->epoll_fd, events, _MAX_EVENTS, timeoutMs);
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == reactor->wake_fd)
+            {
+                uint64_t count;
+                if (read(reactor->wake_fd, &count, sizeof(count)) < 0)
+                {
+                    // Nothing to drain.
+                }
+            }
+            else
+            {
+                struct pollfd pfd;
+                pfd.fd = events[i].data.fd;
+                pfd.events = _to_poll_events(events[i].events);
+                pfd.revents = pfd.events;
+                libwebsocket_service_fd(reactor->lws_ctx, &pfd);
+            }
+        }
+
+        // Let libwebsockets check its timeouts.
+        libwebsocket_service_fd(reactor->lws_ctx, NULL);
+
+        timeoutMs = _run_posts(reactor, false);
+    }
+    return NULL;
+}
+
+static void _wake(CanopyReactor reactor)
+{
+    uint64_t one = 1;
+    if (write(reactor->wake_fd, &one, sizeof(one)) < 0)
+    {
+        // The counter is already non-zero, so the reactor wakes anyway.
+    }
+}
+
+CanopyReactor st_reactor_new()
+{
+    CanopyReactor reactor;
+    struct lws_context_creation_info info={0};
+    struct epoll_event ev;
+
+    reactor = calloc(1, sizeof(CanopyReactor_t));
+    if (!reactor)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&reactor->lock, NULL);
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epoll_fd < 0 || reactor->wake_fd < 0)
+    {
+        goto fail;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = reactor->wake_fd;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev))
+    {
+        goto fail;
+    }
+
+    reactor->protocols[0].name = ST_WEBSOCKET_PROTOCOL_NAME;
+    reactor->protocols[0].callback = _reactor_callback;
+    reactor->protocols[0].rx_buffer_size = _RX_BUFFER_SIZE;
+    // protocols[1] is the all-NULL terminator.
+
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = reactor->protocols;
+    info.extensions = NULL;
+    info.gid = -1;
+    info.uid = -1;
+    info.user = reactor;
+    reactor->lws_ctx = libwebsocket_create_context(&info);
+    if (!reactor->lws_ctx)
+    {
+        st_log_error("Failed to create libwebsocket context");
+        goto fail;
+    }
+
+    if (pthread_create(&reactor->thread, NULL, _reactor_main, reactor))
+    {
+        libwebsocket_context_destroy(reactor->lws_ctx);
+        goto fail;
+    }
+    return reactor;
+
+fail:
+    if (reactor->epoll_fd >= 0)
+        close(reactor->epoll_fd);
+    if (reactor->wake_fd >= 0)
+        close(reactor->wake_fd);
+    pthread_mutex_destroy(&reactor->lock);
+    free(reactor);
+    return NULL;
+}
+
+void st_reactor_free(CanopyReactor reactor)
+{
+    if (!reactor)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    reactor->quit = true;
+    pthread_mutex_unlock(&reactor->lock);
+    _wake(reactor);
+    pthread_join(reactor->thread, NULL);
+
+    // Now that the reactor thread is gone, it is safe to use the context
+    // from here.  Finish any outstanding work (such as freeing STWebSockets
+    // whose connections were closing), then close whatever is left.  Posts
+    // that aren't due yet run too: a freed STWebSocket waiting to reconnect
+    // is only destroyed once its reconnect post has been processed.
+    _run_posts(reactor, true);
+    libwebsocket_context_destroy(reactor->lws_ctx);
+    _run_posts(reactor, true);
+
+    close(reactor->epoll_fd);
+    close(reactor->wake_fd);
+    pthread_mutex_destroy(&reactor->lock);
+    free(reactor->posts);
+    free(reactor->batch);
+    free(reactor);
+}
+
+struct libwebsocket_context * st_reactor_lws_context(CanopyReactor reactor)
+{
+    return reactor->lws_ctx;
+}
+
+bool st_reactor_post(CanopyReactor reactor, STWebSocket ws, uint64_t at_us)
+{
+    pthread_mutex_lock(&reactor->lock);
+    if (reactor->num_posts == reactor->posts_capacity)
+    {
+        size_t newCapacity = reactor->posts_capacity ? reactor->posts_capacity*2 : 16;
+        _ReactorPost_t *newPosts = realloc(reactor->posts,
+                newCapacity * sizeof(_ReactorPost_t));
+        if (!newPosts)
+        {
+            pthread_mutex_unlock(&reactor->lock);
+            st_log_error("Out of memory posting to reactor");
+            return false;
+        }
+        reactor->posts = newPosts;
+        reactor->posts_capacity = newCapacity;
+    }
+    reactor->posts[reactor->num_posts].ws = ws;
+    reactor->posts[reactor->num_posts].at_us = at_us;
+    reactor->num_posts++;
+    pthread_mutex_unlock(&reactor->lock);
+
+    _wake(reactor);
+    return true;
+}
@@ -0,0 +1,53 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_REACTOR_INCLUDED
+#define ST_REACTOR_INCLUDED
+
+// Shared event loop for WebSocket connections.
+//
+// By default every CanopyContext's STWebSocket has its own libwebsockets
+// context, serviced by that context's sync thread.  A CanopyReactor instead
+// owns a single libwebsockets context and one thread that waits on all of
+// its connections' sockets with epoll (libwebsockets' external poll
+// support: the ADD/DEL/CHANGE_MODE_POLL_FD callbacks keep the epoll set up
+// to date, and ready sockets are handed to libwebsocket_service_fd).  Any
+// number of STWebSockets can be attached to it, so a process serving
+// thousands of devices makes one wait per tick instead of one per device.
+//
+// Only the reactor thread calls into the libwebsockets context.  Other
+// threads ask it to act on an STWebSocket's behalf with st_reactor_post.
+
+#include <canopy.h>
+#include <stdint.h>
+#include "websocket/st_websocket.h"
+
+struct libwebsocket_context;
+
+// Create a reactor and start its thread.  Returns NULL on failure.
+CanopyReactor st_reactor_new();
+
+// Stop the reactor thread and close any connections still open.  All
+// STWebSockets using the reactor must have been freed.
+void st_reactor_free(CanopyReactor reactor);
+
+// Get the reactor's libwebsockets context.  Reactor thread only.
+struct libwebsocket_context * st_reactor_lws_context(CanopyReactor reactor);
+
+// Have the reactor thread call st_websocket_reactor_process(<ws>) as soon as
+// possible, or not before <at_us> (CLOCK_MONOTONIC microseconds) if that is
+// later.  Can be called from any thread.  Returns false if out of memory.
+bool st_reactor_post(CanopyReactor reactor, STWebSocket ws, uint64_t at_us);
+
+#endif // ST_REACTOR_INCLUDED
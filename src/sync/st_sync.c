@@ -17,22 +17,349 @@
 #include "sync/st_sync.h"
 #include "cloudvar/st_cloudvar.h"
 #include "http/st_http.h"
+#include "codec/st_codec.h"
 #include "log/st_log.h"
 #include "options/st_options.h"
+#include "promise/st_promise.h"
 #include "websocket/st_websocket.h"
 #include "red_json.h"
 #include "red_string.h"
 #include <sddl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
-static CanopyResultEnum _send_payload(
-        CanopyContext ctx, 
-        STOptions options, 
+// Maximum number of syncs that can be queued for the sync worker at once.
+#define _MAX_QUEUED_JOBS 4
+
+// How long to keep the WebSocket serviced after sending a payload, to pick up
+// the server's reply.  Bounded by the sync's deadline.
+#define _RECV_WINDOW_MS 100
+
+// Longest single st_websocket_service call, so that deadlines and new jobs
+// are noticed promptly.
+#define _SERVICE_SLICE_MS 50
+
+// State of the connection to the cloud server, as far as syncing is
+// concerned.  Only the sync worker touches it.
+typedef enum
+{
+    // The WebSocket hasn't been told to connect yet.  The next sync starts
+    // connecting.
+    _CONN_DISCONNECTED,
+
+    // Waiting for the WebSocket to open.  Once started, the WebSocket
+    // reconnects by itself (with backoff) whenever the connection is lost.
+    _CONN_CONNECTING,
+
+    // WebSocket is open; the handshake needs to be queued.
+    _CONN_HANDSHAKING,
+
+    // Handshake queued on the current connection; payloads can be queued
+    // behind it.
+    _CONN_CONNECTED
+} _ConnStateEnum;
+
+// A sync request, handed from the calling thread to the sync worker.  The
+// payload is a snapshot of the dirty cloud variables, already encoded, so the
+// worker never touches the cloud variables themselves.
+typedef struct _SyncJob_t
+{
+    // Encoded payload, or 0 bytes if nothing was dirty.  <frame> is the
+    // encoder's whole buffer, taken over when the snapshot was encoded: the
+    // payload starts at st_websocket_pre_padding() and is followed by
+    // st_websocket_post_padding() spare bytes, so that the WebSocket can
+    // frame it in place.  Buffers circulate between the encoders, the jobs
+    // and the WebSocket send queue, so payloads are never copied on their
+    // way out and steady-state syncs don't allocate.  JSON payloads are
+    // NUL-terminated.
+    char *frame;
+    size_t capacity;
+    size_t len;
+    CanopyEncodingEnum encoding;
+
+    // Completed when the job is done, if non-NULL.  Set to NULL when the
+    // promise is handed off to the HTTP client, which completes it once the
+    // server responds.
+    CanopyPromise promise;
+
+    // CLOCK_MONOTONIC time, in microseconds, by which the job must be done.
+    uint64_t deadline_us;
+} _SyncJob_t;
+
+// A payload received by the sync worker, waiting to be applied on the
+// calling thread.  A NULL <payload> marks the start of a new WebSocket
+// connection.
+typedef struct _InboundMsg_t
+{
+    char *payload;
+    size_t len;
+    struct _InboundMsg_t *next;
+} _InboundMsg_t;
+
+struct STSync_t
+{
+    CanopyContext ctx;
+    STOptions options;
+    STWebSocket ws;
+    STCloudVarSystem cloudvars;
+
+    // Reusable buffer for JSON payloads (HTTP, and WebSocket payloads until a
+    // binary encoding has been negotiated).  Calling thread only.
+    STEncoder json_encoder;
+
+    // Reusable buffer for WebSocket payloads in the encoding the server
+    // accepted during the handshake, or NULL if JSON is in use.  Calling
+    // thread only.
+    STEncoder ws_encoder;
+
+    // Reusable buffer for the WebSocket handshake.  Sync worker only.
+    STEncoder handshake_encoder;
+
+    // Sync worker only.
+    _ConnStateEnum conn_state;
+
+    // st_websocket_num_connections when the handshake was queued, to notice
+    // the WebSocket reconnecting.  Sync worker only.
+    uint32_t ws_connection;
+
+    // HTTP connection to the cloud server, kept open between syncs, and the
+    // requests queued on it.  Sync worker only.
+    STHttpClient http;
+
+    // Everything below is protected by <lock>.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool thread_started;
+    bool quit;
+
+    // Ring of queued jobs.  The worker owns jobs[job_head] while it runs it.
+    _SyncJob_t jobs[_MAX_QUEUED_JOBS];
+    uint32_t job_head;
+    uint32_t num_jobs;
+
+    // Inbound payloads, oldest first.
+    _InboundMsg_t *inbound_head;
+    _InboundMsg_t *inbound_tail;
+
+    // Encoding the current WebSocket connection has agreed to.
+    CanopyEncodingEnum ws_encoding;
+
+    // A sync failed after its snapshot was taken, so the server may be
+    // missing updates.  Everything gets resent next time.
+    bool resync;
+
+    // The WebSocket send queue is full.  Under the COALESCE policy, syncs
+    // leave changes dirty (to be merged into one later payload) instead of
+    // queueing more snapshots.
+    bool ws_backpressured;
+
+    // The reactor reported activity on the WebSocket that the idle worker
+    // hasn't looked at yet.
+    bool ws_activity;
+};
+
+// A queued HTTP request failed, after its job was done.  The server may be
+// missing updates.  Runs on the sync worker.
+static void _handle_http_failure(STHttpClient client, CanopyResultEnum result, void *userdata)
+{
+    STSync sync = (STSync)userdata;
+    st_log_warn("Sync failed (%d)", result);
+    pthread_mutex_lock(&sync->lock);
+    sync->resync = true;
+    pthread_mutex_unlock(&sync->lock);
+}
+
+// Get the start of <job>'s payload.
+static char * _job_payload(_SyncJob_t *job)
+{
+    return &job->frame[st_websocket_pre_padding()];
+}
+
+// Create an encoder whose buffers can be handed to the WebSocket as is.
+static STEncoder _new_payload_encoder(CanopyEncodingEnum encoding)
+{
+    STEncoder encoder = st_encoder_new(encoding);
+    if (encoder)
+    {
+        st_encoder_set_padding(encoder,
+                st_websocket_pre_padding(),
+                st_websocket_post_padding());
+    }
+    return encoder;
+}
+
+STSync st_sync_new(
+        CanopyContext ctx,
+        STOptions options,
         STWebSocket ws,
-        const char *payload)
+        STCloudVarSystem cloudvars)
+{
+    STSync sync;
+    sync = calloc(1, sizeof(struct STSync_t));
+    if (!sync)
+    {
+        return NULL;
+    }
+    sync->ctx = ctx;
+    sync->options = options;
+    sync->ws = ws;
+    sync->cloudvars = cloudvars;
+    sync->json_encoder = _new_payload_encoder(CANOPY_ENCODING_JSON);
+    sync->handshake_encoder = st_encoder_new(CANOPY_ENCODING_JSON);
+    sync->http = st_http_client_new();
+    if (!sync->json_encoder || !sync->handshake_encoder || !sync->http)
+    {
+        st_encoder_free(sync->json_encoder);
+        st_encoder_free(sync->handshake_encoder);
+        st_http_client_free(sync->http);
+        free(sync);
+        return NULL;
+    }
+    st_http_client_on_failure(sync->http, _handle_http_failure, sync);
+    pthread_mutex_init(&sync->lock, NULL);
+    pthread_cond_init(&sync->cond, NULL);
+    return sync;
+}
+
+void st_sync_free(STSync sync)
+{
+    uint32_t i;
+    _InboundMsg_t *msg, *next;
+
+    if (!sync)
+    {
+        return;
+    }
+
+    // Stop the worker.  It finishes the job it is running (if any); queued
+    // jobs are abandoned.
+    pthread_mutex_lock(&sync->lock);
+    sync->quit = true;
+    pthread_cond_signal(&sync->cond);
+    pthread_mutex_unlock(&sync->lock);
+    if (sync->thread_started)
+    {
+        pthread_join(sync->thread, NULL);
+    }
+
+    // A reactor keeps calling back while it closes the WebSocket, which can
+    // outlive us.
+    if (sync->ws)
+    {
+        st_websocket_recv_callback(sync->ws, NULL, NULL);
+        st_websocket_activity_callback(sync->ws, NULL, NULL);
+    }
+
+    for (i = 0; i < sync->num_jobs; i++)
+    {
+        _SyncJob_t *job = &sync->jobs[(sync->job_head + i) % _MAX_QUEUED_JOBS];
+        if (job->promise)
+        {
+            st_promise_complete(job->promise, CANOPY_ERROR_CONNECTION_FAILED);
+        }
+    }
+    for (i = 0; i < _MAX_QUEUED_JOBS; i++)
+    {
+        free(sync->jobs[i].frame);
+    }
+    for (msg = sync->inbound_head; msg; msg = next)
+    {
+        next = msg->next;
+        free(msg->payload);
+        free(msg);
+    }
+
+    pthread_cond_destroy(&sync->cond);
+    pthread_mutex_destroy(&sync->lock);
+    st_encoder_free(sync->json_encoder);
+    st_encoder_free(sync->ws_encoder);
+    st_encoder_free(sync->handshake_encoder);
+    st_http_client_free(sync->http);
+    free(sync);
+}
+
+// Encoder to use for outbound payloads over the configured send protocol.
+static STEncoder _payload_encoder(STSync sync)
+{
+    if (sync->options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WS &&
+            sync->ws_encoder)
+    {
+        return sync->ws_encoder;
+    }
+    return sync->json_encoder;
+}
+
+static uint64_t _now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*CANOPY_SECONDS + (t.tv_nsec/1000);
+}
+
+// Deadline of a sync that may wait forever (a negative timeout).
+#define _NO_DEADLINE UINT64_MAX
+
+// Milliseconds left until <deadline_us>, or 0 if it has passed.  Saturates
+// at UINT32_MAX, which is also what _NO_DEADLINE gives.
+static uint32_t _remaining_ms(uint64_t deadline_us)
 {
+    uint64_t now;
+    uint64_t remaining;
+    if (deadline_us == _NO_DEADLINE)
+    {
+        return UINT32_MAX;
+    }
+    now = _now_us();
+    if (now >= deadline_us)
+    {
+        return 0;
+    }
+    remaining = (deadline_us - now + 999) / 1000;
+    return remaining > UINT32_MAX ? UINT32_MAX : (uint32_t)remaining;
+}
+
+// Service the WebSocket for at most <max_ms>, without going past
+// <deadline_us>.  Returns false if the deadline has passed.
+static bool _service_before(STSync sync, uint64_t deadline_us, uint32_t max_ms)
+{
+    uint32_t remaining = _remaining_ms(deadline_us);
+    if (remaining == 0)
+    {
+        return false;
+    }
+    st_websocket_service(sync->ws, remaining < max_ms ? remaining : max_ms);
+    return true;
+}
+
+// Publish the state of the WebSocket send queue to the calling thread.  Any
+// queued payloads that were dropped call for a resync.  Called by the sync
+// worker without <lock> held, since the WebSocket's own lock must be taken
+// first (its receive callback queues inbound messages under <lock>).
+static void _check_ws_queue(STSync sync)
+{
+    bool backpressured = st_websocket_is_backpressured(sync->ws);
+    bool dropped = (st_websocket_take_dropped(sync->ws) > 0);
+
+    pthread_mutex_lock(&sync->lock);
+    sync->ws_backpressured = backpressured;
+    if (dropped)
+    {
+        sync->resync = true;
+    }
+    pthread_mutex_unlock(&sync->lock);
+}
+
+// Send a job's payload to the cloud server.  Runs on the sync worker.
+static CanopyResultEnum _send_payload(STSync sync, _SyncJob_t *job)
+{
+    STOptions options = sync->options;
+    bool isJson = (job->encoding == CANOPY_ENCODING_JSON);
+
     // Send payload to cloud
     if (!st_option_is_set(options, CANOPY_VAR_SEND_PROTOCOL))
     {
@@ -43,6 +370,7 @@ static CanopyResultEnum _send_payload(
     {
         // Push: HTTP implementation
         char *url;
+        assert(isJson);
         url = RedString_PrintfToNewChars("http://%s/di/device/%s", 
                 options->val_CANOPY_CLOUD_SERVER,
                 options->val_CANOPY_DEVICE_UUID);
@@ -51,25 +379,72 @@ static CanopyResultEnum _send_payload(
             return CANOPY_ERROR_OUT_OF_MEMORY;
         }
 
-        CanopyPromise promise;
-        st_http_post(ctx, url, payload, &promise);
+        CanopyResultEnum result;
+        uint32_t remaining = _remaining_ms(job->deadline_us);
+        if (remaining == 0)
+        {
+            free(url);
+            return CANOPY_ERROR_TIMED_OUT;
+        }
+        if (job->deadline_us == _NO_DEADLINE)
+        {
+            // No timeout at all, rather than a very long one.
+            remaining = 0;
+        }
+
+        // Queue the request and move on.  The HTTP client completes the
+        // job's promise when the server responds, so a slow response doesn't
+        // hold up the next sync.
+        result = st_http_post(sync->http, url, _job_payload(job), job->len, remaining, job->promise);
         free(url);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
+        job->promise = NULL;
+        st_http_client_poll(sync->http, 0);
     }
     else if (options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WS)
     {
+        bool stale;
+        CanopyResultEnum result;
+
         // Push: WS implementation
-        if (!(st_websocket_is_connected(ws) && st_websocket_is_write_ready(ws)))
+        if (sync->conn_state != _CONN_CONNECTED)
+        {
+            return CANOPY_ERROR_CONNECTION_FAILED;
+        }
+
+        // A binary payload encoded for a previous connection can't be sent
+        // until the new connection has agreed to the encoding again.
+        pthread_mutex_lock(&sync->lock);
+        stale = (job->encoding != sync->ws_encoding && !isJson);
+        pthread_mutex_unlock(&sync->lock);
+        if (stale)
         {
             return CANOPY_ERROR_CONNECTION_FAILED;
         }
+
+        // Queue the payload, handing the job's buffer to the send queue.  It
+        // goes out as the socket drains; servicing the WebSocket takes care
+        // of that.
         // TODO: need a different payload for WS as for HTTP?
-        st_websocket_write(ws, payload);
+        result = st_websocket_write_buffer(sync->ws,
+                &job->frame,
+                &job->capacity,
+                job->len,
+                !isJson);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
     }
     else if (options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_NOOP)
     {
         // Push: NOOP implementation
         // Just log the payload
-        printf("NOOP PUSH:\n%s\n", payload);
+        assert(isJson);
+        printf("NOOP PUSH:\n%s\n", _job_payload(job));
     }
     else {
         return CANOPY_ERROR_PROTOCOL_NOT_SUPPORTED;
@@ -77,133 +452,334 @@ static CanopyResultEnum _send_payload(
     return CANOPY_SUCCESS;
 }
 
-static CanopyResultEnum _process_payload(STCloudVarSystem sys, const char *payload)
+// Handle the server's choice of wire encoding, in reply to the encodings
+// offered in the handshake.
+static CanopyResultEnum _accept_encoding(STSync sync, const char *name)
 {
-    st_log_debug("Processing payload %s", payload); // TODO: Only log if payload logging enabled
-    fprintf(stderr, "_process_payload'%s'\n", payload);
+    CanopyEncodingEnum encoding;
+    if (!st_codec_encoding_from_name(name, &encoding))
+    {
+        st_log_warn("Server chose unknown payload encoding \"%s\"; using JSON", name);
+        return CANOPY_SUCCESS;
+    }
 
-    RedJsonObject json = RedJson_Parse(payload);
-    if (!json)
+    st_encoder_free(sync->ws_encoder);
+    sync->ws_encoder = NULL;
+    if (encoding != CANOPY_ENCODING_JSON)
     {
-        return CANOPY_ERROR_PARSING_PAYLOAD;
+        sync->ws_encoder = _new_payload_encoder(encoding);
+        if (!sync->ws_encoder)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
     }
 
-    if (RedJsonObject_HasKey(json, "vars"))
+    pthread_mutex_lock(&sync->lock);
+    sync->ws_encoding = encoding;
+    pthread_mutex_unlock(&sync->lock);
+    return CANOPY_SUCCESS;
+}
+
+// Apply an inbound payload.  The payload is parsed in place (and so is
+// modified): each entry of "vars" is read in a single pass and stored directly
+// into the matching cloud variable.  Payloads may be JSON or, once
+// negotiated, a binary encoding; which one is detected from the first byte.
+static CanopyResultEnum _process_payload(STSync sync, char *payload, size_t len)
+{
+    STDecoder_t decoder;
+    STTokenEnum token;
+    CanopyResultEnum result;
+    CanopyEncodingEnum encoding;
+
+    encoding = st_codec_detect_encoding(payload, len);
+    if (encoding == CANOPY_ENCODING_JSON)
     {
-        unsigned numVars, i;
-        RedJsonObject varsJson;
-        char ** varnames;
-        CanopyResultEnum result;
+        st_log_debug("Processing payload %.*s", (int)len, payload); // TODO: Only log if payload logging enabled
+    }
+    else
+    {
+        st_log_debug("Processing %s payload (%d bytes)", 
+                st_codec_encoding_name(encoding), (int)len);
+    }
 
-        if (!RedJsonObject_IsValueObject(json, "vars"))
+    result = st_decoder_init(&decoder, encoding, payload, len);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    if (st_decoder_next(&decoder) != ST_TOKEN_BEGIN_OBJECT)
+    {
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    }
+
+    while ((token = st_decoder_next(&decoder)) == ST_TOKEN_KEY)
+    {
+        if (!strcmp(st_decoder_string(&decoder), "encoding"))
         {
-            st_log_error("Inbound payload error: Expected \"vars\" to be JSON object\n");
-            return CANOPY_ERROR_PROCESSING_PAYLOAD;
+            if (st_decoder_next(&decoder) != ST_TOKEN_STRING)
+            {
+                return CANOPY_ERROR_PROCESSING_PAYLOAD;
+            }
+            result = _accept_encoding(sync, st_decoder_string(&decoder));
+            if (result != CANOPY_SUCCESS)
+            {
+                return result;
+            }
+            continue;
+        }
+        if (strcmp(st_decoder_string(&decoder), "vars"))
+        {
+            result = st_decoder_skip_value(&decoder);
+            if (result != CANOPY_SUCCESS)
+            {
+                return result;
+            }
+            continue;
         }
 
-        varsJson = RedJsonObject_GetObject(json, "vars");
-
-        numVars = RedJsonObject_NumItems(varsJson);
-        varnames = RedJsonObject_NewKeysArray(varsJson);
-        if (!varnames)
+        if (st_decoder_next(&decoder) != ST_TOKEN_BEGIN_OBJECT)
         {
-            return CANOPY_ERROR_OUT_OF_MEMORY;
+            st_log_error("Inbound payload error: Expected \"vars\" to be an object\n");
+            return CANOPY_ERROR_PROCESSING_PAYLOAD;
         }
-        for (i = 0 ; i < numVars; i++)
+
+        while ((token = st_decoder_next(&decoder)) == ST_TOKEN_KEY)
         {
             STCloudVar cloudvar;
-            RedJsonValue json;
-            cloudvar = st_cloudvar_system_lookup_var(sys, varnames[i]);
+            cloudvar = st_cloudvar_system_lookup_var(sync->cloudvars, st_decoder_string(&decoder));
             if (!cloudvar)
             {
                 // TODO: is this an error?
-                continue;
+                result = st_decoder_skip_value(&decoder);
+            }
+            else
+            {
+                st_cloudvar_lock(cloudvar);
+                result = st_cloudvar_decode(cloudvar, &decoder);
+                st_cloudvar_unlock(cloudvar);
             }
-            json = RedJsonObject_Get(varsJson, varnames[i]);
-            result = st_cloudvar_update_from_json(cloudvar, json);
             if (result != CANOPY_SUCCESS)
             {
                 return result;
             }
         }
-        RedJsonObject_FreeKeysArray(varnames);
+        if (token != ST_TOKEN_END_OBJECT)
+        {
+            return CANOPY_ERROR_PARSING_PAYLOAD;
+        }
     }
 
+    if (token != ST_TOKEN_END_OBJECT)
+    {
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    }
     return CANOPY_SUCCESS;
 }
 
-static void _handle_ws_recv(STWebSocket ws, const char *payload, void *userdata)
+// Add a message to the inbound queue.  A NULL <payload> marks a new
+// connection.  Runs on the sync worker.
+static void _queue_inbound(STSync sync, const char *payload, size_t len)
+{
+    _InboundMsg_t *msg;
+
+    msg = calloc(1, sizeof(_InboundMsg_t));
+    if (!msg)
+    {
+        st_log_error("Dropping inbound payload: out of memory");
+        return;
+    }
+    if (payload)
+    {
+        // The payload lives in the WebSocket's receive buffer, which is
+        // reused once this callback returns.
+        msg->payload = malloc(len + 1);
+        if (!msg->payload)
+        {
+            st_log_error("Dropping inbound payload: out of memory");
+            free(msg);
+            return;
+        }
+        memcpy(msg->payload, payload, len);
+        msg->payload[len] = '\0';
+        msg->len = len;
+    }
+
+    pthread_mutex_lock(&sync->lock);
+    if (sync->inbound_tail)
+        sync->inbound_tail->next = msg;
+    else
+        sync->inbound_head = msg;
+    sync->inbound_tail = msg;
+    pthread_mutex_unlock(&sync->lock);
+}
+
+// Received payloads touch cloud variables, which belong to the calling
+// thread, so the worker only queues them.  They are applied by
+// st_sync_process_inbound.
+static void _handle_ws_recv(STWebSocket ws, char *payload, size_t len, void *userdata)
 {
-    fprintf(stderr, "_handle_ws_recv '%s'\n", payload);
-    _process_payload((STCloudVarSystem)userdata, payload);
+    _queue_inbound((STSync)userdata, payload, len);
 }
 
-static char * _gen_handshake_payload(const char *uuid)
+// When a reactor services the WebSocket, the idle worker sleeps until the
+// reactor thread reports activity through this callback.
+static void _handle_ws_activity(STWebSocket ws, void *userdata)
 {
-    return RedString_PrintfToNewChars("{\"device_id\" : \"%s\" }", uuid);
+    STSync sync = (STSync)userdata;
+    pthread_mutex_lock(&sync->lock);
+    sync->ws_activity = true;
+    pthread_cond_signal(&sync->cond);
+    pthread_mutex_unlock(&sync->lock);
 }
 
-static char * _gen_outbound_payload(STCloudVarSystem cloudvars)
+// Generate the WebSocket handshake payload.  Besides identifying the device,
+// it offers the server our payload encodings, most preferred first.  A
+// server that understands the offer replies with {"encoding" : <name>}; one
+// that doesn't ignores it, and JSON stays in use.
+static CanopyResultEnum _gen_handshake_payload(STSync sync)
 {
-    uint32_t i, num_dirty;
-    // construct payload:
-    RedJsonObject json = RedJsonObject_New();
-    RedJsonObject json_vars = RedJsonObject_New();
-    RedJsonObject json_sddl = RedJsonObject_New();
-    num_dirty = st_cloudvar_system_num_dirty(cloudvars);
+    STEncoder encoder = sync->handshake_encoder;
+    CanopyEncodingEnum preferred = sync->options->val_CANOPY_PAYLOAD_ENCODING;
 
-    if (num_dirty > 0)
+    st_encoder_reset(encoder);
+    st_encoder_begin_object(encoder);
+    st_encoder_key(encoder, "device_id");
+    st_encoder_string(encoder, sync->options->val_CANOPY_DEVICE_UUID);
+    st_encoder_key(encoder, "encodings");
+    st_encoder_begin_array(encoder);
+    if (preferred != CANOPY_ENCODING_JSON && st_codec_encoding_name(preferred))
     {
-        RedJsonObject_SetObject(json, "vars", json_vars);
-        RedJsonObject_SetObject(json, "sddl", json_sddl);
+        st_encoder_string(encoder, st_codec_encoding_name(preferred));
+    }
+    st_encoder_string(encoder, st_codec_encoding_name(CANOPY_ENCODING_JSON));
+    st_encoder_end_array(encoder);
+    st_encoder_end_object(encoder);
+    return st_encoder_result(encoder);
+}
+
+// Serialize the cloud variables taken by st_cloudvar_system_take_dirty into
+// <encoder>.  The payload is written straight into the encoder's buffer,
+// which is reused from one sync to the next.  Each variable is locked only
+// while it is being encoded, so other threads can keep setting variables
+// throughout.  A variable's dirty flags are cleared as soon as it has been
+// encoded; if this fails, the caller must restore the taken variables.
+static CanopyResultEnum _gen_outbound_payload(STEncoder encoder, STCloudVarSystem cloudvars)
+{
+    uint32_t i;
+    STCloudVar var;
+    bool anySddl = false;
+
+    st_encoder_reset(encoder);
+    st_encoder_begin_object(encoder);
 
+    if (st_cloudvar_system_taken_var(cloudvars, 0))
+    {
         // For each dirty cloud variable, add to the payload "vars" object:
-        // TODO: race condition?
-        for (i = 0; i < num_dirty; i++)
+        st_encoder_key(encoder, "vars");
+        st_encoder_begin_object(encoder);
+        ST_CLOUDVAR_SYSTEM_FOREACH_TAKEN(cloudvars, i, var)
         {
-            STCloudVar var = st_cloudvar_system_dirty_var(cloudvars, i);
+            CanopyResultEnum result = CANOPY_SUCCESS;
+
+            st_cloudvar_lock(var);
 
-            // If the variable's configuration hasn't been sent yet, or is
-            // dirty, send it
+            // The server has no value for a variable whose configuration
+            // hasn't been sent yet, so send all of it rather than the
+            // elements/members touched since the last sync.
             if (st_cloudvar_is_sddl_dirty(var))
             {
-                //
-                // "sddl" : {
-                //     "uint16 var_u16" : {}
-                // }
-                const char * decl = st_cloudvar_decl_string(var);
-                RedJsonObject properties = st_cloudvar_definition_json(var);
-                RedJsonObject_SetObject(json_sddl, decl, properties);
-                // TODO: set other configuration settings
-
-                // TODO: Only actually mark as configured after the server responds.
-                st_cloudvar_clear_sddl_dirty_flag(var);
+                st_cloudvar_mark_subtree_dirty(var);
+                anySddl = true;
             }
 
             // TODO:
             //   - timestamp for better synchronization?
-            if (st_cloudvar_has_value(var))
+            if (st_cloudvar_has_value(var) && st_cloudvar_is_value_dirty(var))
             {
-                RedJsonValue val;
-                CanopyResultEnum result;
-                result = st_cloudvar_value_to_json(&val, var);
-                if (result != CANOPY_SUCCESS)
+                st_encoder_key(encoder, st_cloudvar_name(var));
+                result = st_cloudvar_encode(encoder, var);
+            }
+
+            // The snapshot now owns these changes.  If sending it fails, the
+            // worker asks for a full resync.
+            st_cloudvar_clear_value_dirty(var);
+            st_cloudvar_unlock(var);
+            if (result != CANOPY_SUCCESS)
+            {
+                return result;
+            }
+        }
+        st_encoder_end_object(encoder);
+
+        // If a variable's configuration hasn't been sent yet, or is dirty,
+        // send it:
+        //
+        // "sddl" : {
+        //     "uint16 var_u16" : {}
+        // }
+        //
+        // Declarations never change after initialization, so this doesn't
+        // need the variables' locks.  The SDDL dirty flags are only touched
+        // by the thread calling canopy_sync.
+        st_encoder_key(encoder, "sddl");
+        st_encoder_begin_object(encoder);
+        if (anySddl)
+        {
+            ST_CLOUDVAR_SYSTEM_FOREACH_TAKEN(cloudvars, i, var)
+            {
+                RedJsonObject properties;
+                char *propertiesJson;
+                if (!st_cloudvar_is_sddl_dirty(var))
+                {
+                    continue;
+                }
+
+                // The SDDL definition is only sent once per variable, so it
+                // still goes through libsddl's JSON objects (and is
+                // transcoded for binary encodings).
+                properties = st_cloudvar_definition_json(var);
+                if (!properties)
+                {
+                    return CANOPY_ERROR_OUT_OF_MEMORY;
+                }
+                propertiesJson = RedJsonObject_ToJsonString(properties);
+                if (!propertiesJson)
                 {
-                    return NULL;
+                    return CANOPY_ERROR_OUT_OF_MEMORY;
                 }
-                RedJsonObject_Set(
-                        json_vars, 
-                        st_cloudvar_name(var), 
-                        val);
+                st_encoder_key(encoder, st_cloudvar_decl_string(var));
+                st_encoder_json(encoder, propertiesJson);
+                free(propertiesJson);
+                // TODO: set other configuration settings
             }
         }
+        st_encoder_end_object(encoder);
+    }
+
+    st_encoder_end_object(encoder);
+    if (st_encoder_result(encoder) != CANOPY_SUCCESS)
+    {
+        return st_encoder_result(encoder);
     }
 
-    return RedJsonObject_ToJsonString(json);
+    // TODO: Only actually mark as configured after the server responds.
+    ST_CLOUDVAR_SYSTEM_FOREACH_TAKEN(cloudvars, i, var)
+    {
+        st_cloudvar_clear_sddl_dirty_flag(var);
+    }
+    return CANOPY_SUCCESS;
 }
 
-CanopyResultEnum st_sync(CanopyContext ctx, STOptions options, STWebSocket ws, STCloudVarSystem cloudvars)
+// Drive the connection state machine until it is CONNECTED, or until
+// <deadline_us>.  Each state either makes progress or services the WebSocket
+// for a bounded slice, so this never blocks past the deadline (apart from
+// the DNS lookup inside st_websocket_connect).  A connection that isn't
+// finished by the deadline is left where it is, and the next sync picks up
+// from there.  Runs on the sync worker.
+static CanopyResultEnum _ensure_connected(STSync sync, uint64_t deadline_us)
 {
+    STOptions options = sync->options;
+    STWebSocket ws = sync->ws;
     CanopyResultEnum result;
 
     if (!st_option_is_set(options, CANOPY_CLOUD_SERVER))
@@ -214,65 +790,348 @@ CanopyResultEnum st_sync(CanopyContext ctx, STOptions options, STWebSocket ws, S
     if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_NOOP)
     {
         // Noop Pull: 
+        return CANOPY_SUCCESS;
+    }
+    if (options->val_CANOPY_VAR_RECV_PROTOCOL != CANOPY_PROTOCOL_WS)
+    {
+        return CANOPY_ERROR_PROTOCOL_NOT_SUPPORTED;
     }
-    else if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WS)
+
+    // WS Pull:
+    // A connection can drop at any time.  The WebSocket reconnects by itself,
+    // and each new connection needs a handshake.
+    if (sync->conn_state == _CONN_HANDSHAKING || sync->conn_state == _CONN_CONNECTED)
     {
-        // WS Pull:
-        // Initiate websocket connection if necessary:
-        if (!st_websocket_is_connected(ws))
+        if (st_websocket_state(ws) != ST_WEBSOCKET_OPEN)
         {
-            CanopyResultEnum result;
-            result = st_websocket_connect(
-                    ws,
-                    options->val_CANOPY_CLOUD_SERVER,
-                    80, // TODO: don't hardcode
-                    false, // TODO: don't hardcode
-                    "/echo"); // TODO: rename
-            if (result != CANOPY_SUCCESS)
-                return result;
+            st_log_warn("WebSocket connection lost");
+            sync->conn_state = _CONN_CONNECTING;
+        }
+        else if (st_websocket_num_connections(ws) != sync->ws_connection)
+        {
+            sync->conn_state = _CONN_HANDSHAKING;
+        }
+    }
+
+    while (sync->conn_state != _CONN_CONNECTED)
+    {
+        switch (sync->conn_state)
+        {
+            case _CONN_DISCONNECTED:
+                result = st_websocket_set_queue_limits(
+                        ws,
+                        options->val_CANOPY_WS_QUEUE_HIGH_WATERMARK,
+                        options->val_CANOPY_WS_QUEUE_LOW_WATERMARK,
+                        options->val_CANOPY_WS_QUEUE_POLICY);
+                if (result != CANOPY_SUCCESS)
+                    return result;
+                result = st_websocket_set_rx_limits(
+                        ws,
+                        options->val_CANOPY_WS_RX_BUFFER_SIZE,
+                        options->val_CANOPY_WS_MAX_MESSAGE_SIZE);
+                if (result != CANOPY_SUCCESS)
+                    return result;
+                result = st_websocket_set_reconnect_backoff(
+                        ws,
+                        options->val_CANOPY_WS_RECONNECT_MIN_MS,
+                        options->val_CANOPY_WS_RECONNECT_MAX_MS);
+                if (result != CANOPY_SUCCESS)
+                    return result;
+                st_websocket_set_compression(ws, options->val_CANOPY_WS_COMPRESSION);
+                st_websocket_recv_callback(ws, _handle_ws_recv, sync);
+                st_websocket_activity_callback(ws, _handle_ws_activity, sync);
+                result = st_websocket_connect(
+                        ws,
+                        options->val_CANOPY_CLOUD_SERVER,
+                        80, // TODO: don't hardcode
+                        false, // TODO: don't hardcode
+                        "/echo"); // TODO: rename
+                if (result != CANOPY_SUCCESS)
+                    return result;
+                sync->conn_state = _CONN_CONNECTING;
+                break;
+
+            case _CONN_CONNECTING:
+                if (st_websocket_state(ws) == ST_WEBSOCKET_OPEN)
+                {
+                    sync->conn_state = _CONN_HANDSHAKING;
+                }
+                else if (!_service_before(sync, deadline_us, _SERVICE_SLICE_MS))
+                {
+                    // Still connecting, or waiting out the reconnect backoff.
+                    return (st_websocket_state(ws) == ST_WEBSOCKET_DISCONNECTED) ?
+                        CANOPY_ERROR_CONNECTION_FAILED : CANOPY_ERROR_TIMED_OUT;
+                }
+                break;
+
+            case _CONN_HANDSHAKING:
+                // The new connection starts out in JSON until the server
+                // accepts another encoding.  The marker tells the calling
+                // thread to stop encoding binary payloads.  Whatever the
+                // server had from an earlier connection may be out of date
+                // (or the server may be a different one), so everything gets
+                // resent.
+                pthread_mutex_lock(&sync->lock);
+                sync->ws_encoding = CANOPY_ENCODING_JSON;
+                sync->resync = true;
+                pthread_mutex_unlock(&sync->lock);
+                _queue_inbound(sync, NULL, 0);
+
+                result = _gen_handshake_payload(sync);
+                if (result != CANOPY_SUCCESS)
+                    return result;
+                // The send queue is empty on a new connection, and payloads
+                // queued from now on go out after the handshake.
+                // TODO: need a different payload for WS as for HTTP?
+                result = st_websocket_write(ws,
+                        st_encoder_bytes(sync->handshake_encoder),
+                        st_encoder_len(sync->handshake_encoder));
+                if (result == CANOPY_ERROR_CONNECTION_FAILED)
+                {
+                    sync->conn_state = _CONN_CONNECTING;
+                }
+                if (result != CANOPY_SUCCESS)
+                    return result;
+                sync->ws_connection = st_websocket_num_connections(ws);
+                sync->conn_state = _CONN_CONNECTED;
+                break;
+
+            default:
+                assert(!"Invalid connection state");
+                return CANOPY_ERROR_UNKNOWN;
+        }
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Perform the network I/O for one sync, within the job's deadline.  Runs on
+// the sync worker.
+static CanopyResultEnum _run_job(STSync sync, _SyncJob_t *job)
+{
+    CanopyResultEnum result;
+
+    result = _ensure_connected(sync, job->deadline_us);
+    if (result != CANOPY_SUCCESS)
+        return result;
+
+    if (job->len > 0)
+    {
+        result = _send_payload(sync, job);
+        if (result != CANOPY_SUCCESS)
+            return result;
+    }
+
+    if (sync->options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WS)
+    {
+        // Service websockets, to flush the write and pick up any reply.
+        // Running out of time here doesn't fail the sync: the payload has
+        // been handed off, and the worker keeps servicing the socket.
+        _service_before(sync, job->deadline_us, _RECV_WINDOW_MS);
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Sync worker thread.  Runs queued jobs one at a time.  While idle with an
+// open WebSocket, it keeps servicing the socket so that updates from the
+// server are received between syncs, or, if a reactor services it, handles
+// whatever the reactor reports as it happens.
+static void * _worker_main(void *arg)
+{
+    STSync sync = (STSync)arg;
+
+    pthread_mutex_lock(&sync->lock);
+    while (!sync->quit)
+    {
+        _SyncJob_t *job;
+        CanopyResultEnum result;
+
+        if (sync->num_jobs == 0)
+        {
+            bool httpPending = st_http_client_num_pending(sync->http) > 0;
+            bool wsOpen = (sync->conn_state != _CONN_DISCONNECTED);
+            bool wsPolled = wsOpen && !st_websocket_uses_reactor(sync->ws);
+            bool wsActive = wsPolled || (wsOpen && sync->ws_activity);
+            sync->ws_activity = false;
+            if (httpPending || wsActive)
+            {
+                pthread_mutex_unlock(&sync->lock);
+                if (httpPending)
+                {
+                    st_http_client_poll(sync->http, wsActive ? 0 : _SERVICE_SLICE_MS);
+                }
+                if (wsPolled)
+                {
+                    st_websocket_service(sync->ws, _SERVICE_SLICE_MS);
+                }
+                if (wsActive)
+                {
+                    // Queue the handshake as soon as a reconnect opens,
+                    // without waiting for the next sync.
+                    _ensure_connected(sync, 0);
+                }
+                _check_ws_queue(sync);
+                pthread_mutex_lock(&sync->lock);
+            }
+            else
+            {
+                // Nothing to poll.  With a reactor servicing the WebSocket,
+                // _handle_ws_activity wakes us when there is.
+                pthread_cond_wait(&sync->cond, &sync->lock);
+            }
+            continue;
+        }
 
-            // Service websocket for first time
-            st_websocket_recv_callback(ws, _handle_ws_recv, cloudvars);
-            st_websocket_service(ws, 1000);
-            st_websocket_service(ws, 1000);
+        // The job stays at the head of the ring (so its slot isn't reused)
+        // until it is done.
+        job = &sync->jobs[sync->job_head];
+        pthread_mutex_unlock(&sync->lock);
 
-            // send handhsake
-            char *handshakePayload;
-            handshakePayload = _gen_handshake_payload(options->val_CANOPY_DEVICE_UUID);
+        result = _run_job(sync, job);
+        if (result != CANOPY_SUCCESS)
+        {
+            st_log_warn("Sync failed (%d)", result);
+        }
+        _check_ws_queue(sync);
+
+        pthread_mutex_lock(&sync->lock);
+        if (result != CANOPY_SUCCESS && job->len > 0)
+        {
+            sync->resync = true;
+        }
+        if (job->promise)
+        {
+            st_promise_complete(job->promise, result);
+        }
+        job->promise = NULL;
+        sync->job_head = (sync->job_head + 1) % _MAX_QUEUED_JOBS;
+        sync->num_jobs--;
+    }
+    pthread_mutex_unlock(&sync->lock);
+    return NULL;
+}
 
-            while (!(st_websocket_is_connected(ws) && st_websocket_is_write_ready(ws)))
+// Move the encoded payload into <job>, by swapping buffers with the encoder.
+static void _job_set_payload(_SyncJob_t *job, STEncoder encoder)
+{
+    job->len = st_encoder_len(encoder);
+    job->encoding = st_encoder_encoding(encoder);
+    st_encoder_swap_buffer(encoder, &job->frame, &job->capacity);
+}
+
+CanopyResultEnum st_sync_process_inbound(STSync sync)
+{
+    _InboundMsg_t *msg, *next;
+    bool resync;
+    CanopyResultEnum result = CANOPY_SUCCESS;
+
+    // Take the whole queue at once, so that the worker can keep adding to it
+    // while we process.
+    pthread_mutex_lock(&sync->lock);
+    msg = sync->inbound_head;
+    sync->inbound_head = sync->inbound_tail = NULL;
+    resync = sync->resync;
+    sync->resync = false;
+    pthread_mutex_unlock(&sync->lock);
+
+    if (resync)
+    {
+        st_cloudvar_system_mark_all_dirty(sync->cloudvars);
+    }
+
+    for (; msg; msg = next)
+    {
+        next = msg->next;
+        if (!msg->payload)
+        {
+            // New connection: back to JSON until it is renegotiated.
+            st_encoder_free(sync->ws_encoder);
+            sync->ws_encoder = NULL;
+        }
+        else
+        {
+            CanopyResultEnum msgResult = _process_payload(sync, msg->payload, msg->len);
+            if (msgResult != CANOPY_SUCCESS)
             {
-                // TODO: give up eventually!
-                st_websocket_service(ws, 1000);
+                st_log_warn("Error processing inbound payload (%d)", msgResult);
+                result = msgResult;
             }
-            // TODO: need a different payload for WS as for HTTP?
-            st_websocket_write(ws, handshakePayload);
-            free(handshakePayload);
+            free(msg->payload);
+        }
+        free(msg);
+    }
+    return result;
+}
+
+CanopyResultEnum st_sync_start(STSync sync, CanopyPromise promise, int64_t timeout_us)
+{
+    CanopyResultEnum result;
+    STCloudVarSystem cloudvars = sync->cloudvars;
+    _SyncJob_t *job;
+    bool dirty;
+    bool coalesce;
+
+    // Apply whatever the server sent since the last sync before taking the
+    // snapshot.
+    st_sync_process_inbound(sync);
 
-            st_websocket_service(ws, 1000);
+    pthread_mutex_lock(&sync->lock);
+    if (!sync->thread_started)
+    {
+        if (pthread_create(&sync->thread, NULL, _worker_main, sync))
+        {
+            pthread_mutex_unlock(&sync->lock);
+            return CANOPY_ERROR_UNKNOWN;
         }
+        sync->thread_started = true;
     }
+    if (sync->num_jobs == _MAX_QUEUED_JOBS)
+    {
+        // The worker is falling behind.  Leave the changes dirty; they go out
+        // with a later sync.
+        pthread_mutex_unlock(&sync->lock);
+        return CANOPY_ERROR_SYNC_IN_PROGRESS;
+    }
+    // Slots outside [job_head, job_head + num_jobs) aren't touched by the
+    // worker, so the snapshot can be written without holding the lock.
+    job = &sync->jobs[(sync->job_head + sync->num_jobs) % _MAX_QUEUED_JOBS];
+    coalesce = sync->ws_backpressured &&
+        sync->options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WS &&
+        sync->options->val_CANOPY_WS_QUEUE_POLICY == CANOPY_QUEUE_POLICY_COALESCE;
+    pthread_mutex_unlock(&sync->lock);
 
     // Check if local copy of any Cloud Variables have changed since last sync.
-    if (st_cloudvar_system_is_dirty(cloudvars))
+    // While the WebSocket can't keep up, changes are left dirty so that they
+    // coalesce into a single payload once it has drained.  The job still
+    // runs, to keep the connection going.
+    job->len = 0;
+    dirty = !coalesce && st_cloudvar_system_is_dirty(cloudvars);
+    if (dirty)
     {
-        char *payload;
-        payload = _gen_outbound_payload(cloudvars);
-
-        result = _send_payload(ctx, options, ws, payload);
-        free(payload);
+        STEncoder encoder = _payload_encoder(sync);
+        st_cloudvar_system_take_dirty(cloudvars);
+        result = _gen_outbound_payload(encoder, cloudvars);
         if (result != CANOPY_SUCCESS)
+        {
+            st_cloudvar_system_restore_taken(cloudvars);
             return result;
+        }
 
-        st_cloudvar_system_clear_dirty(cloudvars);
+        _job_set_payload(job, encoder);
     }
-
-    if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WS)
+    // Only now that the sync is certain to be queued is the promise made
+    // pending again; on the failures above it is left as it was.
+    if (promise)
     {
-        // Service websockets
-        // TODO: don't hardcode timeout
-        st_websocket_service(ws, 1000);
+        st_promise_reset(promise);
     }
+    job->promise = promise;
+    // The budget starts now, so it includes time spent waiting in the queue.
+    job->deadline_us = (timeout_us < 0) ? _NO_DEADLINE : _now_us() + (uint64_t)timeout_us;
+
+    pthread_mutex_lock(&sync->lock);
+    sync->num_jobs++;
+    pthread_cond_signal(&sync->cond);
+    pthread_mutex_unlock(&sync->lock);
 
     return CANOPY_SUCCESS;
 }
@@ -18,7 +18,52 @@
 #define ST_SYNC_INCLUDED
 
 #include <canopy.h>
+#include "cloudvar/st_cloudvar.h"
+#include "options/st_options.h"
+#include "websocket/st_websocket.h"
 
-CanopyResultEnum st_sync();
+// An STSync object holds the state needed to synchronize a context's cloud
+// variables with the cloud server: the payload buffers (which are reused
+// between syncs), the wire encoding negotiated with the server, and the sync
+// worker thread.
+//
+// Threading: the cloud variables are only ever touched by the thread that
+// calls st_sync_start and st_sync_process_inbound (the application's
+// thread).  That thread encodes a snapshot of the dirty variables and queues
+// it; the worker, started on the first sync, does all the network I/O
+// (including all use of <ws>).  Payloads the worker receives are queued and
+// applied by the next st_sync_process_inbound.
+typedef struct STSync_t * STSync;
+
+// Create a new STSync object.  It keeps references to (but does not own)
+// <options>, <ws> and <cloudvars>.  <options> must not be changed while a
+// sync is in progress.
+STSync st_sync_new(
+        CanopyContext ctx,
+        STOptions options,
+        STWebSocket ws,
+        STCloudVarSystem cloudvars);
+
+// Free STSync object, stopping its worker thread.  A sync the worker is
+// running is finished first; queued syncs are abandoned, and their promises
+// complete with CANOPY_ERROR_CONNECTION_FAILED.
+void st_sync_free(STSync sync);
+
+// Start synchronizing cloud variables with the cloud server.  Applies any
+// received updates, snapshots the dirty cloud variables, and queues the
+// snapshot for the worker.  <promise>, if non-NULL, is reset and then
+// completed when the worker is done.
+//
+// The worker has <timeout_us> microseconds (or forever, if negative) from
+// now to connect, handshake and send the snapshot; otherwise the promise
+// completes with CANOPY_ERROR_TIMED_OUT.
+//
+// Returns CANOPY_ERROR_SYNC_IN_PROGRESS if too many syncs are queued
+// already.  On any failure, the dirty cloud variables and <promise> are left
+// untouched.
+CanopyResultEnum st_sync_start(STSync sync, CanopyPromise promise, int64_t timeout_us);
+
+// Apply the updates received from the server since the last call.
+CanopyResultEnum st_sync_process_inbound(STSync sync);
 
 #endif // ST_SYNC_INCLUDED
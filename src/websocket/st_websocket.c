@@ -15,33 +15,470 @@
 // WebSocket utility library for Canopy
 
 #include "websocket/st_websocket.h"
+#include "websocket/st_websocket_lws.h"
+#include "reactor/st_reactor.h"
 #include "red_log.h"
 #include "log/st_log.h"
 #include <libwebsockets.h>
+#include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+// An outbound message waiting in the send queue.  Buffers belong to their
+// slot and are kept for reuse, so a steady stream of messages doesn't
+// allocate.
+typedef struct _STWebSocketFrame_t
+{
+    // libwebsockets needs LWS_SEND_BUFFER_PRE_PADDING bytes before the
+    // message and LWS_SEND_BUFFER_POST_PADDING after it.
+    unsigned char *buf;
+    size_t capacity;
+    size_t len;
+    enum libwebsocket_write_protocol protocol;
+} _STWebSocketFrame_t;
+
+// An STWebSocket is used from two threads: the thread that owns it (the
+// sync worker) and the thread running libwebsockets callbacks, which is the
+// same thread unless the WebSocket is attached to a reactor.  All fields are
+// protected by <lock>, which is recursive because libwebsockets can call
+// back into us from inside libwebsocket_write.  The lock is never held while
+// calling libwebsocket_service, and lock order is: STWebSocket, then
+// anything taken by the receive callback.
 struct STWebSocket_t
 {
+    pthread_mutex_t lock;
+
+    // Signalled on every callback, for st_websocket_service to wait on when
+    // the WebSocket is serviced by a reactor.  <cb_activity> is called as
+    // well.
+    pthread_cond_t cond;
+    uint32_t activity;
+    STWebsocketActivityCallback cb_activity;
+    void *cb_activity_userdata;
+
+    // Context of the current connection.  Owned by the WebSocket, unless it
+    // is the reactor's.
     struct libwebsocket_context *ws_ctx;
     struct libwebsocket *ws;
+    STWebSocketStateEnum state;
     bool ws_write_ready;
     STWebsocketRecvCallback cb_recv;
     void *cb_recv_userdata;
+
+    // Shared event loop servicing this WebSocket, or NULL if it has its own
+    // libwebsockets context.
+    CanopyReactor reactor;
+
+    // Number of st_reactor_post calls that the reactor hasn't processed yet.
+    // The WebSocket can't be freed until they have been.
+    uint32_t num_posts;
+
+    // st_websocket_free has been called, but the reactor still has to close
+    // the connection (<closing>) before freeing the WebSocket.
+    bool freed;
+    bool closing;
+
+    // libwebsockets keeps a pointer to the protocol table, and reads the
+    // receive buffer size from it, so it lives as long as the context.
+    struct libwebsocket_protocols protocols[2];
+    size_t rx_buffer_size;
+
+    // Inbound message being reassembled from fragments.  Kept between
+    // messages so that receiving doesn't allocate once it has grown.
+    char *rx_buf;
+    size_t rx_len;
+    size_t rx_capacity;
+    size_t max_message_size;
+
+    // The message being received is too large and is being skipped.
+    bool rx_overflow;
+
+    // Where to (re)connect to.  NULL <hostname> until st_websocket_connect
+    // is called.
+    char *hostname;
+    char *url;
+    uint16_t port;
+    bool use_ssl;
+
+    // Reconnect backoff.  After the connection is lost, the next attempt
+    // waits a random time between 0 and reconnect_min_ms * 2^attempts
+    // (capped at reconnect_max_ms), so that devices that lost their
+    // connection at the same moment don't all come back at once.
+    uint32_t reconnect_min_ms;
+    uint32_t reconnect_max_ms;
+    uint32_t reconnect_attempts;
+    bool reconnect_pending;
+    uint64_t reconnect_at_us;
+    uint32_t random_state;
+
+    // Number of times the connection has opened.
+    uint32_t num_connections;
+
+    // Offer the deflate-frame extension on new connections.
+    bool compression;
+
+    // Ring of queued outbound messages, oldest at <queue_head>.  Its size is
+    // the high watermark.
+    _STWebSocketFrame_t *queue;
+    size_t queue_capacity;
+    size_t queue_head;
+    size_t queue_len;
+    size_t queue_low;
+    CanopyQueuePolicyEnum queue_policy;
+    bool backpressured;
+    uint32_t num_dropped;
+
+    // The oldest queued message is the first one queued on the current
+    // connection (for Canopy, the handshake), and hasn't been sent yet.
+    // DROP_OLDEST never discards it, since nothing else the server is sent
+    // makes sense without it.  Set whenever a new connection is started,
+    // before anything has been queued on it.
+    bool queue_head_pinned;
 };
 
+static void _free_queue(STWebSocket ws)
+{
+    size_t i;
+    for (i = 0; i < ws->queue_capacity; i++)
+    {
+        free(ws->queue[i].buf);
+    }
+    free(ws->queue);
+    ws->queue = NULL;
+    ws->queue_capacity = 0;
+    ws->queue_head = 0;
+    ws->queue_len = 0;
+    ws->backpressured = false;
+}
+
 STWebSocket st_websocket_new()
 {
-    return calloc(1, sizeof(struct STWebSocket_t));
+    STWebSocket ws;
+    pthread_mutexattr_t mutexAttr;
+    pthread_condattr_t condAttr;
+
+    ws = calloc(1, sizeof(struct STWebSocket_t));
+    if (!ws)
+    {
+        return NULL;
+    }
+    ws->rx_buffer_size = ST_WEBSOCKET_DEFAULT_RX_BUFFER_SIZE;
+    ws->max_message_size = ST_WEBSOCKET_DEFAULT_MAX_MESSAGE_SIZE;
+    ws->reconnect_min_ms = ST_WEBSOCKET_DEFAULT_RECONNECT_MIN_MS;
+    ws->reconnect_max_ms = ST_WEBSOCKET_DEFAULT_RECONNECT_MAX_MS;
+
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_settype(&mutexAttr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ws->lock, &mutexAttr);
+    pthread_mutexattr_destroy(&mutexAttr);
+
+    // Use the monotonic clock for timed waits, so that timeouts aren't
+    // affected by changes to the wall clock.
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ws->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    if (st_websocket_set_queue_limits(ws,
+                ST_WEBSOCKET_DEFAULT_QUEUE_HIGH,
+                ST_WEBSOCKET_DEFAULT_QUEUE_LOW,
+                CANOPY_QUEUE_POLICY_COALESCE) != CANOPY_SUCCESS)
+    {
+        pthread_cond_destroy(&ws->cond);
+        pthread_mutex_destroy(&ws->lock);
+        free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+// Release the WebSocket's memory.  Its connection must be gone.
+static void _destroy(STWebSocket ws)
+{
+    _free_queue(ws);
+    free(ws->rx_buf);
+    free(ws->hostname);
+    free(ws->url);
+    pthread_cond_destroy(&ws->cond);
+    pthread_mutex_destroy(&ws->lock);
+    free(ws);
+}
+
+// Ask the reactor to process <ws> (at <at_us>, or now if 0).  Called with
+// <lock> held.
+static void _post(STWebSocket ws, uint64_t at_us)
+{
+    assert(ws->reactor);
+    ws->num_posts++;
+    if (!st_reactor_post(ws->reactor, ws, at_us))
+    {
+        ws->num_posts--;
+    }
 }
 
 void st_websocket_free(STWebSocket ws)
 {
-    free(ws);
+    if (!ws)
+    {
+        return;
+    }
+
+    if (ws->reactor)
+    {
+        // The connection lives in the reactor's context, so only the reactor
+        // thread can close it.  It frees the WebSocket once it has.
+        pthread_mutex_lock(&ws->lock);
+        ws->freed = true;
+        ws->cb_recv = NULL;
+        ws->cb_activity = NULL;
+        _post(ws, 0);
+        pthread_mutex_unlock(&ws->lock);
+        return;
+    }
+
+    if (ws->ws_ctx)
+    {
+        libwebsocket_context_destroy(ws->ws_ctx);
+    }
+    _destroy(ws);
+}
+
+// Something happened; wake up st_websocket_service.
+static void _activity(STWebSocket ws)
+{
+    ws->activity++;
+    pthread_cond_broadcast(&ws->cond);
+    if (ws->reactor && ws->cb_activity)
+    {
+        ws->cb_activity(ws, ws->cb_activity_userdata);
+    }
+}
+
+// Remove the oldest message from the send queue.
+static void _pop_frame(STWebSocket ws)
+{
+    assert(ws->queue_len > 0);
+    ws->queue_head = (ws->queue_head + 1) % ws->queue_capacity;
+    ws->queue_len--;
+    ws->queue_head_pinned = false;
+    if (ws->queue_len <= ws->queue_low)
+    {
+        ws->backpressured = false;
+    }
+}
+
+static uint64_t _now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000 + (t.tv_nsec/1000);
+}
+
+// Get a pseudo-random number (xorshift32).  This only needs to spread out
+// reconnect attempts, so it is seeded from things that differ between
+// devices and between runs.
+static uint32_t _random(STWebSocket ws)
+{
+    uint32_t x = ws->random_state;
+    if (x == 0)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        x = (uint32_t)t.tv_nsec ^ (uint32_t)t.tv_sec ^
+            ((uint32_t)getpid() << 16) ^ (uint32_t)(uintptr_t)ws;
+        if (x == 0)
+        {
+            x = 1;
+        }
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ws->random_state = x;
+    return x;
+}
+
+// Pick when to try connecting again: "full jitter" exponential backoff.
+static void _schedule_reconnect(STWebSocket ws)
+{
+    uint64_t cap;
+    uint64_t delayMs;
+
+    if (!ws->hostname || ws->reconnect_pending || ws->freed)
+    {
+        return;
+    }
+
+    cap = ws->reconnect_min_ms;
+    if (ws->reconnect_attempts < 32)
+    {
+        cap <<= ws->reconnect_attempts;
+    }
+    else
+    {
+        cap = ws->reconnect_max_ms;
+    }
+    if (cap > ws->reconnect_max_ms)
+    {
+        cap = ws->reconnect_max_ms;
+    }
+    delayMs = cap ? _random(ws) % (cap + 1) : 0;
+
+    ws->reconnect_attempts++;
+    ws->reconnect_pending = true;
+    ws->reconnect_at_us = _now_us() + delayMs*1000;
+    st_log_info("WebSocket reconnecting in %d ms", (int)delayMs);
+
+    if (ws->reactor)
+    {
+        _post(ws, ws->reconnect_at_us);
+    }
+}
+
+// Forget the current connection.  Whatever was queued for it will never be
+// sent.
+static void _reset_connection(STWebSocket ws)
+{
+    ws->ws = NULL;
+    ws->state = ST_WEBSOCKET_DISCONNECTED;
+    ws->ws_write_ready = false;
+    ws->num_dropped += ws->queue_len;
+    ws->queue_len = 0;
+    ws->queue_head_pinned = false;
+    ws->backpressured = false;
+    ws->rx_len = 0;
+    ws->rx_overflow = false;
 }
 
-static int _ws_callback(
+// The connection is gone (failed or closed).  A new connection is attempted
+// after a backoff.
+static void _disconnected(STWebSocket ws)
+{
+    _reset_connection(ws);
+    ws->closing = false;
+    if (ws->freed)
+    {
+        // Let the reactor free the WebSocket, outside of this callback.
+        _post(ws, 0);
+        return;
+    }
+    _schedule_reconnect(ws);
+}
+
+// Add a piece of an inbound message to the reassembly buffer, and deliver the
+// message once the piece that completes it arrives.  A message can arrive in
+// several fragments, and libwebsockets hands over a fragment in several
+// pieces when it is larger than the receive buffer.
+static void _receive(STWebSocket ws, struct libwebsocket *wsi, const char *in, size_t len)
+{
+    bool complete = libwebsocket_is_final_fragment(wsi) &&
+        libwebsockets_remaining_packet_payload(wsi) == 0;
+
+    if (!ws->rx_overflow && ws->rx_len + len > ws->max_message_size)
+    {
+        st_log_warn("WebSocket message larger than %d bytes; discarding",
+                (int)ws->max_message_size);
+        ws->rx_overflow = true;
+    }
+
+    if (!ws->rx_overflow)
+    {
+        // One extra byte for a NUL terminator.
+        size_t needed = ws->rx_len + len + 1;
+        if (needed > ws->rx_capacity)
+        {
+            size_t newCapacity = ws->rx_capacity ? ws->rx_capacity : ws->rx_buffer_size;
+            char *newBuf;
+            while (newCapacity < needed)
+            {
+                newCapacity *= 2;
+            }
+            newBuf = realloc(ws->rx_buf, newCapacity);
+            if (!newBuf)
+            {
+                st_log_error("Out of memory receiving WebSocket message; discarding");
+                ws->rx_overflow = true;
+            }
+            else
+            {
+                ws->rx_buf = newBuf;
+                ws->rx_capacity = newCapacity;
+            }
+        }
+    }
+
+    if (!ws->rx_overflow)
+    {
+        memcpy(&ws->rx_buf[ws->rx_len], in, len);
+        ws->rx_len += len;
+    }
+
+    if (!complete)
+    {
+        return;
+    }
+
+    // The server answered, so the connection is really up: the next
+    // reconnect starts from the shortest backoff again.  A connection that
+    // opens but closes before the server says anything (say, a server that
+    // accepts and then drops every device during an outage) keeps backing
+    // off.
+    ws->reconnect_attempts = 0;
+
+    if (!ws->rx_overflow)
+    {
+        ws->rx_buf[ws->rx_len] = '\0';
+        st_log_debug("Websocket Recv: %d bytes\n", (int)ws->rx_len);
+        if (ws->cb_recv)
+        {
+            ws->cb_recv(ws, ws->rx_buf, ws->rx_len, ws->cb_recv_userdata);
+        }
+    }
+    ws->rx_len = 0;
+    ws->rx_overflow = false;
+}
+
+// Send the oldest queued message, if the connection can take it.  Writing
+// one message per writeable notification keeps libwebsockets from having to
+// buffer partial sends.  Must be called on the thread that services the
+// connection.
+static void _drain(STWebSocket ws)
+{
+    _STWebSocketFrame_t *frame;
+    int written;
+
+    if (!ws->ws_write_ready || !ws->ws || ws->queue_len == 0)
+    {
+        return;
+    }
+
+    frame = &ws->queue[ws->queue_head];
+    written = libwebsocket_write(ws->ws,
+            &frame->buf[LWS_SEND_BUFFER_PRE_PADDING],
+            frame->len,
+            frame->protocol);
+    ws->ws_write_ready = false;
+    if (written < 0)
+    {
+        // libwebsockets closes the connection; LWS_CALLBACK_CLOSED counts
+        // the rest of the queue as dropped.
+        st_log_warn("WebSocket write failed");
+        return;
+    }
+    _pop_frame(ws);
+
+    // Register callback so that we're informed when it is safe to write again.
+    if (ws->ws)
+    {
+        libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
+    }
+}
+
+int st_websocket_lws_callback(
         struct libwebsocket_context *this,
         struct libwebsocket *wsi,
         enum libwebsocket_callback_reasons reason,
@@ -49,12 +486,27 @@ static int _ws_callback(
         void *in,
         size_t len)
 {
-    STWebSocket ws = (STWebSocket)libwebsocket_context_user(this);
+    STWebSocket ws = (STWebSocket)user;
+    int result = 0;
+
+    if (!ws)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ws->lock);
     switch (reason)
     {
         case LWS_CALLBACK_CLIENT_ESTABLISHED:
         {
             fprintf(stderr, "ws_callback: LWS_CALLBACK_CLIENT_ESTABLISHED\n");
+            if (ws->closing)
+            {
+                result = -1;
+                break;
+            }
+            ws->state = ST_WEBSOCKET_OPEN;
+            ws->num_connections++;
             libwebsocket_callback_on_writable(this, wsi);
 #if 0
             CanopyEventDetails_t eventDetails;
@@ -72,73 +524,236 @@ static int _ws_callback(
         }
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
             fprintf(stderr, "ws_callback: LWS_CALLBACK_CLIENT_CONNECTION_ERROR\n");
-            return -1;
+            _disconnected(ws);
+            result = -1;
+            break;
         case LWS_CALLBACK_CLOSED:
         {
+            _disconnected(ws);
 #if 0
             fprintf(stderr, "ws_callback: LWS_CALLBACK_CLOSED\n");
             canopy->ws_closed = true;
 #endif
-            return -1;
+            result = -1;
+            break;
         }
         case LWS_CALLBACK_CLIENT_WRITEABLE:
         {
+            if (ws->closing)
+            {
+                // Returning non-zero closes the connection.
+                result = -1;
+                break;
+            }
             ws->ws_write_ready = true;
+            _drain(ws);
             break;
         }
         case LWS_CALLBACK_CLIENT_RECEIVE:
-            /* TODO: this next line seems dangerous! */
-            ((char *)in)[len] = '\0';
-            fprintf(stderr, "rx %d '%s'\n", (int)len, (char *)in);
-            //_process_ws_payload(canopy, in);
-            if (ws->cb_recv)
-            {
-                ws->cb_recv(ws, in, ws->cb_recv_userdata);
-            }
+            _receive(ws, wsi, (const char *)in, len);
             break;
         /*case LWS_CALLBACK_CLIENT_CONFIRM_EXTENSION_SUPPORTED:*/
         default:
             break;
     }
-    return 0;
+    _activity(ws);
+    pthread_mutex_unlock(&ws->lock);
+    return result;
 }
 
-bool st_websocket_is_connected(STWebSocket ws)
+STWebSocketStateEnum st_websocket_state(STWebSocket ws)
 {
+    STWebSocketStateEnum state;
     assert(ws);
-    return ws->ws != NULL;
+    pthread_mutex_lock(&ws->lock);
+    state = ws->state;
+    pthread_mutex_unlock(&ws->lock);
+    return state;
+}
+
+bool st_websocket_is_connected(STWebSocket ws)
+{
+    return st_websocket_state(ws) == ST_WEBSOCKET_OPEN;
 }
 
 bool st_websocket_is_write_ready(STWebSocket ws)
 {
+    bool ready;
     assert(ws);
-    return ws->ws_write_ready;
+    pthread_mutex_lock(&ws->lock);
+    ready = ws->ws_write_ready;
+    pthread_mutex_unlock(&ws->lock);
+    return ready;
 }
 
-CanopyResultEnum st_websocket_connect(
+CanopyResultEnum st_websocket_set_queue_limits(
         STWebSocket ws,
-        const char *hostname,
-        uint16_t port,
-        bool useSSL,
-        const char *url)
+        int high,
+        int low,
+        CanopyQueuePolicyEnum policy)
+{
+    _STWebSocketFrame_t *queue;
+    assert(ws);
+
+    if (high <= 0 || low < 0 || low > high)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    if (policy != CANOPY_QUEUE_POLICY_COALESCE &&
+            policy != CANOPY_QUEUE_POLICY_DROP_OLDEST)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+
+    pthread_mutex_lock(&ws->lock);
+    ws->num_dropped += ws->queue_len;
+    if ((size_t)high != ws->queue_capacity)
+    {
+        queue = calloc(high, sizeof(_STWebSocketFrame_t));
+        if (!queue)
+        {
+            pthread_mutex_unlock(&ws->lock);
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        _free_queue(ws);
+        ws->queue = queue;
+        ws->queue_capacity = high;
+    }
+    ws->queue_head = 0;
+    ws->queue_len = 0;
+    ws->queue_low = low;
+    ws->queue_policy = policy;
+    ws->backpressured = false;
+    pthread_mutex_unlock(&ws->lock);
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_websocket_set_rx_limits(
+        STWebSocket ws,
+        int rxBufferSize,
+        int maxMessageSize)
+{
+    assert(ws);
+    if (rxBufferSize <= 0 || maxMessageSize <= 0)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    pthread_mutex_lock(&ws->lock);
+    ws->rx_buffer_size = rxBufferSize;
+    ws->max_message_size = maxMessageSize;
+    pthread_mutex_unlock(&ws->lock);
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_websocket_set_reconnect_backoff(
+        STWebSocket ws,
+        int minMs,
+        int maxMs)
+{
+    assert(ws);
+    if (minMs < 0 || maxMs < minMs)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    pthread_mutex_lock(&ws->lock);
+    ws->reconnect_min_ms = minMs;
+    ws->reconnect_max_ms = maxMs;
+    pthread_mutex_unlock(&ws->lock);
+    return CANOPY_SUCCESS;
+}
+
+void st_websocket_set_compression(STWebSocket ws, bool enabled)
+{
+    assert(ws);
+    pthread_mutex_lock(&ws->lock);
+    ws->compression = enabled;
+    pthread_mutex_unlock(&ws->lock);
+}
+
+CanopyResultEnum st_websocket_set_reactor(STWebSocket ws, CanopyReactor reactor)
+{
+    CanopyResultEnum result = CANOPY_SUCCESS;
+    assert(ws);
+    pthread_mutex_lock(&ws->lock);
+    if (ws->hostname)
+    {
+        result = CANOPY_ERROR_SYNC_IN_PROGRESS;
+    }
+    else
+    {
+        ws->reactor = reactor;
+    }
+    pthread_mutex_unlock(&ws->lock);
+    return result;
+}
+
+bool st_websocket_uses_reactor(STWebSocket ws)
+{
+    assert(ws);
+    return ws->reactor != NULL;
+}
+
+uint32_t st_websocket_num_connections(STWebSocket ws)
+{
+    uint32_t num;
+    assert(ws);
+    pthread_mutex_lock(&ws->lock);
+    num = ws->num_connections;
+    pthread_mutex_unlock(&ws->lock);
+    return num;
+}
+
+size_t st_websocket_queue_len(STWebSocket ws)
+{
+    size_t len;
+    assert(ws);
+    pthread_mutex_lock(&ws->lock);
+    len = ws->queue_len;
+    pthread_mutex_unlock(&ws->lock);
+    return len;
+}
+
+bool st_websocket_is_backpressured(STWebSocket ws)
+{
+    bool backpressured;
+    assert(ws);
+    pthread_mutex_lock(&ws->lock);
+    backpressured = ws->backpressured;
+    pthread_mutex_unlock(&ws->lock);
+    return backpressured;
+}
+
+uint32_t st_websocket_take_dropped(STWebSocket ws)
+{
+    uint32_t dropped;
+    assert(ws);
+    pthread_mutex_lock(&ws->lock);
+    dropped = ws->num_dropped;
+    ws->num_dropped = 0;
+    pthread_mutex_unlock(&ws->lock);
+    return dropped;
+}
+
+// Create a libwebsockets context for this WebSocket alone.
+static struct libwebsocket_context * _create_context(STWebSocket ws)
 {
-    static struct libwebsocket_protocols sCanopyWsProtocols[] = {
-        {
-            "echo", // TODO: rename 
-            _ws_callback,
-            1024,
-            1024,
-            0,
-            NULL,
-            0
-        },
-        { NULL, NULL, 0, 0, 0, NULL, 0} // end
-    };
     struct lws_context_creation_info info={0};
+
+    memset(ws->protocols, 0, sizeof(ws->protocols));
+    ws->protocols[0].name = ST_WEBSOCKET_PROTOCOL_NAME;
+    ws->protocols[0].callback = st_websocket_lws_callback;
+    ws->protocols[0].rx_buffer_size = ws->rx_buffer_size;
+    // protocols[1] is the all-NULL terminator.
+
     info.port = CONTEXT_PORT_NO_LISTEN;
     info.iface = NULL;
-    info.protocols = sCanopyWsProtocols;
-    info.extensions = NULL;
+    info.protocols = ws->protocols;
+    // When compression is enabled, offer libwebsockets' built-in extensions.
+    // For this generation of libwebsockets that is deflate-frame (it predates
+    // permessage-deflate), with the per-connection state size libwebsockets
+    // expects.  Its zlib window size and memory level are fixed when
+    // libwebsockets is built (LWS_ZLIB_WINDOW_BITS and LWS_ZLIB_MEMLEVEL).
+    info.extensions = ws->compression ? libwebsocket_get_internal_extensions() : NULL;
     info.ssl_cert_filepath = NULL;
     info.ssl_private_key_filepath = NULL;
     info.ssl_ca_filepath = NULL;
@@ -153,73 +768,433 @@ CanopyResultEnum st_websocket_connect(
 
     //lws_set_log_level(511, NULL);
 
-    ws->ws_ctx = libwebsocket_create_context(&info);
-    if (!ws->ws_ctx)
+    return libwebsocket_create_context(&info);
+}
+
+// Start a connection attempt to the saved server.  If it can't even be
+// started, another attempt is scheduled.  Called with <lock> held, on the
+// thread that services the connection.
+static void _attempt_connect(STWebSocket ws)
+{
+    struct libwebsocket *wsi;
+
+    ws->reconnect_pending = false;
+
+    if (ws->reactor)
     {
-        fprintf(stderr, "Failed to create libwebsocket context\n");
-        return CANOPY_ERROR_CONNECTION_FAILED;
+        ws->ws_ctx = st_reactor_lws_context(ws->reactor);
+    }
+    else
+    {
+        // Start over with a fresh context.
+        if (ws->ws_ctx)
+        {
+            libwebsocket_context_destroy(ws->ws_ctx);
+        }
+        ws->ws_ctx = _create_context(ws);
+        if (!ws->ws_ctx)
+        {
+            fprintf(stderr, "Failed to create libwebsocket context\n");
+            _disconnected(ws);
+            return;
+        }
     }
 
     printf("Connecting to:\n");
-    printf("Host: %s\n", hostname);
-    printf("Port: %d\n", port);
-    printf("UseSSL: %d\n", useSSL);
-    ws->ws = libwebsocket_client_connect(
+    printf("Host: %s\n", ws->hostname);
+    printf("Port: %d\n", ws->port);
+    printf("UseSSL: %d\n", ws->use_ssl);
+    ws->state = ST_WEBSOCKET_CONNECTING;
+    wsi = libwebsocket_client_connect_extended(
             ws->ws_ctx, 
-            hostname, 
-            port,
-            useSSL,
-            url, // "/echo"
-            hostname ,
+            ws->hostname, 
+            ws->port,
+            ws->use_ssl,
+            ws->url, // "/echo"
+            ws->hostname,
             "localhost", // origin
-            "echo", // TODO: rename
-            -1 // latest ietf version
+            ST_WEBSOCKET_PROTOCOL_NAME,
+            -1, // latest ietf version
+            ws // per-connection user data, passed to callbacks
         );
-    if (!ws->ws)
+    // libwebsocket_client_connect_extended only attaches <ws> to the
+    // connection once it has been created, so callbacks made from inside it
+    // have no user data and are ignored.  A failure that happens there shows
+    // up as a NULL return instead.
+    if (!wsi)
     {
         fprintf(stderr, "Failed to create libwebsocket connection\n");
-        return CANOPY_ERROR_CONNECTION_FAILED;
+        _disconnected(ws);
+        return;
     }
-
+    ws->ws = wsi;
+    ws->queue_head_pinned = true;
     libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
+}
+
+CanopyResultEnum st_websocket_connect(
+        STWebSocket ws,
+        const char *hostname,
+        uint16_t port,
+        bool useSSL,
+        const char *url)
+{
+    char *hostnameCopy;
+    char *urlCopy;
+
+    hostnameCopy = strdup(hostname);
+    urlCopy = strdup(url);
+    if (!hostnameCopy || !urlCopy)
+    {
+        free(hostnameCopy);
+        free(urlCopy);
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+
+    pthread_mutex_lock(&ws->lock);
+    free(ws->hostname);
+    free(ws->url);
+    ws->hostname = hostnameCopy;
+    ws->url = urlCopy;
+    ws->port = port;
+    ws->use_ssl = useSSL;
+    ws->reconnect_attempts = 0;
+
+    if (ws->reactor)
+    {
+        // The reactor thread makes the attempt.  A previous connection is
+        // closed first, and the new one follows after a backoff.
+        if (ws->ws)
+        {
+            ws->closing = true;
+        }
+        else
+        {
+            ws->reconnect_pending = true;
+            ws->reconnect_at_us = 0;
+        }
+        _post(ws, 0);
+        pthread_mutex_unlock(&ws->lock);
+        return CANOPY_SUCCESS;
+    }
+
+    // Any previous connection is dropped, but this first attempt to the new
+    // server isn't held back by its backoff.
+    if (ws->ws_ctx)
+    {
+        libwebsocket_context_destroy(ws->ws_ctx);
+        ws->ws_ctx = NULL;
+    }
+    _reset_connection(ws);
+    _attempt_connect(ws);
+    pthread_mutex_unlock(&ws->lock);
     return CANOPY_SUCCESS;
 }
 
-void st_websocket_service(STWebSocket ws, uint32_t timeout_ms)
+void st_websocket_reactor_process(STWebSocket ws)
 {
-    libwebsocket_service(ws->ws_ctx, timeout_ms);
+    bool destroy;
+
+    pthread_mutex_lock(&ws->lock);
+    ws->num_posts--;
+    if (ws->freed || ws->closing)
+    {
+        if (ws->ws)
+        {
+            // Close from inside the connection's next writeable callback.
+            ws->closing = true;
+            libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
+        }
+    }
+    else if (!ws->ws && ws->reconnect_pending &&
+            _now_us() >= ws->reconnect_at_us)
+    {
+        _attempt_connect(ws);
+    }
+    else
+    {
+        // Send whatever was queued while the socket was writeable.
+        _drain(ws);
+    }
+    destroy = (ws->freed && !ws->ws && ws->num_posts == 0);
+    pthread_mutex_unlock(&ws->lock);
+
+    if (destroy)
+    {
+        _destroy(ws);
+    }
 }
 
-void st_websocket_write(STWebSocket ws, const char *msg)
+void st_websocket_service(STWebSocket ws, uint32_t timeout_ms)
 {
-    char *buf;
-    if (!ws->ws_write_ready)
+    uint64_t now;
+    struct libwebsocket_context *ctx;
+
+    if (ws->reactor)
+    {
+        // The reactor does the work; just wait for something to happen.
+        struct timespec deadline;
+        uint32_t activity;
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&ws->lock);
+        activity = ws->activity;
+        while (activity == ws->activity)
+        {
+            if (pthread_cond_timedwait(&ws->cond, &ws->lock, &deadline))
+            {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&ws->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&ws->lock);
+    ctx = ws->ws_ctx;
+    pthread_mutex_unlock(&ws->lock);
+    if (ctx)
+    {
+        libwebsocket_service(ctx, timeout_ms);
+
+        // A closed connection's context can't be destroyed from inside its
+        // own callback, so it is cleaned up here.
+        pthread_mutex_lock(&ws->lock);
+        if (ws->state == ST_WEBSOCKET_DISCONNECTED)
+        {
+            libwebsocket_context_destroy(ws->ws_ctx);
+            ws->ws_ctx = NULL;
+        }
+        pthread_mutex_unlock(&ws->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&ws->lock);
+    if (!ws->reconnect_pending)
     {
-        RedLog_DebugLog("canopy", "WS not ready for write!  Skipping.");
+        pthread_mutex_unlock(&ws->lock);
         return;
     }
 
+    // Waiting to reconnect.  Sleep until it's time (or the timeout), rather
+    // than returning right away, so that callers servicing in a loop don't
+    // spin.
+    now = _now_us();
+    if (now < ws->reconnect_at_us)
+    {
+        uint64_t waitUs = ws->reconnect_at_us - now;
+        struct timespec t;
+        if (waitUs > (uint64_t)timeout_ms * 1000)
+        {
+            waitUs = (uint64_t)timeout_ms * 1000;
+        }
+        t.tv_sec = waitUs / 1000000;
+        t.tv_nsec = (waitUs % 1000000) * 1000;
+        pthread_mutex_unlock(&ws->lock);
+        nanosleep(&t, NULL);
+        pthread_mutex_lock(&ws->lock);
+        if (_now_us() < ws->reconnect_at_us)
+        {
+            pthread_mutex_unlock(&ws->lock);
+            return;
+        }
+    }
+    _attempt_connect(ws);
+    pthread_mutex_unlock(&ws->lock);
+}
+
+size_t st_websocket_pre_padding()
+{
+    return LWS_SEND_BUFFER_PRE_PADDING;
+}
+
+size_t st_websocket_post_padding()
+{
+    return LWS_SEND_BUFFER_POST_PADDING;
+}
+
+// Claim the next free send queue slot, applying the queue policy if the
+// queue is full.  The message isn't queued until _commit_frame.  Called with
+// <lock> held.
+static CanopyResultEnum _claim_frame(STWebSocket ws, _STWebSocketFrame_t **out)
+{
+    if (!ws->ws)
+    {
+        return CANOPY_ERROR_CONNECTION_FAILED;
+    }
+
+    if (ws->queue_len == ws->queue_capacity)
+    {
+        if (ws->queue_policy == CANOPY_QUEUE_POLICY_COALESCE)
+        {
+            RedLog_DebugLog("canopy", "WS send queue full!  Deferring.");
+            return CANOPY_ERROR_SYNC_IN_PROGRESS;
+        }
+        if (ws->queue_head_pinned)
+        {
+            // Keep the first message and drop the one after it instead, by
+            // moving the first message into its slot.  The slot the first
+            // message leaves behind is the one that gets reused.
+            size_t next = (ws->queue_head + 1) % ws->queue_capacity;
+            _STWebSocketFrame_t pinned;
+            if (ws->queue_len < 2)
+            {
+                RedLog_DebugLog("canopy", "WS send queue full!  Deferring.");
+                return CANOPY_ERROR_SYNC_IN_PROGRESS;
+            }
+            pinned = ws->queue[ws->queue_head];
+            ws->queue[ws->queue_head] = ws->queue[next];
+            ws->queue[next] = pinned;
+        }
+        RedLog_DebugLog("canopy", "WS send queue full!  Dropping oldest.");
+        ws->num_dropped++;
+        ws->queue_head = (ws->queue_head + 1) % ws->queue_capacity;
+        ws->queue_len--;
+    }
+
+    *out = &ws->queue[(ws->queue_head + ws->queue_len) % ws->queue_capacity];
+    return CANOPY_SUCCESS;
+}
+
+// Queue the message in the slot returned by _claim_frame, then send what the
+// connection can take.  Called with <lock> held.
+static void _commit_frame(
+        STWebSocket ws,
+        _STWebSocketFrame_t *frame,
+        size_t len,
+        enum libwebsocket_write_protocol protocol)
+{
+    frame->len = len;
+    frame->protocol = protocol;
+
+    ws->queue_len++;
+    if (ws->queue_len == ws->queue_capacity)
+    {
+        ws->backpressured = true;
+    }
+
+    if (ws->reactor)
+    {
+        // Only the reactor thread may write to the connection.
+        if (ws->ws_write_ready)
+        {
+            _post(ws, 0);
+        }
+    }
+    else
+    {
+        _drain(ws);
+    }
+}
+
+static CanopyResultEnum _write(
+        STWebSocket ws, 
+        const char *data, 
+        size_t len, 
+        enum libwebsocket_write_protocol protocol)
+{
+    _STWebSocketFrame_t *frame;
+    CanopyResultEnum result;
+    size_t needed;
+
+    pthread_mutex_lock(&ws->lock);
+    result = _claim_frame(ws, &frame);
+    if (result != CANOPY_SUCCESS)
+    {
+        pthread_mutex_unlock(&ws->lock);
+        return result;
+    }
+
     // libwebsockets requires all this crazy padding.
-    size_t len = strlen(msg);
-    buf = calloc(1, LWS_SEND_BUFFER_PRE_PADDING + len + LWS_SEND_BUFFER_POST_PADDING);
-    strcpy(&buf[LWS_SEND_BUFFER_PRE_PADDING], msg);
+    needed = LWS_SEND_BUFFER_PRE_PADDING + len + LWS_SEND_BUFFER_POST_PADDING;
+    if (needed > frame->capacity)
+    {
+        unsigned char *newBuf = realloc(frame->buf, needed);
+        if (!newBuf)
+        {
+            pthread_mutex_unlock(&ws->lock);
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        frame->buf = newBuf;
+        frame->capacity = needed;
+    }
+    memcpy(&frame->buf[LWS_SEND_BUFFER_PRE_PADDING], data, len);
 
-    // Log payload
-    st_log_debug("Websocket Send: %d '%s'\n", (int)len, (char *)msg);
+    _commit_frame(ws, frame, len, protocol);
+    pthread_mutex_unlock(&ws->lock);
+    return CANOPY_SUCCESS;
+}
 
-    // Send msg.
-    libwebsocket_write(ws->ws, (unsigned char *)&buf[LWS_SEND_BUFFER_PRE_PADDING], len, LWS_WRITE_TEXT);
-    ws->ws_write_ready = false;
+CanopyResultEnum st_websocket_write(STWebSocket ws, const char *data, size_t len)
+{
+    st_log_debug("Websocket Send: %d '%.*s'\n", (int)len, (int)len, data);
 
-    // Register callback so that we're informed when it is safe to write again.
-    libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
+    return _write(ws, data, len, LWS_WRITE_TEXT);
+}
+
+CanopyResultEnum st_websocket_write_binary(STWebSocket ws, const char *data, size_t len)
+{
+    st_log_debug("Websocket Send: %d bytes (binary)\n", (int)len);
 
-    // Cleanup.
-    free(buf);
+    return _write(ws, data, len, LWS_WRITE_BINARY);
+}
+
+CanopyResultEnum st_websocket_write_buffer(
+        STWebSocket ws,
+        char **buf,
+        size_t *capacity,
+        size_t len,
+        bool binary)
+{
+    _STWebSocketFrame_t *frame;
+    CanopyResultEnum result;
+    unsigned char *spare;
+    size_t spareCapacity;
+
+    assert(*capacity >= LWS_SEND_BUFFER_PRE_PADDING + len + LWS_SEND_BUFFER_POST_PADDING);
+    st_log_debug("Websocket Send: %d bytes\n", (int)len);
+
+    pthread_mutex_lock(&ws->lock);
+    result = _claim_frame(ws, &frame);
+    if (result != CANOPY_SUCCESS)
+    {
+        pthread_mutex_unlock(&ws->lock);
+        return result;
+    }
+
+    // Swap buffers with the slot, so the message is queued where it is.
+    spare = frame->buf;
+    spareCapacity = frame->capacity;
+    frame->buf = (unsigned char *)*buf;
+    frame->capacity = *capacity;
+    *buf = (char *)spare;
+    *capacity = spareCapacity;
+
+    _commit_frame(ws, frame, len, binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+    pthread_mutex_unlock(&ws->lock);
+    return CANOPY_SUCCESS;
 }
 
 void st_websocket_recv_callback(STWebSocket ws, STWebsocketRecvCallback cb, void *userdata)
 {
+    pthread_mutex_lock(&ws->lock);
     ws->cb_recv = cb;
     ws->cb_recv_userdata = userdata;
+    pthread_mutex_unlock(&ws->lock);
+}
+
+void st_websocket_activity_callback(STWebSocket ws, STWebsocketActivityCallback cb, void *userdata)
+{
+    pthread_mutex_lock(&ws->lock);
+    ws->cb_activity = cb;
+    ws->cb_activity_userdata = userdata;
+    pthread_mutex_unlock(&ws->lock);
 }
@@ -18,11 +18,52 @@
 // WebSocket utility library for Canopy
 
 #include <canopy.h>
+#include <stddef.h>
 
 // An STWebSocket is an ADT representing a websocket connection.
 typedef struct STWebSocket_t * STWebSocket;
 
-typedef void (*STWebsocketRecvCallback)(STWebSocket ws, const char *payload, void *userdata);
+// Connection state of an STWebSocket.  Changes happen while the WebSocket is
+// being serviced.
+typedef enum
+{
+    // No connection.  Either never connected, or the connection failed or
+    // was closed (and a reconnect is pending).
+    ST_WEBSOCKET_DISCONNECTED,
+
+    // st_websocket_connect has been called; waiting for the server to accept
+    // the upgrade.
+    ST_WEBSOCKET_CONNECTING,
+
+    // Connection established.
+    ST_WEBSOCKET_OPEN
+} STWebSocketStateEnum;
+
+// Callback for received messages.  Only called once a message is complete,
+// however many fragments and reads it arrived in.  <payload> points to the
+// <len> bytes of the message inside the WebSocket's reassembly buffer (and is
+// followed by a NUL terminator).  It is only valid for the duration of the
+// callback, but the callback may modify it (for example, to parse it in
+// place).
+typedef void (*STWebsocketRecvCallback)(STWebSocket ws, char *payload, size_t len, void *userdata);
+
+// Callback for activity on a WebSocket serviced by a reactor: anything
+// libwebsockets reports about the connection (opening, closing, becoming
+// writeable, receiving).  Called on the reactor thread with the WebSocket's
+// lock held, so it must not call back into the WebSocket.
+typedef void (*STWebsocketActivityCallback)(STWebSocket ws, void *userdata);
+
+// Default send queue limits (see st_websocket_set_queue_limits).
+#define ST_WEBSOCKET_DEFAULT_QUEUE_HIGH 8
+#define ST_WEBSOCKET_DEFAULT_QUEUE_LOW 2
+
+// Default reconnect backoff (see st_websocket_set_reconnect_backoff).
+#define ST_WEBSOCKET_DEFAULT_RECONNECT_MIN_MS 1000
+#define ST_WEBSOCKET_DEFAULT_RECONNECT_MAX_MS 60000
+
+// Default receive limits (see st_websocket_set_rx_limits).
+#define ST_WEBSOCKET_DEFAULT_RX_BUFFER_SIZE 4096
+#define ST_WEBSOCKET_DEFAULT_MAX_MESSAGE_SIZE (1024*1024)
 
 // Create a new (disconnected) WebSocket object.
 STWebSocket st_websocket_new();
@@ -30,7 +71,15 @@ STWebSocket st_websocket_new();
 // Free websocket object.
 void st_websocket_free(STWebSocket ws);
 
-// Connect to WebSocket server.
+// Start connecting to WebSocket server.  Any previous connection is closed
+// first.  Service the WebSocket until it is OPEN.
+//
+// From then on the WebSocket stays connected by itself: whenever a connection
+// attempt fails or the connection is lost, it goes back to DISCONNECTED and
+// tries again (while being serviced) after a randomized, exponentially
+// growing delay.  The delay goes back to the minimum once the server sends
+// a message over a new connection.  Returns CANOPY_ERROR_OUT_OF_MEMORY, or CANOPY_SUCCESS (even if the
+// first attempt failed right away, since it will be retried).
 CanopyResultEnum st_websocket_connect(
         STWebSocket ws,
         const char *hostname,
@@ -38,20 +87,131 @@ CanopyResultEnum st_websocket_connect(
         bool useSSL,
         const char *url);
 
-// Is STWebSocket connected?
+// Get the WebSocket's connection state.
+STWebSocketStateEnum st_websocket_state(STWebSocket ws);
+
+// Is STWebSocket connected (OPEN)?
 bool st_websocket_is_connected(STWebSocket ws);
 
 // Is WebSocket ready to send bytes?
 bool st_websocket_is_write_ready(STWebSocket ws);
 
-// Service WebSocket.  You must call this periodically.
+// Configure the outbound message queue.  Up to <high> messages can wait for
+// the connection to become writeable.  Once <high> are queued the WebSocket
+// is backpressured until the queue drains down to <low>.  <policy> decides
+// what st_websocket_write does when the queue is full:
+//
+//      CANOPY_QUEUE_POLICY_COALESCE - the message is refused with
+//          CANOPY_ERROR_SYNC_IN_PROGRESS, so the caller can merge it into a
+//          later one.
+//
+//      CANOPY_QUEUE_POLICY_DROP_OLDEST - the oldest queued message is
+//          discarded to make room.  The first message queued on a
+//          connection (the handshake) is kept until it has been sent, and
+//          the one after it is discarded instead.  If it is the only queued
+//          message, the new one is refused with
+//          CANOPY_ERROR_SYNC_IN_PROGRESS.
+//
+// Discards any messages still queued.  Returns CANOPY_ERROR_INVALID_VALUE
+// unless 0 <= <low> <= <high> and <high> > 0.
+CanopyResultEnum st_websocket_set_queue_limits(
+        STWebSocket ws,
+        int high,
+        int low,
+        CanopyQueuePolicyEnum policy);
+
+// Configure receiving.  libwebsockets reads up to <rxBufferSize> bytes at a
+// time, and messages longer than <maxMessageSize> bytes are discarded.  Takes
+// effect at the next st_websocket_connect.  Returns
+// CANOPY_ERROR_INVALID_VALUE unless both are positive.
+CanopyResultEnum st_websocket_set_rx_limits(
+        STWebSocket ws,
+        int rxBufferSize,
+        int maxMessageSize);
+
+// Configure the reconnect backoff.  The n-th attempt in a row waits a random
+// time between 0 and min(<maxMs>, <minMs> * 2^(n-1)) milliseconds.  Returns
+// CANOPY_ERROR_INVALID_VALUE unless 0 <= <minMs> <= <maxMs>.
+CanopyResultEnum st_websocket_set_reconnect_backoff(
+        STWebSocket ws,
+        int minMs,
+        int maxMs);
+
+// Offer compression (the deflate-frame extension) to the server when
+// connecting.  Takes effect on the next connection attempt.
+void st_websocket_set_compression(STWebSocket ws, bool enabled);
+
+// Service the WebSocket from <reactor>'s thread (see canopy_use_reactor)
+// instead of from st_websocket_service, which then only waits for activity.
+// Returns CANOPY_ERROR_SYNC_IN_PROGRESS if st_websocket_connect has already
+// been called.
+CanopyResultEnum st_websocket_set_reactor(STWebSocket ws, CanopyReactor reactor);
+
+// Is the WebSocket serviced by a reactor?  Doesn't change once
+// st_websocket_connect has been called, so it may be asked without taking
+// the WebSocket's lock from then on.
+bool st_websocket_uses_reactor(STWebSocket ws);
+
+// Get the number of times the WebSocket has opened a connection.  A change
+// means a new connection, which needs a new handshake.
+uint32_t st_websocket_num_connections(STWebSocket ws);
+
+// Get the number of queued outbound messages.
+size_t st_websocket_queue_len(STWebSocket ws);
+
+// Has the outbound queue filled up (and not yet drained to its low
+// watermark)?
+bool st_websocket_is_backpressured(STWebSocket ws);
+
+// Get the number of queued messages discarded (because of the DROP_OLDEST
+// policy, or because the connection went away before they were sent) since
+// the last call, and reset the count.
+uint32_t st_websocket_take_dropped(STWebSocket ws);
+
+// Service WebSocket.  You must call this periodically.  Blocks for at most
+// <timeout_ms> milliseconds waiting for activity (or, while disconnected,
+// for the time to reconnect).  Does nothing if st_websocket_connect has never
+// been called.
 void st_websocket_service(STWebSocket ws, uint32_t timeout_ms);
 
-// Send payload over the WebSocket.  Fails silently if the WebSocket isn't
-// connected to the server.
-void st_websocket_write(STWebSocket ws, const char *msg);
+// Queue <len> bytes of text payload to be sent over the WebSocket.  It goes
+// out (in order) as the connection becomes writeable while the WebSocket is
+// serviced.  The payload is copied into a buffer owned by the send queue.
+// Returns CANOPY_ERROR_CONNECTION_FAILED if the WebSocket isn't connected to
+// the server (or connecting to it), and CANOPY_ERROR_SYNC_IN_PROGRESS if the
+// queue is full under the COALESCE policy.
+CanopyResultEnum st_websocket_write(STWebSocket ws, const char *data, size_t len);
+
+// Queue <len> bytes of binary payload to be sent over the WebSocket.  Same as
+// st_websocket_write otherwise.
+CanopyResultEnum st_websocket_write_binary(STWebSocket ws, const char *data, size_t len);
+
+// Number of bytes of padding a buffer passed to st_websocket_write_buffer
+// needs in front of, and after, the payload.  libwebsockets builds the frame
+// header and trailer in them.
+size_t st_websocket_pre_padding();
+size_t st_websocket_post_padding();
+
+// Queue a payload without copying it.  *<buf> is an allocation (from malloc)
+// of *<capacity> bytes holding the <len>-byte payload at offset
+// st_websocket_pre_padding(), followed by st_websocket_post_padding() spare
+// bytes.  On success the send queue takes the buffer, and hands back a spare
+// one in exchange (which may be NULL, with a capacity of 0).  On failure the
+// buffer is left with the caller.  Otherwise the same as st_websocket_write
+// (or st_websocket_write_binary, if <binary>).
+CanopyResultEnum st_websocket_write_buffer(
+        STWebSocket ws,
+        char **buf,
+        size_t *capacity,
+        size_t len,
+        bool binary);
 
 // Set the callback that gets triggered when data is received from the server.
 void st_websocket_recv_callback(STWebSocket ws, STWebsocketRecvCallback cb, void *userdata);
 
+// Set the callback that gets triggered on activity, when the WebSocket is
+// serviced by a reactor.  Lets the owning thread sleep until there is
+// something to do, instead of polling st_websocket_service.
+void st_websocket_activity_callback(STWebSocket ws, STWebsocketActivityCallback cb, void *userdata);
+
 #endif // ST_WEBSOCKET_INCLUDED
@@ -0,0 +1,46 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_WEBSOCKET_LWS_INCLUDED
+#define ST_WEBSOCKET_LWS_INCLUDED
+
+// libwebsockets glue shared by STWebSocket and the reactor.  Only include
+// this from code that talks to libwebsockets directly.
+
+#include "websocket/st_websocket.h"
+#include <libwebsockets.h>
+
+// WebSocket subprotocol spoken with the cloud server.
+#define ST_WEBSOCKET_PROTOCOL_NAME "echo" // TODO: rename
+
+// Protocol callback for STWebSocket connections.  Each connection is opened
+// with its STWebSocket as the libwebsockets per-connection user data, so
+// <user> is the STWebSocket the event is for (or NULL for events that aren't
+// about a connection).
+int st_websocket_lws_callback(
+        struct libwebsocket_context *context,
+        struct libwebsocket *wsi,
+        enum libwebsocket_callback_reasons reason,
+        void *user,
+        void *in,
+        size_t len);
+
+// Called on the reactor thread for each st_reactor_post(ws, ...) once it is
+// due.  Starts connection attempts, sends queued messages and closes
+// connections on behalf of the threads using <ws>, since only the reactor
+// thread may call into the reactor's libwebsockets context.  May free <ws>
+// (once st_websocket_free has been called on it and its connection is gone).
+void st_websocket_reactor_process(STWebSocket ws);
+
+#endif // ST_WEBSOCKET_LWS_INCLUDED
@@ -0,0 +1,81 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "cloudvar/st_cloudvar.h"
+#include "codec/st_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tests that array elements received from the server are stored, but not
+// sent back with the next payload.  Drives the cloudvar decoder/encoder
+// directly, so it includes internal headers.  Doesn't "sync" w/ server.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    CanopyVar ary;
+    STDecoder_t decoder;
+    STEncoder encoder;
+    char inbound[] = "{\"1\" : 5.5, \"2\" : 6.5}";
+    const char *outbound;
+    double readFloat64;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "inout float64[4] ary");
+    RedTest_Verify(test, "Init float64 array", result == CANOPY_SUCCESS);
+
+    ary = canopy_var_handle(canopy, "ary");
+    RedTest_Verify(test, "Get array handle", ary != NULL);
+
+    result = canopy_var_set(canopy, "ary",
+        CANOPY_VALUE_ARRAY(
+            0, CANOPY_VALUE_FLOAT64(1.5)
+        )
+    );
+    RedTest_Verify(test, "Set element locally", result == CANOPY_SUCCESS);
+
+    result = st_decoder_init(&decoder, CANOPY_ENCODING_JSON, inbound, strlen(inbound));
+    RedTest_Verify(test, "Init decoder", result == CANOPY_SUCCESS);
+
+    st_cloudvar_lock(ary);
+    result = st_cloudvar_decode(ary, &decoder);
+    st_cloudvar_unlock(ary);
+    RedTest_Verify(test, "Decode inbound elements", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get(canopy, "ary",
+            CANOPY_READ_ARRAY(
+                2, CANOPY_READ_FLOAT64(&readFloat64)));
+    RedTest_Verify(test, "Decoded element readable", result == CANOPY_SUCCESS && readFloat64 == 6.5);
+
+    encoder = st_encoder_new(CANOPY_ENCODING_JSON);
+    RedTest_Verify(test, "Create encoder", encoder != NULL);
+
+    st_cloudvar_lock(ary);
+    result = st_cloudvar_encode(encoder, ary);
+    st_cloudvar_unlock(ary);
+    RedTest_Verify(test, "Encode outbound payload", result == CANOPY_SUCCESS);
+
+    outbound = st_encoder_bytes(encoder);
+    RedTest_Verify(test, "Locally set element is sent", strstr(outbound, "\"0\"") != NULL);
+    RedTest_Verify(test, "Decoded elements are not sent back",
+            strstr(outbound, "\"1\"") == NULL && strstr(outbound, "\"2\"") == NULL);
+    st_encoder_free(encoder);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,422 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "codec/st_codec.h"
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _MAX_DUMP 4096
+
+static const CanopyEncodingEnum _encodings[] = {
+    CANOPY_ENCODING_JSON,
+    CANOPY_ENCODING_CBOR,
+};
+#define _NUM_ENCODINGS (sizeof(_encodings) / sizeof(_encodings[0]))
+
+// Decode a copy of the <len> bytes at <bytes>, describing every token in
+// <dump> (one "token:text" entry per token, numbers printed with %.17g).
+// Returns the last token: ST_TOKEN_END if the whole document was read,
+// otherwise ST_TOKEN_ERROR.
+static STTokenEnum _decode(
+        CanopyEncodingEnum encoding,
+        const char *bytes,
+        size_t len,
+        char *dump)
+{
+    STDecoder_t decoder;
+    STTokenEnum token;
+    double number;
+    size_t dumpLen = 0;
+    char *buf = malloc(len ? len : 1);
+
+    memcpy(buf, bytes, len);
+    dump[0] = '\0';
+    st_decoder_init(&decoder, encoding, buf, len);
+    do
+    {
+        token = st_decoder_next(&decoder);
+        if (dumpLen + 256 >= _MAX_DUMP)
+        {
+            continue;
+        }
+        if (token == ST_TOKEN_KEY || token == ST_TOKEN_STRING)
+        {
+            dumpLen += snprintf(&dump[dumpLen], _MAX_DUMP - dumpLen,
+                    "%d:%s ", token, st_decoder_string(&decoder));
+        }
+        else if (token == ST_TOKEN_NUMBER && st_decoder_number(&decoder, &number))
+        {
+            dumpLen += snprintf(&dump[dumpLen], _MAX_DUMP - dumpLen,
+                    "%d:%.17g ", token, number);
+        }
+        else
+        {
+            dumpLen += snprintf(&dump[dumpLen], _MAX_DUMP - dumpLen, "%d ", token);
+        }
+    } while (token != ST_TOKEN_END && token != ST_TOKEN_ERROR);
+    free(buf);
+    return token;
+}
+
+// Decode a one-element array, returning its number (or NaN).
+static double _decode_number(CanopyEncodingEnum encoding, const char *bytes, size_t len)
+{
+    STDecoder_t decoder;
+    double number;
+    char *buf = malloc(len);
+    bool ok;
+
+    memcpy(buf, bytes, len);
+    st_decoder_init(&decoder, encoding, buf, len);
+    ok = st_decoder_next(&decoder) == ST_TOKEN_BEGIN_ARRAY &&
+        st_decoder_next(&decoder) == ST_TOKEN_NUMBER &&
+        st_decoder_number(&decoder, &number) &&
+        st_decoder_next(&decoder) == ST_TOKEN_END_ARRAY &&
+        st_decoder_next(&decoder) == ST_TOKEN_END;
+    free(buf);
+    return ok ? number : 0.0 / 0.0;
+}
+
+// Decode the <len> bytes of CBOR at <bytes>, returning the last token.
+static STTokenEnum _scan_cbor(const char *bytes, size_t len)
+{
+    char dump[_MAX_DUMP];
+    return _decode(CANOPY_ENCODING_CBOR, bytes, len, dump);
+}
+
+#define _SCAN_CBOR(literal) _scan_cbor((literal), sizeof(literal) - 1)
+
+// Write a document exercising every kind of value and nesting.
+static void _encode_document(STEncoder encoder)
+{
+    st_encoder_begin_object(encoder);
+    st_encoder_key(encoder, "vars");
+    st_encoder_begin_object(encoder);
+    st_encoder_key(encoder, "temperature");
+    st_encoder_float32(encoder, 21.5f);
+    st_encoder_key(encoder, "count");
+    st_encoder_uint(encoder, 70000);
+    st_encoder_key(encoder, "offset");
+    st_encoder_int(encoder, -300);
+    st_encoder_key(encoder, "on");
+    st_encoder_bool(encoder, true);
+    st_encoder_key(encoder, "off");
+    st_encoder_bool(encoder, false);
+    st_encoder_key(encoder, "nothing");
+    st_encoder_null(encoder);
+    st_encoder_key(encoder, "gps");
+    st_encoder_begin_object(encoder);
+    st_encoder_key(encoder, "latitude");
+    st_encoder_float64(encoder, 37.774929);
+    st_encoder_key(encoder, "history");
+    st_encoder_begin_array(encoder);
+    st_encoder_begin_array(encoder);
+    st_encoder_end_array(encoder);
+    st_encoder_begin_object(encoder);
+    st_encoder_end_object(encoder);
+    st_encoder_string(encoder, "fix");
+    st_encoder_end_array(encoder);
+    st_encoder_end_object(encoder);
+    st_encoder_end_object(encoder);
+    st_encoder_end_object(encoder);
+}
+
+// Tests the JSON and CBOR encoders and decoders against each other, and the
+// CBOR reader against malformed input.  Includes internal headers.
+int main(int argc, const char *argv[])
+{
+    RedTest test;
+    STEncoder encoder;
+    char dump[_MAX_DUMP];
+    char dumps[_NUM_ENCODINGS][_MAX_DUMP];
+    char msg[128];
+    size_t e, i, len;
+    bool ok;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    // Integers at each CBOR size boundary, with the encoded size of the
+    // CBOR item (the array around it takes 2 more bytes).
+    {
+        static const struct
+        {
+            int64_t value;
+            size_t cborSize;
+        } ints[] = {
+            {0, 1}, {23, 1}, {24, 2}, {255, 2}, {256, 3}, {65535, 3},
+            {65536, 5}, {4294967295LL, 5}, {4294967296LL, 9}, {INT64_MAX, 9},
+            {-1, 1}, {-24, 1}, {-25, 2}, {-256, 2}, {-257, 3}, {-65536, 3},
+            {-65537, 5}, {-4294967296LL, 5}, {-4294967297LL, 9}, {INT64_MIN, 9},
+        };
+        static const uint64_t uints[] = {UINT32_MAX, UINT64_MAX};
+
+        for (e = 0; e < _NUM_ENCODINGS; e++)
+        {
+            encoder = st_encoder_new(_encodings[e]);
+            for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++)
+            {
+                st_encoder_reset(encoder);
+                st_encoder_begin_array(encoder);
+                st_encoder_int(encoder, ints[i].value);
+                st_encoder_end_array(encoder);
+                ok = st_encoder_result(encoder) == CANOPY_SUCCESS &&
+                    _decode_number(_encodings[e],
+                            st_encoder_bytes(encoder),
+                            st_encoder_len(encoder)) == (double)ints[i].value;
+                if (_encodings[e] == CANOPY_ENCODING_CBOR)
+                {
+                    ok = ok && st_encoder_len(encoder) == ints[i].cborSize + 2;
+                }
+                snprintf(msg, sizeof(msg), "%s int %lld round trip",
+                        st_codec_encoding_name(_encodings[e]), (long long)ints[i].value);
+                RedTest_Verify(test, msg, ok);
+            }
+            for (i = 0; i < sizeof(uints) / sizeof(uints[0]); i++)
+            {
+                st_encoder_reset(encoder);
+                st_encoder_begin_array(encoder);
+                st_encoder_uint(encoder, uints[i]);
+                st_encoder_end_array(encoder);
+                ok = st_encoder_result(encoder) == CANOPY_SUCCESS &&
+                    _decode_number(_encodings[e],
+                            st_encoder_bytes(encoder),
+                            st_encoder_len(encoder)) == (double)uints[i];
+                snprintf(msg, sizeof(msg), "%s uint %llu round trip",
+                        st_codec_encoding_name(_encodings[e]), (unsigned long long)uints[i]);
+                RedTest_Verify(test, msg, ok);
+            }
+            st_encoder_free(encoder);
+        }
+    }
+
+    // Floats.  A float64 that fits in a float32 is sent as one in CBOR.
+    {
+        static const float floats[] = {0.0f, 1.5f, -0.1f, 3.14159f, FLT_MIN, FLT_MAX, -FLT_MAX};
+        static const struct
+        {
+            double value;
+            size_t cborSize;
+        } doubles[] = {
+            {0.1, 9}, {-37.774929, 9}, {1e300, 9}, {DBL_MIN, 9}, {2.5, 5}, {-65536.0, 5},
+        };
+        double number;
+
+        for (e = 0; e < _NUM_ENCODINGS; e++)
+        {
+            encoder = st_encoder_new(_encodings[e]);
+            for (i = 0; i < sizeof(floats) / sizeof(floats[0]); i++)
+            {
+                st_encoder_reset(encoder);
+                st_encoder_begin_array(encoder);
+                st_encoder_float32(encoder, floats[i]);
+                st_encoder_end_array(encoder);
+                number = _decode_number(_encodings[e],
+                        st_encoder_bytes(encoder),
+                        st_encoder_len(encoder));
+                snprintf(msg, sizeof(msg), "%s float32 %.9g round trip",
+                        st_codec_encoding_name(_encodings[e]), floats[i]);
+                RedTest_Verify(test, msg, (float)number == floats[i]);
+            }
+            for (i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++)
+            {
+                st_encoder_reset(encoder);
+                st_encoder_begin_array(encoder);
+                st_encoder_float64(encoder, doubles[i].value);
+                st_encoder_end_array(encoder);
+                ok = _decode_number(_encodings[e],
+                        st_encoder_bytes(encoder),
+                        st_encoder_len(encoder)) == doubles[i].value;
+                if (_encodings[e] == CANOPY_ENCODING_CBOR)
+                {
+                    ok = ok && st_encoder_len(encoder) == doubles[i].cborSize + 2;
+                }
+                snprintf(msg, sizeof(msg), "%s float64 %.17g round trip",
+                        st_codec_encoding_name(_encodings[e]), doubles[i].value);
+                RedTest_Verify(test, msg, ok);
+            }
+            st_encoder_free(encoder);
+        }
+
+        // Half precision isn't written, but is accepted: [1.0, -2.0].
+        number = _decode_number(CANOPY_ENCODING_CBOR, "\x81\xf9\x3c\x00", 4);
+        RedTest_Verify(test, "CBOR half float", number == 1.0);
+    }
+
+    // Strings needing escapes in JSON, and long enough to need a 2-byte
+    // header in CBOR.
+    {
+        const char *strings[] = {
+            "",
+            "quote \" backslash \\ slash /",
+            "newline \n tab \t return \r control \x01 \x1f delete \x7f",
+            "unicode \xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80",
+            "0123456789012345678901234567890123456789012345678901234567890123456789"
+                "0123456789012345678901234567890123456789012345678901234567890123456789"
+                "0123456789012345678901234567890123456789012345678901234567890123456789"
+                "0123456789012345678901234567890123456789012345678901234567890123456789",
+        };
+        STDecoder_t decoder;
+        char *buf;
+
+        for (e = 0; e < _NUM_ENCODINGS; e++)
+        {
+            encoder = st_encoder_new(_encodings[e]);
+            for (i = 0; i < sizeof(strings) / sizeof(strings[0]); i++)
+            {
+                st_encoder_reset(encoder);
+                st_encoder_begin_object(encoder);
+                st_encoder_key(encoder, strings[i]);
+                st_encoder_string(encoder, strings[i]);
+                st_encoder_end_object(encoder);
+                len = st_encoder_len(encoder);
+                buf = malloc(len);
+                memcpy(buf, st_encoder_bytes(encoder), len);
+                st_decoder_init(&decoder, _encodings[e], buf, len);
+                ok = st_decoder_next(&decoder) == ST_TOKEN_BEGIN_OBJECT &&
+                    st_decoder_next(&decoder) == ST_TOKEN_KEY &&
+                    !strcmp(st_decoder_string(&decoder), strings[i]) &&
+                    st_decoder_next(&decoder) == ST_TOKEN_STRING &&
+                    !strcmp(st_decoder_string(&decoder), strings[i]) &&
+                    st_decoder_string_len(&decoder) == strlen(strings[i]) &&
+                    st_decoder_next(&decoder) == ST_TOKEN_END_OBJECT &&
+                    st_decoder_next(&decoder) == ST_TOKEN_END;
+                free(buf);
+                snprintf(msg, sizeof(msg), "%s string %u round trip",
+                        st_codec_encoding_name(_encodings[e]), (unsigned)i);
+                RedTest_Verify(test, msg, ok);
+            }
+            st_encoder_free(encoder);
+        }
+    }
+
+    // Nested maps and arrays decode to the same tokens in both encodings.
+    {
+        for (e = 0; e < _NUM_ENCODINGS; e++)
+        {
+            encoder = st_encoder_new(_encodings[e]);
+            _encode_document(encoder);
+            ok = st_encoder_result(encoder) == CANOPY_SUCCESS &&
+                _decode(_encodings[e],
+                        st_encoder_bytes(encoder),
+                        st_encoder_len(encoder),
+                        dumps[e]) == ST_TOKEN_END;
+            snprintf(msg, sizeof(msg), "%s document decodes",
+                    st_codec_encoding_name(_encodings[e]));
+            RedTest_Verify(test, msg, ok);
+
+            // Every proper prefix of the document is truncated.
+            ok = true;
+            for (len = 0; len < st_encoder_len(encoder); len++)
+            {
+                if (_decode(_encodings[e], st_encoder_bytes(encoder), len, dump) != ST_TOKEN_ERROR)
+                {
+                    ok = false;
+                }
+            }
+            snprintf(msg, sizeof(msg), "%s truncated document rejected",
+                    st_codec_encoding_name(_encodings[e]));
+            RedTest_Verify(test, msg, ok);
+
+            if (_encodings[e] == CANOPY_ENCODING_CBOR)
+            {
+                RedTest_Verify(test, "CBOR document detected",
+                        st_codec_detect_encoding(
+                            st_encoder_bytes(encoder),
+                            st_encoder_len(encoder)) == CANOPY_ENCODING_CBOR);
+            }
+            else
+            {
+                RedTest_Verify(test, "JSON document detected",
+                        st_codec_detect_encoding(
+                            st_encoder_bytes(encoder),
+                            st_encoder_len(encoder)) == CANOPY_ENCODING_JSON);
+            }
+            st_encoder_free(encoder);
+        }
+        RedTest_Verify(test, "Document matches across encodings", !strcmp(dumps[0], dumps[1]));
+    }
+
+    // JSON text spliced into a document.
+    {
+        for (e = 0; e < _NUM_ENCODINGS; e++)
+        {
+            char sddl[] = "{\"optional float32 x\" : {\"min\" : -1.5, \"max\" : 100, "
+                "\"tags\" : [\"a\\\"b\", true, false, null, []]}}";
+            encoder = st_encoder_new(_encodings[e]);
+            st_encoder_begin_object(encoder);
+            st_encoder_key(encoder, "sddl");
+            st_encoder_json(encoder, sddl);
+            st_encoder_key(encoder, "after");
+            st_encoder_int(encoder, 1);
+            st_encoder_end_object(encoder);
+            ok = st_encoder_result(encoder) == CANOPY_SUCCESS &&
+                _decode(_encodings[e],
+                        st_encoder_bytes(encoder),
+                        st_encoder_len(encoder),
+                        dumps[e]) == ST_TOKEN_END;
+            snprintf(msg, sizeof(msg), "%s spliced JSON decodes",
+                    st_codec_encoding_name(_encodings[e]));
+            RedTest_Verify(test, msg, ok);
+            st_encoder_free(encoder);
+        }
+        RedTest_Verify(test, "Spliced JSON matches across encodings", !strcmp(dumps[0], dumps[1]));
+
+        {
+            char bad[] = "{\"a\" : [1, }";
+            encoder = st_encoder_new(CANOPY_ENCODING_CBOR);
+            st_encoder_json(encoder, bad);
+            RedTest_Verify(test, "Malformed spliced JSON is an error",
+                    st_encoder_result(encoder) == CANOPY_ERROR_INVALID_VALUE);
+            st_encoder_free(encoder);
+        }
+    }
+
+    // Malformed and unsupported CBOR.
+    RedTest_Verify(test, "CBOR empty input", _scan_cbor("", 0) == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR truncated argument", _SCAN_CBOR("\x19\x01") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR truncated float64", _SCAN_CBOR("\xfb\x3f\xf0\x00") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR truncated text", _SCAN_CBOR("\x65" "abc") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR text length past end", _SCAN_CBOR("\x7b\xff\xff\xff\xff\xff\xff\xff\xff" "a") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR short definite array", _SCAN_CBOR("\x83\x01\x02") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR short definite map", _SCAN_CBOR("\xa1\x61" "a") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR huge array count", _SCAN_CBOR("\x9b\x80\x00\x00\x00\x00\x00\x00\x00\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR huge map count", _SCAN_CBOR("\xbb\x40\x00\x00\x00\x00\x00\x00\x00\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR missing break", _SCAN_CBOR("\x9f\x01") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR map missing value", _SCAN_CBOR("\xbf\x61" "a\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR break in definite array", _SCAN_CBOR("\x82\x01\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR stray break", _SCAN_CBOR("\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR indefinite text", _SCAN_CBOR("\x7f\x61" "a\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR indefinite bytes", _SCAN_CBOR("\x5f\x41" "a\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR indefinite integer", _SCAN_CBOR("\x1f") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR indefinite tag", _SCAN_CBOR("\xdf\x01") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR byte string", _SCAN_CBOR("\x42\x01\x02") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR integer key", _SCAN_CBOR("\xa1\x01\x02") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR array key", _SCAN_CBOR("\xbf\x80\x01\xff") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR reserved argument", _SCAN_CBOR("\x1c") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR unassigned simple value", _SCAN_CBOR("\xf0") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR one-byte simple value", _SCAN_CBOR("\xf8\x20") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR trailing bytes", _SCAN_CBOR("\xa0\x00") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "CBOR tag only", _SCAN_CBOR("\xc1") == ST_TOKEN_ERROR);
+
+    // Valid CBOR this library doesn't write itself.
+    RedTest_Verify(test, "CBOR definite map and array",
+            _SCAN_CBOR("\xa2\x61" "a\x82\x01\x20\x61" "b\xa0") == ST_TOKEN_END);
+    RedTest_Verify(test, "CBOR indefinite inside definite",
+            _SCAN_CBOR("\x81\xbf\x61" "a\x9f\xff\xff") == ST_TOKEN_END);
+    RedTest_Verify(test, "CBOR tagged value", _SCAN_CBOR("\xc1\x1a\x51\x4b\x67\xb0") == ST_TOKEN_END);
+    RedTest_Verify(test, "CBOR two-byte text header", _SCAN_CBOR("\x78\x01" "a") == ST_TOKEN_END);
+
+    {
+        char deep[ST_CBOR_READER_MAX_DEPTH + 2];
+        memset(deep, 0x81, sizeof(deep));
+        deep[ST_CBOR_READER_MAX_DEPTH] = 0x00;
+        RedTest_Verify(test, "CBOR maximum nesting", _scan_cbor(deep, ST_CBOR_READER_MAX_DEPTH + 1) == ST_TOKEN_END);
+        deep[ST_CBOR_READER_MAX_DEPTH] = (char)0x81;
+        deep[ST_CBOR_READER_MAX_DEPTH + 1] = 0x00;
+        RedTest_Verify(test, "CBOR nesting too deep", _scan_cbor(deep, sizeof(deep)) == ST_TOKEN_ERROR);
+    }
+
+    return RedTest_End(test);
+}
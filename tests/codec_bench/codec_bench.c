@@ -0,0 +1,146 @@
+#include <canopy.h>
+#include "codec/st_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _ITERATIONS 100000
+
+static double _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Write a typical sync payload: a dozen float32 sensor readings, four
+// counters, a bool, a string, a float64 struct and a float32 array.  <k>
+// varies the values from run to run.
+static void _encode_payload(STEncoder encoder, int k)
+{
+    char name[32];
+    int i;
+
+    st_encoder_reset(encoder);
+    st_encoder_begin_object(encoder);
+    st_encoder_key(encoder, "vars");
+    st_encoder_begin_object(encoder);
+    for (i = 0; i < 12; i++)
+    {
+        snprintf(name, sizeof(name), "temperature_%d", i);
+        st_encoder_key(encoder, name);
+        st_encoder_float32(encoder, 20.0f + i * 0.37f + k * 0.001f);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        snprintf(name, sizeof(name), "counter_%d", i);
+        st_encoder_key(encoder, name);
+        st_encoder_uint(encoder, 1000 * i + k);
+    }
+    st_encoder_key(encoder, "door_open");
+    st_encoder_bool(encoder, k & 1);
+    st_encoder_key(encoder, "status");
+    st_encoder_string(encoder, "nominal");
+    st_encoder_key(encoder, "gps");
+    st_encoder_begin_object(encoder);
+    st_encoder_key(encoder, "latitude");
+    st_encoder_float64(encoder, 37.774929 + k * 1e-7);
+    st_encoder_key(encoder, "longitude");
+    st_encoder_float64(encoder, -122.419416);
+    st_encoder_end_object(encoder);
+    st_encoder_key(encoder, "samples");
+    st_encoder_begin_array(encoder);
+    for (i = 0; i < 16; i++)
+    {
+        st_encoder_float32(encoder, 0.125f * i + k * 0.01f);
+    }
+    st_encoder_end_array(encoder);
+    st_encoder_end_object(encoder);
+    st_encoder_end_object(encoder);
+}
+
+// Decode a copy of the encoded payload, reading every string and number.
+static STTokenEnum _decode_payload(CanopyEncodingEnum encoding, const char *bytes, size_t len, char *buf)
+{
+    STDecoder_t decoder;
+    STTokenEnum token;
+    double number;
+    size_t total = 0;
+
+    memcpy(buf, bytes, len);
+    st_decoder_init(&decoder, encoding, buf, len);
+    do
+    {
+        token = st_decoder_next(&decoder);
+        if (token == ST_TOKEN_KEY || token == ST_TOKEN_STRING)
+        {
+            total += st_decoder_string_len(&decoder);
+        }
+        else if (token == ST_TOKEN_NUMBER)
+        {
+            st_decoder_number(&decoder, &number);
+        }
+    } while (token != ST_TOKEN_END && token != ST_TOKEN_ERROR);
+    return total ? token : ST_TOKEN_ERROR;
+}
+
+// Times encoding and decoding a representative payload with each encoding.
+// Not a pass/fail test; the results are quoted in docs/di_protocol.md.
+int main(int argc, const char *argv[])
+{
+    static const CanopyEncodingEnum encodings[] = {
+        CANOPY_ENCODING_JSON,
+        CANOPY_ENCODING_CBOR,
+    };
+    STEncoder encoder;
+    char *buf;
+    double start, encodeUs, decodeUs;
+    size_t e;
+    int k;
+
+    printf("%-8s %8s %14s %14s\n", "encoding", "bytes", "encode (us)", "decode (us)");
+    for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++)
+    {
+        encoder = st_encoder_new(encodings[e]);
+        if (!encoder)
+        {
+            return 1;
+        }
+
+        start = _now();
+        for (k = 0; k < _ITERATIONS; k++)
+        {
+            _encode_payload(encoder, k);
+        }
+        encodeUs = (_now() - start) * 1e6 / _ITERATIONS;
+
+        _encode_payload(encoder, 0);
+        if (st_encoder_result(encoder) != CANOPY_SUCCESS)
+        {
+            return 1;
+        }
+        buf = malloc(st_encoder_len(encoder));
+        start = _now();
+        for (k = 0; k < _ITERATIONS; k++)
+        {
+            if (_decode_payload(encodings[e],
+                    st_encoder_bytes(encoder),
+                    st_encoder_len(encoder),
+                    buf) != ST_TOKEN_END)
+            {
+                return 1;
+            }
+        }
+        decodeUs = (_now() - start) * 1e6 / _ITERATIONS;
+
+        printf("%-8s %8zu %14.2f %14.2f\n",
+                st_codec_encoding_name(encodings[e]),
+                st_encoder_len(encoder),
+                encodeUs,
+                decodeUs);
+        free(buf);
+        st_encoder_free(encoder);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "json/st_json_reader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Read every token of the <len> bytes at <text> (which may contain NULs),
+// parsing a copy of it.  Returns the last token: ST_TOKEN_END if the whole
+// document was read, otherwise ST_TOKEN_ERROR.
+static STTokenEnum _scan(const char *text, size_t len)
+{
+    STJsonReader_t reader;
+    STTokenEnum token;
+    char *buf = malloc(len ? len : 1);
+
+    memcpy(buf, text, len);
+    st_json_reader_init(&reader, buf, len);
+    do
+    {
+        token = st_json_reader_next(&reader);
+    } while (token != ST_TOKEN_END && token != ST_TOKEN_ERROR);
+    free(buf);
+    return token;
+}
+
+#define _SCAN(literal) _scan((literal), sizeof(literal) - 1)
+
+// Tests the JSON reader directly, mostly against malformed input, since it
+// parses whatever arrives from the network.  Includes internal headers.
+int main(int argc, const char *argv[])
+{
+    RedTest test;
+    STJsonReader_t reader;
+    double number;
+    bool ok;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    {
+        char doc[] = "{\"a\" : [1, -2.5e3, true, false, null, \"x\\n\\u00e9\\ud83d\\ude00\"], \"b\" : {}}";
+        st_json_reader_init(&reader, doc, strlen(doc));
+        ok = st_json_reader_next(&reader) == ST_TOKEN_BEGIN_OBJECT &&
+            st_json_reader_next(&reader) == ST_TOKEN_KEY &&
+            !strcmp(st_json_reader_string(&reader), "a") &&
+            st_json_reader_next(&reader) == ST_TOKEN_BEGIN_ARRAY &&
+            st_json_reader_next(&reader) == ST_TOKEN_NUMBER &&
+            st_json_reader_number(&reader, &number) && number == 1.0 &&
+            st_json_reader_next(&reader) == ST_TOKEN_NUMBER &&
+            st_json_reader_number(&reader, &number) && number == -2500.0 &&
+            st_json_reader_next(&reader) == ST_TOKEN_TRUE &&
+            st_json_reader_next(&reader) == ST_TOKEN_FALSE &&
+            st_json_reader_next(&reader) == ST_TOKEN_NULL &&
+            st_json_reader_next(&reader) == ST_TOKEN_STRING &&
+            !strcmp(st_json_reader_string(&reader), "x\n\xc3\xa9\xf0\x9f\x98\x80") &&
+            st_json_reader_string_len(&reader) == 8 &&
+            st_json_reader_next(&reader) == ST_TOKEN_END_ARRAY &&
+            st_json_reader_next(&reader) == ST_TOKEN_KEY &&
+            st_json_reader_next(&reader) == ST_TOKEN_BEGIN_OBJECT &&
+            st_json_reader_next(&reader) == ST_TOKEN_END_OBJECT &&
+            st_json_reader_next(&reader) == ST_TOKEN_END_OBJECT &&
+            st_json_reader_next(&reader) == ST_TOKEN_END;
+        RedTest_Verify(test, "Well-formed document", ok);
+    }
+
+    RedTest_Verify(test, "Empty input", _SCAN("") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Whitespace only", _SCAN("  \n") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Unclosed object", _SCAN("{\"a\" : 1") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Unclosed array", _SCAN("[1, 2") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Trailing comma", _SCAN("[1, 2,]") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Missing comma", _SCAN("[1 2]") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Missing colon", _SCAN("{\"a\" 1}") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Missing value", _SCAN("{\"a\" : }") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Unquoted key", _SCAN("{a : 1}") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Mismatched close", _SCAN("[1}") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Extra close", _SCAN("[1]]") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Trailing garbage", _SCAN("{} x") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Truncated literal", _SCAN("[tru]") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Literal at end of input", _SCAN("nul") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Bare word", _SCAN("hello") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Unterminated string", _SCAN("\"abc") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Escape at end of input", _SCAN("\"abc\\") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Unknown escape", _SCAN("\"a\\x\"") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Short \\u escape", _SCAN("\"\\u12\"") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Non-hex \\u escape", _SCAN("\"\\u12g4\"") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Lone high surrogate", _SCAN("\"\\ud800\"") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Bad low surrogate", _SCAN("\"\\ud800\\u0041\"") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "Raw control character in string", _SCAN("\"a\nb\"") == ST_TOKEN_ERROR);
+
+    // NULs from the receive buffer are never part of a token.
+    RedTest_Verify(test, "NUL inside string", _SCAN("\"a\0b\"") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "NUL after top-level number", _SCAN("1\0") == ST_TOKEN_ERROR);
+    RedTest_Verify(test, "NUL inside array", _SCAN("[1\0]") == ST_TOKEN_ERROR);
+    {
+        char doc[] = "[12\0]";
+        st_json_reader_init(&reader, doc, sizeof(doc) - 1);
+        ok = st_json_reader_next(&reader) == ST_TOKEN_BEGIN_ARRAY &&
+            st_json_reader_next(&reader) == ST_TOKEN_NUMBER &&
+            st_json_reader_number(&reader, &number) && number == 12.0 &&
+            st_json_reader_next(&reader) == ST_TOKEN_ERROR &&
+            st_json_reader_next(&reader) == ST_TOKEN_ERROR;
+        RedTest_Verify(test, "Number stops at NUL", ok);
+    }
+
+    {
+        char doc[] = "[1e, 1.2.3, --1]";
+        st_json_reader_init(&reader, doc, strlen(doc));
+        ok = st_json_reader_next(&reader) == ST_TOKEN_BEGIN_ARRAY;
+        for (i = 0; ok && i < 3; i++)
+        {
+            ok = st_json_reader_next(&reader) == ST_TOKEN_NUMBER &&
+                !st_json_reader_number(&reader, &number);
+        }
+        RedTest_Verify(test, "Malformed numbers rejected on conversion", ok);
+    }
+
+    {
+        char doc[ST_JSON_READER_MAX_DEPTH + 2];
+        memset(doc, '[', sizeof(doc));
+        RedTest_Verify(test, "Nesting too deep", _scan(doc, sizeof(doc)) == ST_TOKEN_ERROR);
+    }
+
+    return RedTest_End(test);
+}
@@ -121,6 +121,49 @@ int main(void)
     result = canopy_sync(canopy, NULL);
     CHECK_RESULT(result);
 
+    // Set again using the typed (allocation-free) setters
+
+    result = canopy_var_set_bool(canopy, "var_bool", false);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_int8(canopy, "var_i8", -16);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_uint8(canopy, "var_u8", 16);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_int16(canopy, "var_i16", -10001);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_uint16(canopy, "var_u16", 10001);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_int32(canopy, "var_i32", -85001);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_uint32(canopy, "var_u32", 85001);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_float32(canopy, "var_f32", 2.5f);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_float64(canopy, "var_f64", 2.5000000001);
+    CHECK_RESULT(result);
+
+    result = canopy_var_set_string(canopy, "var_string", "Hello Typed");
+    CHECK_RESULT(result);
+
+    // Datatype mismatch must be rejected
+    result = canopy_var_set_float32(canopy, "var_i8", 1.0f);
+    if (result != CANOPY_ERROR_INCORRECT_DATATYPE)
+    {
+        fprintf(stderr, "error (%d): expected datatype mismatch\n", __LINE__);
+        return -1;
+    }
+
+    result = canopy_sync(canopy, NULL);
+    CHECK_RESULT(result);
+
     result = canopy_shutdown_context(canopy);
     CHECK_RESULT(result);
 
@@ -0,0 +1,69 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tests non-blocking sync with a promise.  Syncs using the NOOP protocol.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyPromise promise;
+    RedTest test;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Initialize float32 cloud var", result == CANOPY_SUCCESS);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_SYNC_BLOCKING, false
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    promise = canopy_new_promise();
+    RedTest_Verify(test, "Create promise", promise != NULL);
+
+    result = canopy_promise_result(promise);
+    RedTest_Verify(test, "New promise is pending", result == CANOPY_ERROR_PROMISE_NOT_COMPLETE);
+
+    result = canopy_promise_wait(promise, 10);
+    RedTest_Verify(test, "Waiting on pending promise times out", result == CANOPY_ERROR_TIMED_OUT);
+
+    for (i = 0; i < 10; i++)
+    {
+        result = canopy_var_set_float32(canopy, "temperature", (float)i);
+        RedTest_Verify(test, "Set float32", result == CANOPY_SUCCESS);
+
+        result = canopy_sync(canopy, promise);
+        RedTest_Verify(test, "Start non-blocking sync", result == CANOPY_SUCCESS);
+
+        result = canopy_promise_wait(promise, 10000);
+        RedTest_Verify(test, "Wait for sync", result == CANOPY_SUCCESS);
+
+        result = canopy_promise_result(promise);
+        RedTest_Verify(test, "Sync result", result == CANOPY_SUCCESS);
+    }
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync without promise", result == CANOPY_SUCCESS);
+
+    result = canopy_sync_blocking(canopy, 10*CANOPY_SECONDS);
+    RedTest_Verify(test, "Blocking sync", result == CANOPY_SUCCESS);
+
+    canopy_free_promise(promise);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -1,6 +1,8 @@
 #include <canopy.h>
 #include "red_test.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int main(int argc, const char *argv[])
 {
@@ -68,6 +70,67 @@ int main(int argc, const char *argv[])
                 3, CANOPY_READ_FLOAT64(&readFloat64)));
     RedTest_Verify(test, "readFloat64 correct value", readFloat64 == 143.04040);
 
+    result = canopy_var_get(canopy, "float64_ary",
+            CANOPY_READ_ARRAY(
+                4, CANOPY_READ_FLOAT64(&readFloat64)));
+    RedTest_Verify(test, "Unset element not readable", result == CANOPY_ERROR_VARIABLE_NOT_SET);
+
+    result = canopy_var_set(canopy, "float64_ary",
+        CANOPY_VALUE_ARRAY(
+            0, CANOPY_VALUE_BOOL(true)
+        )
+    );
+    RedTest_Verify(test, "Element datatype checked", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+
+    char *readString;
+    result = canopy_var_set(canopy, "string_ary",
+        CANOPY_VALUE_ARRAY(
+            5, CANOPY_VALUE_STRING("first")
+        )
+    );
+    result = canopy_var_set(canopy, "string_ary",
+        CANOPY_VALUE_ARRAY(
+            5, CANOPY_VALUE_STRING("second")
+        )
+    );
+    RedTest_Verify(test, "Overwrite string element", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get(canopy, "string_ary",
+            CANOPY_READ_ARRAY(
+                5, CANOPY_READ_STRING(&readString)));
+    RedTest_Verify(test, "String[5] correct value", result == CANOPY_SUCCESS && !strcmp(readString, "second"));
+    free(readString);
+
+    double frame[3] = {1.5, 2.5, 3.5};
+    double readFrame[4];
+    result = canopy_var_set_array_float64(canopy, "float64_ary", frame, 2, 3);
+    RedTest_Verify(test, "Bulk set float64 elements", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get_array_float64(canopy, "float64_ary", readFrame, 2, 3);
+    RedTest_Verify(test, "Bulk get float64 elements", result == CANOPY_SUCCESS &&
+            readFrame[0] == 1.5 && readFrame[1] == 2.5 && readFrame[2] == 3.5);
+
+    result = canopy_var_get_array_float64(canopy, "float64_ary", readFrame, 1, 4);
+    RedTest_Verify(test, "Bulk get of unset element fails", result == CANOPY_ERROR_VARIABLE_NOT_SET);
+
+    result = canopy_var_set_array_float64(canopy, "float64_ary", frame, 4, 3);
+    RedTest_Verify(test, "Bulk set out of bounds", result == CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS);
+
+    bool bools[4] = {false, true, false, true};
+    result = canopy_var_set_array_bool(canopy, "float64_ary", bools, 0, 4);
+    RedTest_Verify(test, "Bulk set checks datatype", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+
+    result = canopy_var_handle_set_array_bool(canopy_var_handle(canopy, "bool_ary"), bools, 0, 4);
+    RedTest_Verify(test, "Bulk set bool elements by handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get(canopy, "bool_ary",
+            CANOPY_READ_ARRAY(
+                1, CANOPY_READ_BOOL(&readBool1)));
+    RedTest_Verify(test, "Bulk-set element readable", result == CANOPY_SUCCESS && readBool1 == true);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync after bulk set", result == CANOPY_SUCCESS);
+
     result = canopy_shutdown_context(canopy);
     RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
 
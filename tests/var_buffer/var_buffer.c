@@ -0,0 +1,173 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "cloudvar/st_cloudvar.h"
+#include "codec/st_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Encode <var>'s value as it would go out in the next payload, and start
+// decoding it.  Returns the JSON, which the caller frees, or NULL.
+static char * _encode(CanopyVar var, STDecoder decoder)
+{
+    STEncoder encoder;
+    char *json = NULL;
+
+    encoder = st_encoder_new(CANOPY_ENCODING_JSON);
+    if (!encoder)
+    {
+        return NULL;
+    }
+    st_cloudvar_lock(var);
+    if (st_cloudvar_encode(encoder, var) == CANOPY_SUCCESS)
+    {
+        json = strdup(st_encoder_bytes(encoder));
+    }
+    st_cloudvar_unlock(var);
+    st_encoder_free(encoder);
+
+    if (json && st_decoder_init(decoder, CANOPY_ENCODING_JSON, json, strlen(json)) != CANOPY_SUCCESS)
+    {
+        free(json);
+        json = NULL;
+    }
+    return json;
+}
+
+// Read the start of the next {"t" : TIMESTAMP, "v" : VALUE} sample, up to
+// its value.  Checks that its timestamp isn't older than <lastTime>, which is
+// then updated.
+static bool _next_sample(STDecoder decoder, char *lastTime, size_t len)
+{
+    const char *time;
+
+    if (st_decoder_next(decoder) != ST_TOKEN_BEGIN_OBJECT ||
+            st_decoder_next(decoder) != ST_TOKEN_KEY ||
+            strcmp(st_decoder_string(decoder), "t") ||
+            st_decoder_next(decoder) != ST_TOKEN_STRING)
+    {
+        return false;
+    }
+    time = st_decoder_string(decoder);
+    if (strcmp(time, lastTime) < 0 || strlen(time) >= len)
+    {
+        return false;
+    }
+    strcpy(lastTime, time);
+    return st_decoder_next(decoder) == ST_TOKEN_KEY &&
+        !strcmp(st_decoder_string(decoder), "v");
+}
+
+// Tests buffering of samples between syncs with CANOPY_VAR_BUFFER_SAMPLES.
+// Syncs using the NOOP protocol.  Checks the batched payload through the
+// cloudvar encoder, so it includes internal headers.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    float readVibration;
+    char *readStatus;
+    int i;
+    STDecoder_t decoder;
+    char *json;
+    char lastTime[40];
+    double number;
+    bool ok;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_var_init(canopy, "out float32 vibration",
+            CANOPY_VAR_BUFFER_SAMPLES, 16);
+    RedTest_Verify(test, "Initialize buffered float32 cloud var", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out string status",
+            CANOPY_VAR_BUFFER_SAMPLES, 2);
+    RedTest_Verify(test, "Initialize buffered string cloud var", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 cpu[4]",
+            CANOPY_VAR_BUFFER_SAMPLES, 16);
+    RedTest_Verify(test, "Buffering rejected for arrays", result == CANOPY_ERROR_INVALID_OPT);
+
+    result = canopy_var_init(canopy, "out float32 humidity",
+            CANOPY_VAR_BUFFER_SAMPLES, -1);
+    RedTest_Verify(test, "Negative buffer size rejected", result == CANOPY_ERROR_INVALID_VALUE);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    // Overflow the buffer a few times over.
+    for (i = 0; i < 100; i++)
+    {
+        result = canopy_var_set_float32(canopy, "vibration", (float)i);
+        if (result != CANOPY_SUCCESS)
+            break;
+    }
+    RedTest_Verify(test, "Set buffered float32", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get_float32(canopy, "vibration", &readVibration);
+    RedTest_Verify(test, "Get returns latest sample", result == CANOPY_SUCCESS && readVibration == 99.0f);
+
+    result = canopy_var_set_string(canopy, "status", "starting");
+    RedTest_Verify(test, "Set buffered string", result == CANOPY_SUCCESS);
+    result = canopy_var_set_string(canopy, "status", "running");
+    RedTest_Verify(test, "Set buffered string again", result == CANOPY_SUCCESS);
+    result = canopy_var_set_string(canopy, "status", "idle");
+    RedTest_Verify(test, "Overwrite oldest string sample", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get_string(canopy, "status", &readStatus);
+    RedTest_Verify(test, "Get buffered string", result == CANOPY_SUCCESS && !strcmp(readStatus, "idle"));
+    free(readStatus);
+
+    // The payload holds the 16 most recent samples, oldest first.
+    json = _encode(canopy_var_handle(canopy, "vibration"), &decoder);
+    ok = json && st_decoder_next(&decoder) == ST_TOKEN_BEGIN_ARRAY;
+    lastTime[0] = '\0';
+    for (i = 84; ok && i < 100; i++)
+    {
+        ok = _next_sample(&decoder, lastTime, sizeof(lastTime)) &&
+            st_decoder_next(&decoder) == ST_TOKEN_NUMBER &&
+            st_decoder_number(&decoder, &number) && number == (double)i &&
+            st_decoder_next(&decoder) == ST_TOKEN_END_OBJECT;
+    }
+    ok = ok && st_decoder_next(&decoder) == ST_TOKEN_END_ARRAY;
+    RedTest_Verify(test, "Float32 samples batched in order", ok);
+    free(json);
+
+    json = _encode(canopy_var_handle(canopy, "status"), &decoder);
+    ok = json && st_decoder_next(&decoder) == ST_TOKEN_BEGIN_ARRAY;
+    lastTime[0] = '\0';
+    ok = ok && _next_sample(&decoder, lastTime, sizeof(lastTime)) &&
+        st_decoder_next(&decoder) == ST_TOKEN_STRING &&
+        !strcmp(st_decoder_string(&decoder), "running") &&
+        st_decoder_next(&decoder) == ST_TOKEN_END_OBJECT;
+    ok = ok && _next_sample(&decoder, lastTime, sizeof(lastTime)) &&
+        st_decoder_next(&decoder) == ST_TOKEN_STRING &&
+        !strcmp(st_decoder_string(&decoder), "idle") &&
+        st_decoder_next(&decoder) == ST_TOKEN_END_OBJECT &&
+        st_decoder_next(&decoder) == ST_TOKEN_END_ARRAY;
+    RedTest_Verify(test, "String samples batched in order", ok);
+    free(json);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    result = canopy_var_set_float32(canopy, "vibration", 1.5f);
+    RedTest_Verify(test, "Set after sync", result == CANOPY_SUCCESS);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync again", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
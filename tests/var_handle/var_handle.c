@@ -0,0 +1,114 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tests handle-based access to the local copy of cloud variables.  Doesn't
+// "sync" w/ server.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    CanopyVar temperature, status;
+    float readTemperature;
+    char *readStatus;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_var_init(canopy, "inout float32 temperature");
+    RedTest_Verify(test, "Initialize float32 cloud var", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out string status");
+    RedTest_Verify(test, "Initialize string cloud var", result == CANOPY_SUCCESS);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    RedTest_Verify(test, "Handle to uninitialized var is NULL",
+            canopy_var_handle(canopy, "humidity") == NULL);
+
+    temperature = canopy_var_handle(canopy, "temperature");
+    RedTest_Verify(test, "Get float32 handle", temperature != NULL);
+
+    status = canopy_var_handle(canopy, "status");
+    RedTest_Verify(test, "Get string handle", status != NULL);
+
+    result = canopy_var_handle_get_float32(temperature, &readTemperature);
+    RedTest_Verify(test, "Get before set fails", result == CANOPY_ERROR_VARIABLE_NOT_SET);
+
+    for (i = 0; i < 1000; i++)
+    {
+        result = canopy_var_handle_set_float32(temperature, (float)i);
+        if (result != CANOPY_SUCCESS)
+            break;
+    }
+    RedTest_Verify(test, "Set float32 via handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_handle_get_float32(temperature, &readTemperature);
+    RedTest_Verify(test, "Get float32 via handle", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Float32 matches", readTemperature == 999.0f);
+
+    result = canopy_var_get_float32(canopy, "temperature", &readTemperature);
+    RedTest_Verify(test, "Get float32 by name", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Float32 by name matches", readTemperature == 999.0f);
+
+    result = canopy_var_handle_set_int8(temperature, 4);
+    RedTest_Verify(test, "Datatype mismatch rejected", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+
+    result = canopy_var_handle_set_string(status, "running");
+    RedTest_Verify(test, "Set string via handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_handle_set(status, CANOPY_VALUE_STRING("idle"));
+    RedTest_Verify(test, "Set CanopyVarValue via handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_handle_get_string(status, &readStatus);
+    RedTest_Verify(test, "Get string via handle", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "String matches", !strcmp(readStatus, "idle"));
+    free(readStatus);
+
+    // Values and readers are recycled after use, so a long loop of
+    // CANOPY_VALUE_* / CANOPY_READ_* calls neither leaks nor grows.
+    for (i = 0; i < 10000; i++)
+    {
+        result = canopy_var_handle_set(temperature, CANOPY_VALUE_FLOAT32((float)i));
+        if (result != CANOPY_SUCCESS)
+            break;
+        result = canopy_var_handle_get(temperature, CANOPY_READ_FLOAT32(&readTemperature));
+        if (result != CANOPY_SUCCESS || readTemperature != (float)i)
+            break;
+        result = canopy_var_set(canopy, "status", CANOPY_VALUE_STRING("busy"));
+        if (result != CANOPY_SUCCESS)
+            break;
+    }
+    RedTest_Verify(test, "Set & get with pooled values", result == CANOPY_SUCCESS && i == 10000);
+
+    CanopyVarValue value = CANOPY_VALUE_FLOAT32(1.0f);
+    result = canopy_var_handle_set(temperature, value);
+    RedTest_Verify(test, "Set with value", result == CANOPY_SUCCESS);
+
+    CanopyVarReader reader = CANOPY_READ_FLOAT32(&readTemperature);
+    result = canopy_var_handle_get(temperature, reader);
+    RedTest_Verify(test, "Get with reader", result == CANOPY_SUCCESS && readTemperature == 1.0f);
+
+    result = canopy_var_set(canopy, "humidity", CANOPY_VALUE_FLOAT32(50.0f));
+    RedTest_Verify(test, "Set unknown var consumes value", result == CANOPY_ERROR_VARIABLE_NOT_INITIALIZED);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,105 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_VARS 5000
+
+// Initializes a large number of Cloud Variables of every kind, and shuts the
+// context down, freeing them.  Syncs using the NOOP protocol.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    char decl[64];
+    char name[32];
+    char *readString;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        switch (i % 4)
+        {
+            case 0:
+                snprintf(decl, sizeof(decl), "out float32 temperature_%d", i);
+                result = canopy_var_init(canopy, decl);
+                break;
+            case 1:
+                snprintf(decl, sizeof(decl), "out string status_%d", i);
+                result = canopy_var_init(canopy, decl, CANOPY_VAR_BUFFER_SAMPLES, 4);
+                break;
+            case 2:
+                snprintf(decl, sizeof(decl), "out string[8] labels_%d", i);
+                result = canopy_var_init(canopy, decl);
+                break;
+            case 3:
+                snprintf(decl, sizeof(decl), "out struct gps_%d", i);
+                result = canopy_var_init(canopy, decl,
+                        CANOPY_INIT_FIELD("float32 latitude"),
+                        CANOPY_INIT_FIELD("float32 longitude"),
+                        CANOPY_INIT_FIELD("struct status",
+                            CANOPY_INIT_FIELD("string message")
+                        )
+                );
+                break;
+        }
+        if (result != CANOPY_SUCCESS)
+            break;
+    }
+    RedTest_Verify(test, "Initialize many cloud vars", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature_0");
+    RedTest_Verify(test, "Duplicate rejected", result == CANOPY_ERROR_VARIABLE_ALREADY_INITIALIZED);
+
+    result = canopy_var_init(canopy, "out struct dup",
+            CANOPY_INIT_FIELD("float32 x"),
+            CANOPY_INIT_FIELD("float32 x")
+    );
+    RedTest_Verify(test, "Duplicate member rejected", result == CANOPY_ERROR_BAD_VARIABLE_DECLARATION);
+
+    for (i = 1; i < NUM_VARS; i += 4)
+    {
+        snprintf(name, sizeof(name), "status_%d", i);
+        result = canopy_var_set_string(canopy, name, "ok");
+        if (result != CANOPY_SUCCESS)
+            break;
+    }
+    RedTest_Verify(test, "Set strings", result == CANOPY_SUCCESS);
+
+    result = canopy_var_set(canopy, "labels_2",
+        CANOPY_VALUE_ARRAY(
+            7, CANOPY_VALUE_STRING("last")
+        )
+    );
+    RedTest_Verify(test, "Set string array element", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get_string(canopy, "status_4997", &readString);
+    RedTest_Verify(test, "Get string", result == CANOPY_SUCCESS && !strcmp(readString, "ok"));
+    free(readString);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    result = canopy_var_set_string(canopy, "status_1", "still ok");
+    RedTest_Verify(test, "Set after sync", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
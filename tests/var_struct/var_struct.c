@@ -2,6 +2,11 @@
 #include "red_test.h"
 #include <stdio.h>
 
+static int _on_member_change(CanopyContext ctx, const char *varname, void *userdata)
+{
+    return 0;
+}
+
 int main(int argc, const char *argv[])
 {
     CanopyContext canopy;
@@ -67,6 +72,39 @@ int main(int argc, const char *argv[])
     result = canopy_sync(canopy, NULL);
     RedTest_Verify(test, "sync", result == CANOPY_SUCCESS);
 
+    CanopyVar gps = canopy_var_handle(canopy, "gps");
+    RedTest_Verify(test, "Struct has 4 members", canopy_var_num_members(gps) == 4);
+    RedTest_Verify(test, "Members in declaration order",
+            canopy_var_member_index(gps, "latitude") == 0 &&
+            canopy_var_member_index(gps, "longitude") == 1 &&
+            canopy_var_member_index(gps, "altitude") == 2 &&
+            canopy_var_member_index(gps, "status") == 3);
+    RedTest_Verify(test, "Unknown member", canopy_var_member_index(gps, "speed") == -1);
+    RedTest_Verify(test, "Member index out of range", canopy_var_member_at(gps, 4) == NULL);
+
+    CanopyVar altitude = canopy_var_member(gps, "altitude");
+    RedTest_Verify(test, "Member handle", altitude && altitude == canopy_var_member_at(gps, 2));
+
+    result = canopy_var_handle_set_float32(altitude, 12.5f);
+    RedTest_Verify(test, "Set member by handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get(canopy, "gps", CANOPY_READ_STRUCT("altitude", CANOPY_READ_FLOAT32(&val)));
+    RedTest_Verify(test, "Member set by handle readable", result == CANOPY_SUCCESS && val == 12.5f);
+
+    CanopyVar ok = canopy_var_member(canopy_var_member_at(gps, 3), "ok");
+    bool readOk;
+    result = canopy_var_handle_get_bool(ok, &readOk);
+    RedTest_Verify(test, "Nested member by handle", result == CANOPY_SUCCESS && readOk == true);
+
+    result = canopy_var_handle_on_change(altitude, _on_member_change, NULL);
+    RedTest_Verify(test, "on_change on member handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_handle_on_change(ok, _on_member_change, NULL);
+    RedTest_Verify(test, "on_change on nested member handle", result == CANOPY_SUCCESS);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "sync", result == CANOPY_SUCCESS);
+
     result = canopy_shutdown_context(canopy);
     RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
 
@@ -0,0 +1,149 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_WRITERS 4
+#define NUM_SETS 10000
+
+typedef struct
+{
+    CanopyContext canopy;
+    const char *varname;
+    CanopyResultEnum result;
+} Writer_t;
+
+static void * _writer_main(void *arg)
+{
+    Writer_t *writer = (Writer_t *)arg;
+    int i;
+
+    writer->result = CANOPY_SUCCESS;
+    for (i = 1; i <= NUM_SETS; i++)
+    {
+        writer->result = canopy_var_set_int32(writer->canopy, writer->varname, i);
+        if (writer->result != CANOPY_SUCCESS)
+            break;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    CanopyVar var;
+    volatile bool stop;
+    bool ok;
+} Reader_t;
+
+// Reads a variable that another thread is setting to 1, 2, 3, ...  Reads
+// don't take a lock, but must never see a value go backwards.
+static void * _reader_main(void *arg)
+{
+    Reader_t *reader = (Reader_t *)arg;
+    int32_t value;
+    int32_t last = 0;
+
+    reader->ok = true;
+    while (!reader->stop)
+    {
+        CanopyResultEnum result = canopy_var_handle_get_int32(reader->var, &value);
+        if (result == CANOPY_ERROR_VARIABLE_NOT_SET)
+            continue;
+        if (result != CANOPY_SUCCESS || value < last || value > NUM_SETS)
+        {
+            reader->ok = false;
+            break;
+        }
+        last = value;
+    }
+    return NULL;
+}
+
+// Tests setting different cloud variables from several threads while
+// another thread syncs.  Syncs using the NOOP protocol.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    Writer_t writers[NUM_WRITERS];
+    pthread_t threads[NUM_WRITERS];
+    Reader_t reader;
+    pthread_t readerThread;
+    const char *varnames[NUM_WRITERS] = {"w0", "w1", "w2", "w3"};
+    char decl[32];
+    bool allSet;
+    int32_t readValue;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    // Variables are initialized before any other thread uses the context.
+    result = CANOPY_SUCCESS;
+    for (i = 0; i < NUM_WRITERS && result == CANOPY_SUCCESS; i++)
+    {
+        snprintf(decl, sizeof(decl), "out int32 %s", varnames[i]);
+        result = canopy_var_init(canopy, decl);
+    }
+    RedTest_Verify(test, "Initialize cloud vars", result == CANOPY_SUCCESS);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    reader.var = canopy_var_handle(canopy, "w0");
+    reader.stop = false;
+    pthread_create(&readerThread, NULL, _reader_main, &reader);
+
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        writers[i].canopy = canopy;
+        writers[i].varname = varnames[i];
+        pthread_create(&threads[i], NULL, _writer_main, &writers[i]);
+    }
+
+    // Sync while the writers are busy.
+    result = CANOPY_SUCCESS;
+    for (i = 0; i < 20 && result == CANOPY_SUCCESS; i++)
+    {
+        result = canopy_sync(canopy, NULL);
+    }
+    RedTest_Verify(test, "Sync during concurrent sets", result == CANOPY_SUCCESS);
+
+    allSet = true;
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        allSet = allSet && (writers[i].result == CANOPY_SUCCESS);
+    }
+    RedTest_Verify(test, "Concurrent sets", allSet);
+
+    reader.stop = true;
+    pthread_join(readerThread, NULL);
+    RedTest_Verify(test, "Lock-free reads during sets", reader.ok);
+
+    allSet = true;
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        result = canopy_var_get_int32(canopy, varnames[i], &readValue);
+        allSet = allSet && result == CANOPY_SUCCESS && readValue == NUM_SETS;
+    }
+    RedTest_Verify(test, "Each var holds its last value", allSet);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Final sync", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}